@@ -1,6 +1,8 @@
 import os
 import json
+import socket
 import subprocess
+import threading
 from datetime import datetime
 from flask import Flask, request, jsonify, send_from_directory
 from flask_cors import CORS
@@ -14,6 +16,7 @@ CORS(app)
 # =======================
 USE_DB = os.environ.get('USE_DB', 'false').lower() == 'true'
 DATABASE_URL = os.environ.get('DATABASE_URL', 'sqlite:///data.db')
+FLASK_DEBUG = True  # debug mode, with the reloader
 
 # ADMIN CREDENTIALS - CHANGE THESE!
 ADMIN_PASSWORD = os.environ.get('ADMIN_PASSWORD', 'admin123')
@@ -31,18 +34,118 @@ else:
 # =======================
 # C++ Backend Integration
 # =======================
-def call_cpp_logic(cmd_data):
-    """Call the C++ backend with JSON input and get JSON output"""
-    binary = './backend/logic.exe' if os.name == 'nt' else './backend/logic'
+# By default the C++ backend runs as one long-lived `logic --serve` process
+# that keeps all data in memory and answers one JSON line per command.
+# Set CPP_DAEMON=false to go back to spawning a process for every call, or
+# CPP_SOCKET=/path/to/logic.sock to talk to a daemon started separately with
+# `backend/logic --serve --socket /path/to/logic.sock`.
+CPP_BINARY = './backend/logic.exe' if os.name == 'nt' else './backend/logic'
+CPP_DAEMON = os.environ.get('CPP_DAEMON', 'true').lower() == 'true'
+CPP_SOCKET = os.environ.get('CPP_SOCKET', '')
+CPP_TIMEOUT = 10  # seconds to wait for one response
+
+class LogicDaemon:
+    """Persistent connection to a `logic --serve` process (pipe or socket)."""
+
+    def __init__(self, socket_path=''):
+        self.socket_path = socket_path
+        self.lock = threading.Lock()
+        self.proc = None
+        self.sock = None
+        self.reader = None
+        self.writer = None
+        self.timed_out = False
+
+    def _connect(self):
+        if self.socket_path:
+            self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.sock.connect(self.socket_path)
+            self.reader = self.sock.makefile('r', encoding='utf-8')
+            self.writer = self.sock.makefile('w', encoding='utf-8')
+        else:
+            self.proc = subprocess.Popen(
+                [CPP_BINARY, '--serve'],
+                stdin=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                text=True,
+                bufsize=1
+            )
+            self.reader = self.proc.stdout
+            self.writer = self.proc.stdin
+
+    def _close(self):
+        for stream in (self.writer, self.reader):
+            try:
+                if stream:
+                    stream.close()
+            except Exception:
+                pass
+        if self.sock:
+            self.sock.close()
+        if self.proc:
+            self.proc.kill()
+            self.proc.wait()
+        self.proc = self.sock = self.reader = self.writer = None
+
+    def _abort(self):
+        # Called from a timer while call() waits; unblocks its readline
+        self.timed_out = True
+        try:
+            if self.proc:
+                self.proc.kill()
+            if self.sock:
+                self.sock.shutdown(socket.SHUT_RDWR)
+        except Exception:
+            pass
+
+    def call(self, cmd_data):
+        """Raises only if the command never reached the daemon. Once it has
+        been written it is not sent again, as it may already have run."""
+        with self.lock:
+            for attempt in range(2):
+                try:
+                    if self.writer is None:
+                        self._connect()
+                    self.writer.write(json.dumps(cmd_data) + '\n')
+                    self.writer.flush()
+                    break
+                except Exception as e:
+                    # A daemon that died since the last call; reconnect once
+                    self._close()
+                    if attempt == 1:
+                        raise e
+            self.timed_out = False
+            timer = threading.Timer(CPP_TIMEOUT, self._abort)
+            timer.start()
+            try:
+                line = self.reader.readline()
+            except Exception:
+                line = ''
+            finally:
+                timer.cancel()
+            if not line:
+                self._close()
+                if self.timed_out:
+                    return {'error': 'C++ computation timeout'}
+                return {'error': 'C++ daemon closed the connection'}
+            try:
+                return json.loads(line)
+            except json.JSONDecodeError:
+                return {'error': f'Invalid C++ output: {line.strip()}'}
+
+logic_daemon = LogicDaemon(CPP_SOCKET) if (CPP_DAEMON or CPP_SOCKET) else None
+
+def call_cpp_logic_once(cmd_data):
+    """Spawn the C++ backend for a single command (no daemon)"""
     try:
         result = subprocess.run(
-            [binary],
+            [CPP_BINARY],
             input=json.dumps(cmd_data),
             capture_output=True,
             text=True,
-            timeout=10
+            timeout=CPP_TIMEOUT
         )
-        if result.returncode != 0:
+        if result.returncode != 0 and not result.stdout.startswith('{"error"'):
             return {'error': f'C++ error: {result.stderr.strip()}'}
         return json.loads(result.stdout)
     except subprocess.TimeoutExpired:
@@ -52,9 +155,53 @@ def call_cpp_logic(cmd_data):
     except Exception as e:
         return {'error': str(e)}
 
+def call_cpp_logic(cmd_data):
+    """Call the C++ backend with JSON input and get JSON output"""
+    if logic_daemon is not None:
+        try:
+            return logic_daemon.call(cmd_data)
+        except Exception:
+            # Daemon unavailable; fall back to a one-shot process
+            pass
+    return call_cpp_logic_once(cmd_data)
+
+def call_cpp_logic_batch(cmds):
+    """Run a list of commands against one backend state; one result per command.
+
+    Without the daemon this is a single `logic --batch` process instead of
+    one process (and one load + persist) per command.
+    """
+    if not cmds:
+        return []
+    if logic_daemon is not None:
+        return [call_cpp_logic(cmd) for cmd in cmds]
+    try:
+        result = subprocess.run(
+            [CPP_BINARY, '--batch'],
+            input=''.join(json.dumps(cmd) + '\n' for cmd in cmds),
+            capture_output=True,
+            text=True,
+            timeout=60
+        )
+        return json.loads(result.stdout)
+    except subprocess.TimeoutExpired:
+        return [{'error': 'C++ computation timeout'}] * len(cmds)
+    except Exception as e:
+        return [{'error': str(e)}] * len(cmds)
+
 # =======================
 # Helper Functions
 # =======================
+def list_args(*keys):
+    """Paging (limit, cursor) and filter query parameters for getAll* commands"""
+    return {key: request.args[key] for key in keys if request.args.get(key)}
+
+def list_result(result):
+    """A full listing is a list; a page is {'items', 'count', 'nextCursor'}"""
+    if isinstance(result, list) or (isinstance(result, dict) and 'items' in result):
+        return result
+    return []
+
 def load_routes_from_file():
     routes = []
     try:
@@ -171,8 +318,8 @@ def list_users():
     if password != ADMIN_PASSWORD:
         return jsonify({'error': 'Unauthorized'}), 401
     
-    result = call_cpp_logic({'cmd': 'getAllUsers'})
-    return jsonify(result if isinstance(result, list) else [])
+    result = call_cpp_logic({'cmd': 'getAllUsers', **list_args('limit', 'cursor')})
+    return jsonify(list_result(result))
 
 # =======================
 # Seat Management APIs
@@ -290,8 +437,11 @@ def list_bookings():
     if password != ADMIN_PASSWORD:
         return jsonify({'error': 'Unauthorized'}), 401
     
-    result = call_cpp_logic({'cmd': 'getAllBookings'})
-    return jsonify(result if isinstance(result, list) else [])
+    result = call_cpp_logic({
+        'cmd': 'getAllBookings',
+        **list_args('limit', 'cursor', 'routeID', 'status', 'userID')
+    })
+    return jsonify(list_result(result))
 
 @app.route('/api/getUserBookings/<user_id>', methods=['GET'])
 def get_user_bookings(user_id):
@@ -302,6 +452,18 @@ def get_user_bookings(user_id):
     
     return jsonify(result if isinstance(result, list) else [])
 
+@app.route('/api/routeManifest/<int:route_id>', methods=['GET'])
+def route_manifest(route_id):
+    password = request.args.get('password')
+    if password != ADMIN_PASSWORD:
+        return jsonify({'error': 'Unauthorized'}), 401
+    
+    result = call_cpp_logic({
+        'cmd': 'getRouteManifest',
+        'routeID': str(route_id)
+    })
+    return jsonify(result)
+
 # =======================
 # Seat Reservation APIs
 # =======================
@@ -314,11 +476,14 @@ def reserve_seat():
     if not seat_id or not user_id:
         return jsonify({'error': 'Invalid request'}), 400
     
-    result = call_cpp_logic({
+    command = {
         'cmd': 'reserveSeat',
         'seatID': seat_id,
         'userID': user_id
-    })
+    }
+    if data.get('ttlSeconds') is not None:
+        command['ttlSeconds'] = str(data['ttlSeconds'])
+    result = call_cpp_logic(command)
     
     if 'error' in result:
         return jsonify(result), 400
@@ -349,12 +514,8 @@ def release_seat():
 @app.route('/api/listRoutes', methods=['GET'])
 def list_routes():
     routes = load_routes_from_file()
-    # Initialize seats for each route
-    for route in routes:
-        call_cpp_logic({
-            'cmd': 'initSeats',
-            'routeID': str(route['id'])
-        })
+    # Create seats for routes that don't have any yet
+    call_cpp_logic({'cmd': 'initAllSeats'})
     return jsonify(routes)
 
 @app.route('/api/addRoute', methods=['POST'])
@@ -403,6 +564,7 @@ def remove_route():
 def search_route():
     from_city = request.args.get('from', '').strip()
     to_city = request.args.get('to', '').strip()
+    criteria = request.args.get('criteria', 'distance').strip()
     
     if not from_city or not to_city:
         return jsonify({'error': 'Missing from or to parameter'}), 400
@@ -410,13 +572,110 @@ def search_route():
     result = call_cpp_logic({
         'cmd': 'findRoute',
         'from': from_city,
-        'to': to_city
+        'to': to_city,
+        'criteria': criteria
+    })
+    
+    if 'error' in result:
+        return jsonify(result), 404
+    return jsonify(result)
+
+@app.route('/api/searchTrip', methods=['GET'])
+def search_trip():
+    from_city = request.args.get('from', '').strip()
+    to_city = request.args.get('to', '').strip()
+    
+    if not from_city or not to_city:
+        return jsonify({'error': 'Missing from or to parameter'}), 400
+    
+    # With `until`, every worthwhile departure between time and until
+    cmd = {'cmd': 'findTripProfile' if request.args.get('until') else 'findTrip',
+           'from': from_city, 'to': to_city}
+    for key in ('date', 'time', 'until'):
+        if request.args.get(key):
+            cmd[key] = request.args.get(key)
+    result = call_cpp_logic(cmd)
+    
+    if 'error' in result:
+        return jsonify(result), 404
+    return jsonify(result)
+
+@app.route('/api/tripSeats/<trip_id>', methods=['GET'])
+def get_trip_seats(trip_id):
+    result = call_cpp_logic({
+        'cmd': 'getTripSeats',
+        'tripID': trip_id,
+        'date': request.args.get('date', ''),
+        'from': request.args.get('from', ''),
+        'to': request.args.get('to', '')
     })
     
     if 'error' in result:
         return jsonify(result), 404
     return jsonify(result)
 
+@app.route('/api/bookTrip', methods=['POST'])
+def book_trip():
+    data = request.json
+    trip_id = data.get('tripID', '').strip()
+    date = data.get('date', '').strip()
+    user_id = data.get('userID', '').strip()
+    seat_ids = data.get('seatIDs', [])
+    price_per_seat = data.get('pricePerSeat', 0)
+    
+    if not trip_id or not date or not user_id or not seat_ids:
+        return jsonify({'error': 'Invalid booking data'}), 400
+    
+    result = call_cpp_logic({
+        'cmd': 'bookTripSeats',
+        'tripID': trip_id,
+        'date': date,
+        'from': data.get('from', '').strip(),
+        'to': data.get('to', '').strip(),
+        'routeInfo': data.get('route_info', ''),
+        'userID': user_id,
+        'seatIDs': seat_ids,
+        'pricePerSeat': str(price_per_seat)
+    })
+    
+    if 'error' in result:
+        return jsonify(result), 400
+    return jsonify(result)
+
+@app.route('/api/suggestStops', methods=['GET'])
+def suggest_stops():
+    query = request.args.get('q', '').strip()
+    limit = request.args.get('limit', 10, type=int)
+    
+    if not query:
+        return jsonify({'suggestions': []})
+    
+    result = call_cpp_logic({
+        'cmd': 'suggestStops',
+        'query': query,
+        'limit': str(limit)
+    })
+    return jsonify(result)
+
+@app.route('/api/nearestStops', methods=['GET'])
+def nearest_stops():
+    lat = request.args.get('lat', type=float)
+    lng = request.args.get('lng', type=float)
+    
+    if lat is None or lng is None:
+        return jsonify({'error': 'Missing lat or lng parameter'}), 400
+    
+    cmd = {'cmd': 'nearestStops', 'lat': str(lat), 'lng': str(lng)}
+    if request.args.get('k'):
+        cmd['k'] = request.args.get('k')
+    if request.args.get('radiusKm'):
+        cmd['radiusKm'] = request.args.get('radiusKm')
+    
+    result = call_cpp_logic(cmd)
+    if 'error' in result:
+        return jsonify(result), 400
+    return jsonify(result)
+
 # =======================
 # Admin APIs
 # =======================
@@ -447,13 +706,12 @@ if __name__ == '__main__':
     print(f"Running in FILE mode with C++ backend")
     print(f"Admin password: {ADMIN_PASSWORD}")
     
-    # Initialize seats for existing routes
-    routes = load_routes_from_file()
-    for route in routes:
-        call_cpp_logic({
-            'cmd': 'initSeats',
-            'routeID': str(route['id'])
-        })
-    print(f"Initialized seats for {len(routes)} routes")
+    # With debug on, Werkzeug's reloader runs this block both in a watcher
+    # process and in the child that serves. Only the serving process may
+    # start the daemon: it holds backend/data.lock for as long as it lives.
+    if not FLASK_DEBUG or os.environ.get('WERKZEUG_RUN_MAIN') == 'true':
+        # Create seats for routes that don't have any yet
+        result = call_cpp_logic({'cmd': 'initAllSeats'})
+        print(f"Initialized seats for {len(result.get('initialized', []))} of {result.get('routes', 0)} routes")
     
-    app.run(host='0.0.0.0', port=5000, debug=True)
\ No newline at end of file
+    app.run(host='0.0.0.0', port=5000, debug=FLASK_DEBUG)
\ No newline at end of file
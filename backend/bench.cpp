@@ -0,0 +1,580 @@
+// Microbenchmarks for the hot paths in logic.cpp.
+//
+// Generates deterministic synthetic datasets (a grid of stops, routes.txt
+// lines with coordinates, users, bookings and seats) at each requested
+// scale in a scratch directory, then times loading, route search,
+// booking, seat counts and the JSON serializers against them. Prints one
+// JSON line per benchmark:
+//
+//   {"bench":"findRoutePath","scale":10000,"ops":..,"nsPerOp":..,
+//    "allocsPerOp":..,"peakRssKB":..}
+//
+// followed by a summary line. Scale N means N seats (40 per route), N/10
+// routes.txt lines over N/40 stops, N/10 users, N/10 bookings and N
+// timetable connections. Loads count one op per record; everything else
+// one op per call.
+//
+// Usage (after `make bench`, or through it with BENCH_ARGS="..."):
+//   backend/bench [--scales 1000,10000,100000] [--budget-ms 500]
+//   backend/bench > baseline.ndjson
+//   backend/bench --baseline baseline.ndjson [--threshold 1.25]
+//
+// With --baseline, each result is compared with the saved run at the same
+// scale. One that is more than threshold times slower is flagged, and the
+// exit status is 1.
+
+#define LOGIC_NO_MAIN
+#include "logic.cpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// ========================
+// Allocation Counting
+// ========================
+// Every operator new in the process goes through here. The benchmarks run
+// on one thread, so a relaxed counter is enough.
+
+atomic<uint64_t> allocCount{0};
+
+void* countedAlloc(size_t n) {
+    allocCount.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t n) { return countedAlloc(n); }
+void* operator new[](size_t n) { return countedAlloc(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// ========================
+// Peak RSS
+// ========================
+// On Linux the high-water mark can be reset, so each benchmark reports its
+// own peak. Elsewhere the process-wide peak is reported.
+
+void resetPeakRss() {
+    ofstream clear("/proc/self/clear_refs");
+    if (clear.is_open()) clear << "5";
+}
+
+long peakRssKB() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return stol(line.substr(6));
+    }
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+// ========================
+// Synthetic Datasets
+// ========================
+
+struct Dataset {
+    long long scale = 0;
+    int stops = 0;
+    int routeLines = 0;
+    int seatRoutes = 0;
+    int users = 0;
+    int bookings = 0;
+    vector<string> availableSeats; // seat IDs left free, for bookSeats
+};
+
+const int BENCH_SEATS_PER_ROUTE = 40;
+
+string stopName(int stop) {
+    return "Stop " + to_string(stop);
+}
+
+// Stops sit on a square grid about 1 km apart. Routes join each stop to
+// its right and lower neighbours, then random nearby pairs make up the rest.
+void writeRoutes(Dataset& d, mt19937& rng) {
+    int width = max(2, (int)ceil(sqrt((double)d.stops)));
+    auto coord = [&](int stop, double& lat, double& lng) {
+        lat = 30.0 + (stop / width) * 0.009;
+        lng = 78.0 + (stop % width) * 0.0104;
+    };
+
+    string out;
+    char buf[256];
+    int lines = 0;
+    auto addRoute = [&](int a, int b) {
+        double lat1, lng1, lat2, lng2;
+        coord(a, lat1, lng1);
+        coord(b, lat2, lng2);
+        double km = haversineKm({lat1, lng1}, {lat2, lng2});
+        snprintf(buf, sizeof(buf), "|%.2f|%d|[{\"lat\":%.5f,\"lng\":%.5f},{\"lat\":%.5f,\"lng\":%.5f}]\n",
+                 km, 10 + (int)(km * 5), lat1, lng1, lat2, lng2);
+        out += stopName(a);
+        out += '|';
+        out += stopName(b);
+        out += buf;
+        lines++;
+    };
+
+    for (int s = 0; s < d.stops && lines < d.routeLines; s++) {
+        if (s % width + 1 < width && s + 1 < d.stops) addRoute(s, s + 1);
+        if (s + width < d.stops && lines < d.routeLines) addRoute(s, s + width);
+    }
+    uniform_int_distribution<int> anyStop(0, d.stops - 1), offset(-3, 3);
+    while (lines < d.routeLines) {
+        int a = anyStop(rng);
+        int b = a + offset(rng) * width + offset(rng);
+        if (b < 0 || b >= d.stops || b == a) continue;
+        addRoute(a, b);
+    }
+    writeFileAtomically(ROUTES_FILE, out);
+}
+
+void writeUsers(const Dataset& d) {
+    string out;
+    for (int u = 1; u <= d.users; u++) {
+        out += to_string(u) + "|User " + to_string(u) + "|user" + to_string(u) + "@example.com|1|20.00\n";
+    }
+    writeFileAtomically(USERS_FILE, out);
+}
+
+// About a quarter of the seats are booked, two per booking, and one in
+// twenty is held for a day. The rest are left available.
+void writeSeatsAndBookings(Dataset& d, mt19937& rng) {
+    string seats, bookingLines;
+    uint32_t holdUntil = holdClock() + RESERVATION_MAX_TTL;
+    uniform_int_distribution<int> anyUser(1, d.users);
+    uniform_int_distribution<int> roll(0, 99);
+    int booking = 0;
+    d.availableSeats.clear();
+
+    for (int r = 1; r <= d.seatRoutes; r++) {
+        for (int i = 0; i < BENCH_SEATS_PER_ROUTE; i++) {
+            string seatID = makeSeatID(r, i);
+            string routeID = to_string(r);
+            int dice = roll(rng);
+            if (dice < 25 && booking < d.bookings && i + 1 < BENCH_SEATS_PER_ROUTE) {
+                string bookingID = "BK" + to_string(++booking);
+                string user = to_string(anyUser(rng));
+                string second = makeSeatID(r, i + 1);
+                seats += seatID + "|Booked|" + user + "|" + routeID + "|" + bookingID + "\n";
+                seats += second + "|Booked|" + user + "|" + routeID + "|" + bookingID + "\n";
+                bookingLines += bookingID + "|" + routeID + "|" + stopName(r) + " → " + stopName(r + 1) +
+                                "|" + user + "|" + seatID + "," + second + "|20.00|2026-01-01 10:00:00|" +
+                                (dice < 2 ? "Cancelled" : "Active") + "\n";
+                i++;
+            } else if (dice < 30) {
+                seats += seatID + "|Reserved|" + to_string(anyUser(rng)) + "|" + routeID + "||" +
+                         to_string(holdUntil) + "\n";
+            } else {
+                seats += seatID + "|Available||" + routeID + "|\n";
+                d.availableSeats.push_back(seatID);
+            }
+        }
+    }
+    d.bookings = booking;
+    writeFileAtomically(SEATS_FILE, seats);
+    writeFileAtomically(BOOKINGS_FILE, bookingLines);
+}
+
+// Trips of about ten legs that wander over the route graph, starting
+// between 05:00 and 23:00; most run on weekdays only. Needs the routes
+// loaded.
+void writeTimetable(const Dataset& d, mt19937& rng) {
+    const RouteGraph& g = routeGraph;
+    uniform_int_distribution<int> anyStop(0, (int)g.stopKeys.size() - 1);
+    uniform_int_distribution<int> start(5 * 3600, 23 * 3600), ride(120, 360), weekdaysOnly(0, 9);
+    string out;
+    long long connections = 0;
+    for (int trip = 1; connections < d.scale; trip++) {
+        int stop = anyStop(rng);
+        int32_t t = start(rng);
+        const char* days = weekdaysOnly(rng) < 7 ? "1111100" : "1111111";
+        for (int leg = 0; leg < 10 && connections < d.scale; leg++) {
+            uint32_t edges = g.edgeStart[stop + 1] - g.edgeStart[stop];
+            if (edges == 0) break;
+            uint32_t e = g.edgeStart[stop] + rng() % edges;
+            int32_t arrive = t + ride(rng);
+            out += "T" + to_string(trip) + "|" + to_string(g.edgeRoute[e]) + "|" + formatClock(t) + "|" +
+                   formatClock(arrive) + "|" + days + "\n";
+            connections++;
+            stop = g.edgeTo[e];
+            t = arrive + 30;
+        }
+    }
+    writeFileAtomically(TIMETABLE_FILE, out);
+}
+
+Dataset generateDataset(long long scale) {
+    Dataset d;
+    d.scale = scale;
+    d.seatRoutes = max(1, (int)(scale / BENCH_SEATS_PER_ROUTE));
+    d.routeLines = max(d.seatRoutes + 1, (int)(scale / 10));
+    d.stops = max(16, (int)(scale / 40));
+    d.users = max(10, (int)(scale / 10));
+    d.bookings = max(1, (int)(scale / 10));
+
+    mt19937 rng(42 + (uint32_t)scale);
+    writeRoutes(d, rng);
+    writeUsers(d);
+    writeSeatsAndBookings(d, rng);
+    shuffle(d.availableSeats.begin(), d.availableSeats.end(), rng);
+    return d;
+}
+
+void removeDataset() {
+    for (const string& path : {ROUTES_FILE, USERS_FILE, BOOKINGS_FILE, SEATS_FILE, TIMETABLE_FILE,
+                               usersText.indexPath, bookingsText.indexPath, seatsText.indexPath}) {
+        remove(path.c_str());
+    }
+}
+
+// Drops everything the previous scale loaded.
+void resetBenchState() {
+    resetStressState();
+    for (TextIndex* ix : {&usersText, &bookingsText, &seatsText}) closeTextIndex(*ix);
+    usersLoaded = bookingsLoaded = seatsLoaded = bookingIndexComplete = tripSeatsLoaded = true;
+    tripInventory.clear();
+    userBookingsLoaded.clear();
+    routeBookingsLoaded.clear();
+    holdTimers = TimingWheel();
+    unstampedHolds.clear();
+    allStoredRoutes.clear();
+    routeGraph = RouteGraph();
+    timetable = Timetable();
+}
+
+// ========================
+// Timing
+// ========================
+
+struct BenchResult {
+    string bench;
+    long long scale;
+    long long ops;
+    double nsPerOp;
+    double allocsPerOp;
+    long peakKB;
+};
+
+struct BenchOptions {
+    vector<long long> scales = {1000, 10000, 100000};
+    double budgetSeconds = 0.5;
+    string baselinePath;
+    double threshold = 1.25;
+};
+
+BenchOptions benchOptions;
+vector<BenchResult> benchResults;
+volatile size_t benchSink; // keeps results observable so calls are not elided
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void record(const string& bench, long long scale, long long ops, double seconds, uint64_t allocs) {
+    ops = max(1LL, ops);
+    benchResults.push_back({bench, scale, ops, seconds * 1e9 / ops, (double)allocs / ops, peakRssKB()});
+}
+
+// Times one call that handles `records` records.
+template <typename F>
+void benchOnce(const string& bench, long long scale, long long records, F call) {
+    resetPeakRss();
+    uint64_t allocs = allocCount.load();
+    auto start = chrono::steady_clock::now();
+    call();
+    double seconds = secondsSince(start);
+    record(bench, scale, records, seconds, allocCount.load() - allocs);
+}
+
+// Calls op(i) for i = 0, 1, ... until maxOps calls or the time budget run
+// out. The clock is read at doubling intervals (capped at 1024 calls), so
+// it costs nothing on fast ops and slow ops still stop near the budget.
+template <typename F>
+void benchLoop(const string& bench, long long scale, long long maxOps, F op) {
+    resetPeakRss();
+    uint64_t allocs = allocCount.load();
+    auto start = chrono::steady_clock::now();
+    long long ops = 0, nextCheck = 1;
+    double seconds = 0;
+    while (ops < maxOps) {
+        op(ops++);
+        if (ops == nextCheck) {
+            seconds = secondsSince(start);
+            if (seconds >= benchOptions.budgetSeconds) break;
+            nextCheck += min(nextCheck, 1024LL);
+        }
+    }
+    seconds = secondsSince(start);
+    record(bench, scale, ops, seconds, allocCount.load() - allocs);
+}
+
+// ========================
+// Benchmarks
+// ========================
+
+void runScale(long long scale) {
+    resetBenchState();
+    Dataset d = generateDataset(scale);
+    mt19937 rng(7 + (uint32_t)scale);
+
+    benchOnce("loadRoutesFromFile", scale, d.routeLines, [] { loadRoutesFromFile(); });
+    loadUsers();
+    benchOnce("loadBookings", scale, d.bookings, [] { loadBookings(); });
+    benchOnce("loadSeatState", scale, (long long)d.seatRoutes * BENCH_SEATS_PER_ROUTE, [] { loadSeatState(); });
+
+    uniform_int_distribution<int> anyStop(0, d.stops - 1);
+    vector<pair<string, string>> trips(256);
+    for (auto& trip : trips) trip = {stopName(anyStop(rng)), stopName(anyStop(rng))};
+    benchLoop("findRoutePath", scale, 1 << 20, [&](long long i) {
+        const auto& trip = trips[i % trips.size()];
+        benchSink = benchSink + findRoutePath(trip.first, trip.second).size();
+    });
+
+    // Timetable queries on a Monday, leaving between 06:00 and 20:00
+    writeTimetable(d, rng);
+    benchOnce("loadTimetable", scale, scale, [] { loadTimetable(); });
+    uniform_int_distribution<int32_t> anyTime(6 * 3600, 20 * 3600);
+    vector<TripQuery> queries(256);
+    for (TripQuery& q : queries) q = {anyStop(rng), anyStop(rng), 20261019, 0, anyTime(rng)};
+    vector<TripLeg> legs;
+    benchLoop("findTripEarliest", scale, 1 << 20, [&](long long i) {
+        const TripQuery& q = queries[i % queries.size()];
+        benchSink = benchSink + earliestArrival(timetable, q.source, q.target, q.time, q.weekday, legs);
+    });
+    benchLoop("findTripProfile", scale, 1 << 20, [&](long long i) {
+        const TripQuery& q = queries[i % queries.size()];
+        benchSink = benchSink + profileJourneys(timetable, q.source, q.target, q.time, q.time + 3600, q.weekday).size();
+    });
+
+    // Free seats over a random stretch of a 10-leg trip with a thousand
+    // seats, a third of each seat's legs taken
+    TripSeats seats;
+    for (int i = 0; i < 1000; i++) {
+        int from = rng() % 10;
+        seats.hold({i, tripSegmentLegs(from, from + 1 + rng() % 3), 0, 0});
+    }
+    vector<uint64_t> stretches(256);
+    for (uint64_t& legs : stretches) {
+        int from = rng() % 10;
+        legs = tripSegmentLegs(from, from + 1 + rng() % (10 - from));
+    }
+    benchLoop("countFreeTripSeats", scale, 1 << 24, [&](long long i) {
+        benchSink = benchSink + seats.countFree(1000, stretches[i % stretches.size()]);
+    });
+
+    benchLoop("countAvailableSeats", scale, 1 << 24, [&](long long i) {
+        benchSink = benchSink + countAvailableSeats(1 + (int)(i % d.seatRoutes));
+    });
+    benchLoop("seatStatsToJSON", scale, 1 << 20, [&](long long i) {
+        benchSink = benchSink + seatStatsToJSON(1 + (int)(i % d.seatRoutes)).size();
+    });
+    benchLoop("seatsToJSON", scale, 1 << 20, [&](long long i) {
+        JsonWriter w;
+        seatsToJSON(w, 1 + (int)(i % d.seatRoutes));
+        benchSink = benchSink + w.str().size();
+    });
+    benchLoop("userToJSON", scale, 1 << 20, [&](long long i) {
+        benchSink = benchSink + userToJSON(to_string(1 + i % d.users)).size();
+    });
+    benchLoop("userBookingsToJSON", scale, 1 << 20, [&](long long i) {
+        JsonWriter w;
+        userBookingsToJSON(w, to_string(1 + i % d.users));
+        benchSink = benchSink + w.str().size();
+    });
+    benchLoop("bookingToJSON", scale, 1 << 20, [&](long long i) {
+        benchSink = benchSink + bookingToJSON("BK" + to_string(1 + i % max(1, d.bookings))).size();
+    });
+    benchLoop("routeManifestToJSON", scale, 1 << 20, [&](long long i) {
+        JsonWriter w;
+        routeManifestToJSON(w, 1 + (int)(i % d.seatRoutes));
+        benchSink = benchSink + w.str().size();
+    });
+    benchLoop("networkSeatStatsToJSON", scale, 1 << 20, [&](long long) {
+        benchSink = benchSink + networkSeatStatsToJSON().size();
+    });
+
+    // The whole seat table as one getAllSeats listing, written to nowhere
+    ofstream discard("/dev/null");
+    Request req;
+    ListQuery q;
+    string error;
+    parseRequest("{\"cmd\":\"getAllSeats\"}", req);
+    parseListQuery(req, LIST_SEATS, q, error);
+    benchOnce("getAllSeats", scale, (long long)d.seatRoutes * BENCH_SEATS_PER_ROUTE, [&] {
+        JsonWriter w(&discard);
+        writeList(q, w);
+    });
+
+    // Last, as it changes the inventory. The journal is never flushed here;
+    // dropping its pending text keeps memory flat.
+    uniform_int_distribution<int> anyUser(1, d.users);
+    benchLoop("bookSeats", scale, (long long)d.availableSeats.size(), [&](long long i) {
+        const string& seatID = d.availableSeats[i];
+        int routeID, index;
+        parseSeatID(seatID, routeID, index);
+        benchSink = benchSink + bookSeats(routeID, "Bench trip", to_string(anyUser(rng)), {seatID}, 20).size();
+        if ((i & 1023) == 0) journal.pending.clear();
+    });
+    journal.pending.clear();
+    // One seat of a random stretch of a random trip; overlapping stretches
+    // of a seat already sold fail
+    benchLoop("bookTripSegments", scale, scale, [&](long long i) {
+        const Trip& trip = timetable.trips[i % timetable.trips.size()];
+        uint32_t board = rng() % trip.legCount, alight = board + rng() % (trip.legCount - board);
+        const Connection& first = timetable.connections[timetable.tripLegs[trip.firstLeg + board]];
+        const Connection& last = timetable.connections[timetable.tripLegs[trip.firstLeg + alight]];
+        string seatID = makeTripSeatID(sv(trip.tripID), 20261019, (int)(rng() % trip.seats));
+        benchSink = benchSink + bookTripSeats(string(sv(trip.tripID)), "2026-10-19",
+                                              string(sv(routeGraph.stopNames[first.depStop])),
+                                              string(sv(routeGraph.stopNames[last.arrStop])), "",
+                                              to_string(anyUser(rng)), {seatID}, 20).size();
+        if ((i & 1023) == 0) journal.pending.clear();
+    });
+    journal.pending.clear();
+
+    // Point lookups through the indexes the loads above wrote, each on a
+    // record not yet in memory
+    resetBenchState();
+    openTextData();
+    benchLoop("findUserIndexed", scale, d.users, [&](long long i) {
+        benchSink = benchSink + (findUser(to_string(1 + i)) != nullptr);
+    });
+    benchLoop("findBookingIndexed", scale, d.bookings, [&](long long i) {
+        benchSink = benchSink + (findBooking("BK" + to_string(1 + i)) != nullptr);
+    });
+    benchLoop("findRouteSeatsIndexed", scale, d.seatRoutes, [&](long long i) {
+        benchSink = benchSink + (findRouteSeats(1 + (int)i) != nullptr);
+    });
+
+    removeDataset();
+}
+
+// ========================
+// Baseline Comparison
+// ========================
+
+string resultKey(const string& bench, long long scale) {
+    return bench + "@" + to_string(scale);
+}
+
+// Reads nsPerOp of each result in a saved run (this program's output).
+unordered_map<string, double> loadBaseline(const string& path) {
+    unordered_map<string, double> baseline;
+    ifstream file(path);
+    string line;
+    Request req;
+    while (getline(file, line)) {
+        if (!parseRequest(line, req)) continue;
+        string bench = req.str("bench"), scale = req.str("scale"), ns = req.str("nsPerOp");
+        if (bench.empty() || scale.empty() || ns.empty()) continue;
+        baseline[resultKey(bench, stoll(scale))] = stod(ns);
+    }
+    return baseline;
+}
+
+int reportResults() {
+    unordered_map<string, double> baseline;
+    bool compare = !benchOptions.baselinePath.empty();
+    if (compare) {
+        baseline = loadBaseline(benchOptions.baselinePath);
+        if (baseline.empty()) {
+            cerr << "No results in baseline " << benchOptions.baselinePath << endl;
+            return 1;
+        }
+    }
+
+    int regressions = 0;
+    long peak = 0;
+    for (const BenchResult& r : benchResults) {
+        JsonWriter w(&cout);
+        w.raw("{\"bench\":").str(r.bench)
+         .raw(",\"scale\":").num(r.scale)
+         .raw(",\"ops\":").num(r.ops)
+         .raw(",\"nsPerOp\":").num(r.nsPerOp, 1)
+         .raw(",\"allocsPerOp\":").num(r.allocsPerOp, 2)
+         .raw(",\"peakRssKB\":").num((long long)r.peakKB);
+        auto it = baseline.find(resultKey(r.bench, r.scale));
+        if (it != baseline.end() && it->second > 0) {
+            double ratio = r.nsPerOp / it->second;
+            bool regressed = ratio > benchOptions.threshold;
+            regressions += regressed;
+            w.raw(",\"baselineNsPerOp\":").num(it->second, 1)
+             .raw(",\"ratio\":").num(ratio, 3)
+             .raw(",\"regression\":").boolean(regressed);
+        }
+        w.raw("}\n");
+        peak = max(peak, r.peakKB);
+    }
+    cout << "{\"summary\":true,\"results\":" << benchResults.size()
+         << ",\"regressions\":" << regressions << ",\"peakRssKB\":" << peak << "}" << endl;
+    return regressions > 0 ? 1 : 0;
+}
+
+// ========================
+// Entry Point
+// ========================
+
+bool parseScales(const string& list, vector<long long>& scales) {
+    scales.clear();
+    stringstream in(list);
+    string item;
+    while (getline(in, item, ',')) {
+        long long scale = (long long)stod(item); // accepts 1e6
+        if (scale < 100 || scale > 10000000) return false;
+        scales.push_back(scale);
+    }
+    return !scales.empty();
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--scales" && i + 1 < argc) {
+            if (!parseScales(argv[++i], benchOptions.scales)) {
+                cerr << "Scales must be between 100 and 10000000" << endl;
+                return 1;
+            }
+        } else if (arg == "--budget-ms" && i + 1 < argc) {
+            benchOptions.budgetSeconds = max(1, stoi(argv[++i])) / 1000.0;
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            benchOptions.baselinePath = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            benchOptions.threshold = stod(argv[++i]);
+        } else {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+
+    // The datasets use the real data file names, so every platform runs in
+    // a new directory of its own, never next to the tracked files.
+    error_code ec;
+    filesystem::path home = filesystem::current_path(ec);
+    filesystem::path dir;
+    if (!ec) dir = filesystem::temp_directory_path(ec) / ("logic-bench-" + to_string(random_device{}()));
+    if (!ec && filesystem::create_directories(dir / "backend", ec)) filesystem::current_path(dir, ec);
+    else if (!ec) ec = make_error_code(errc::file_exists);
+    if (ec) {
+        cerr << "Cannot create a scratch directory: " << ec.message() << endl;
+        return 1;
+    }
+
+    for (long long scale : benchOptions.scales) {
+        runScale(scale);
+        cerr << "scale " << scale << " done" << endl;
+    }
+
+    filesystem::current_path(home, ec);
+    filesystem::remove_all(dir, ec);
+    return reportResults();
+}
@@ -2,6 +2,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <queue>
 #include <algorithm>
@@ -9,9 +13,158 @@
 #include <sstream>
 #include <iomanip>
 #include <fstream>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+#include <string_view>
+#include <charconv>
+#include <memory>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LOGIC_SSE2 1
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define LOGIC_TSC 1
+#endif
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 using namespace std;
 
+// ========================
+// Symbol Table
+// ========================
+// Process-wide string interning. IDs, names and other short strings that
+// repeat across records (user/booking/seat IDs, stop names, route info,
+// statuses) are stored once and referred to by a 32-bit Sym; strings are
+// only rebuilt when writing JSON or files. Sym 0 is always "".
+
+typedef uint32_t Sym;
+
+uint64_t fnv1a(string_view s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (char c : s) {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+struct SymbolTable {
+    string arena;               // all symbols back to back
+    vector<uint32_t> offsets;   // symbol i is arena[offsets[i], offsets[i+1])
+    vector<Sym> slots;          // open-addressing hash index, UINT32_MAX = empty
+
+    SymbolTable() {
+        offsets.push_back(0);
+        slots.assign(1024, UINT32_MAX);
+        intern("");
+    }
+
+    size_t count() const { return offsets.size() - 1; }
+
+    string_view view(Sym s) const {
+        return string_view(arena.data() + offsets[s], offsets[s + 1] - offsets[s]);
+    }
+
+    static size_t hash(string_view s) {
+        return (size_t)fnv1a(s);
+    }
+
+    bool lookup(string_view s, Sym& out) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(s) & mask;; i = (i + 1) & mask) {
+            Sym cand = slots[i];
+            if (cand == UINT32_MAX) return false;
+            if (view(cand) == s) {
+                out = cand;
+                return true;
+            }
+        }
+    }
+
+    Sym intern(string_view s) {
+        Sym found;
+        if (lookup(s, found)) return found;
+        if ((count() + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+        Sym sym = (Sym)count();
+        arena.append(s.data(), s.size());
+        offsets.push_back((uint32_t)arena.size());
+        size_t mask = slots.size() - 1;
+        size_t i = hash(s) & mask;
+        while (slots[i] != UINT32_MAX) i = (i + 1) & mask;
+        slots[i] = sym;
+        return sym;
+    }
+
+    void rehash(size_t size) {
+        slots.assign(size, UINT32_MAX);
+        size_t mask = size - 1;
+        for (Sym sym = 0; sym < count(); sym++) {
+            size_t i = hash(view(sym)) & mask;
+            while (slots[i] != UINT32_MAX) i = (i + 1) & mask;
+            slots[i] = sym;
+        }
+    }
+
+    size_t memoryBytes() const {
+        return arena.capacity() + offsets.capacity() * sizeof(uint32_t) + slots.capacity() * sizeof(Sym);
+    }
+};
+
+SymbolTable symbols;
+
+// Symbols are read through this pointer so the background compaction
+// thread can resolve them from its own copy while the main thread interns.
+thread_local const SymbolTable* symbolsView = &symbols;
+
+Sym intern(string_view s) {
+    return symbols.intern(s);
+}
+
+string_view sv(Sym s) {
+    return symbolsView->view(s);
+}
+
+// Orders symbol-keyed maps by the strings themselves, so listings and the
+// snapshot keep the same order as string-keyed maps did. Plain strings
+// compare too, to seek by a key that was never interned.
+struct SymOrder {
+    using is_transparent = void;
+    bool operator()(Sym a, Sym b) const {
+        return a != b && sv(a) < sv(b);
+    }
+    bool operator()(Sym a, string_view b) const { return sv(a) < b; }
+    bool operator()(string_view a, Sym b) const { return a < sv(b); }
+};
+
+const Sym SYM_ACTIVE = intern("Active");
+const Sym SYM_CANCELLED = intern("Cancelled");
+
 // ========================
 // Data Structures
 // ========================
@@ -23,837 +176,6170 @@ struct Coordinate {
 
 struct Route {
     int routeID;
-    string from;
-    string to;
+    Sym from;
+    Sym to;
     double distance;
     double ticketPrice;
     vector<Coordinate> coords;
+    Sym fromKey; // lowercased stop names for lookups
+    Sym toKey;
+};
+
+// Route network in compressed sparse row form. Stops are dense indices;
+// the routes leaving stop s are edges edgeStart[s] .. edgeStart[s+1]-1,
+// with per-edge arrays so the search loop touches no maps.
+struct RouteGraph {
+    vector<Sym> stopKeys;               // stop -> lowercase name
+    vector<Sym> stopNames;              // stop -> name as first spelled
+    vector<Coordinate> stopCoords;      // stop -> position, NAN if unknown
+    unordered_map<Sym, int> stopIndex;  // lowercase name -> stop
+    vector<uint32_t> edgeStart;
+    vector<int> edgeFrom;
+    vector<int> edgeTo;
+    vector<int> edgeRoute;              // routeID of the edge
+    vector<double> edgeDistance;        // weights in hundredths
+    vector<double> edgePrice;
+    vector<uint32_t> inStart;           // same layout over incoming edges,
+    vector<uint32_t> inEdge;            // giving forward edge indices
+
+    int stopCount() const { return (int)stopKeys.size(); }
+};
+
+// Stop-name lookup for suggestStops, built from routeGraph on first use.
+// Prefix matches come from a radix tree over every word-start suffix of
+// the lowercased names, so "market" finds "Gurudwara Rd Market"; each node
+// keeps its best few stops so short prefixes answer without a subtree walk.
+// Misspelled names are matched through a trigram index.
+struct StopSearchIndex {
+    struct Entry {
+        uint32_t pos;   // suffix start in text
+        uint32_t stop;
+        uint32_t score; // lower ranks first
+    };
+    struct Node {
+        uint32_t lo, hi;                // entries below this node
+        uint32_t labelPos, labelLen;    // edge label in text
+        uint32_t firstChild, childCount;
+        uint32_t topStart, topCount;    // best distinct stops, as entries
+    };
+    bool built = false;
+    string text;                 // lowercased names back to back
+    vector<uint32_t> nameEnd;    // stop -> end of its name in text
+    vector<uint32_t> stopRank;   // stop -> rank by routes, then length, name
+    vector<uint32_t> stopRoutes; // stop -> routes starting or ending there
+    vector<Entry> entries;       // sorted by suffix
+    vector<Node> nodes;          // nodes[0] is the root
+    vector<uint32_t> top;
+    vector<uint32_t> gramCodes;  // sorted distinct trigrams
+    vector<uint32_t> gramStart;  // postings of gramCodes[i]: gramStops[gramStart[i] .. gramStart[i+1]-1]
+    vector<uint32_t> gramStops;
+    vector<uint16_t> nameGrams;  // stop -> distinct trigrams in its name
+    vector<uint16_t> hitCount;   // query scratch, all zero between queries
+};
+
+// Static k-d tree over the stops with known positions, for nearestStops.
+// Points are unit vectors on the sphere, where straight-line (chord)
+// distance orders stops exactly as great-circle distance does and there is
+// no wrap-around at the antimeridian. The layout is implicit: the points
+// lo..hi-1 of a subtree have their splitting point at the middle.
+struct StopSpatialIndex {
+    struct Point {
+        double p[3];
+        uint32_t stop;
+        uint32_t axis; // split axis of the subtree this point divides
+    };
+    bool built = false;
+    vector<Point> points;
 };
 
+enum SeatStatus : uint8_t {
+    SEAT_AVAILABLE = 0,
+    SEAT_BOOKED = 1,
+    SEAT_RESERVED = 2
+};
+
+// Record form of one seat, as read from or written to files
 struct Seat {
-    string seatID;
-    string status; // "Available", "Booked", "Reserved"
-    string userID;
     int routeID;
-    string bookingID;
+    int index; // seat "R<routeID>S<index+1>"
+    SeatStatus status;
+    Sym userID;
+    Sym bookingID;
+    uint32_t holdUntil; // reserved seats: unix time the hold lapses, 0 if none
 };
 
 struct Booking {
-    string bookingID;
+    Sym bookingID;
     int routeID;
-    string routeInfo;
-    string userID;
-    vector<string> seatIDs;
+    Sym routeInfo;
+    Sym userID;
+    vector<Sym> seatIDs;
     double totalPrice;
     string timestamp;
-    string status; // "Active", "Cancelled"
+    Sym status; // "Active", "Cancelled"
 };
 
 struct User {
-    string userID;
-    string name;
+    Sym userID;
+    Sym name;
     string email;
-    vector<string> bookingIDs;
     int totalBookings;
     double totalSpent;
 };
 
+typedef map<Sym, User, SymOrder> UserTable;
+typedef map<Sym, Booking, SymOrder> BookingTable;
+
 // ========================
 // Global Data Storage
 // ========================
-map<string, Seat> seats; // seatID -> Seat
-map<string, User> users; // userID -> User
-map<string, Booking> bookings; // bookingID -> Booking
+UserTable users; // userID -> User
+BookingTable bookings; // bookingID -> Booking
 map<int, Route> routes; // routeID -> Route
-int nextBookingID = 1;
+// Concurrent bookings take their numbers without a lock
+atomic<int> nextBookingID{1};
+
+void raiseNextBookingID(int next) {
+    int current = nextBookingID.load();
+    while (current < next && !nextBookingID.compare_exchange_weak(current, next)) {}
+}
+
+// "BK12" -> 12; 0 for an ID without a number
+int bookingNumber(string_view bookingID) {
+    int n = 0;
+    if (bookingID.size() > 2) from_chars(bookingID.data() + 2, bookingID.data() + bookingID.size(), n);
+    return n;
+}
+
+// Secondary indexes over the bookings table. Every booking in the table is
+// indexed: whatever adds, replaces or cancels one goes through
+// reindexBooking, unindexBooking or setBookingStatus. Lists keep the order
+// in which bookings were indexed.
+struct BookingIndex {
+    unordered_map<Sym, vector<Sym>> byUser;  // userID -> bookings
+    unordered_map<int, vector<Sym>> byRoute; // routeID -> bookings
+    unordered_map<int, set<Sym, SymOrder>> activeByRoute; // routeID -> bookings holding seats
+};
+
+BookingIndex bookingIndex;
+
+void indexBookingFields(Sym bookingID, int routeID, Sym userID, bool active) {
+    bookingIndex.byUser[userID].push_back(bookingID);
+    bookingIndex.byRoute[routeID].push_back(bookingID);
+    if (active) bookingIndex.activeByRoute[routeID].insert(bookingID);
+}
+
+void unindexBooking(const Booking& b) {
+    vector<Sym>& byUser = bookingIndex.byUser[b.userID];
+    byUser.erase(remove(byUser.begin(), byUser.end(), b.bookingID), byUser.end());
+    vector<Sym>& byRoute = bookingIndex.byRoute[b.routeID];
+    byRoute.erase(remove(byRoute.begin(), byRoute.end(), b.bookingID), byRoute.end());
+    bookingIndex.activeByRoute[b.routeID].erase(b.bookingID);
+}
+
+// Indexes b, which replaces old (nullptr for a booking new to the table).
+void reindexBooking(const Booking* old, const Booking& b) {
+    if (old && (old->userID != b.userID || old->routeID != b.routeID)) {
+        unindexBooking(*old);
+        old = nullptr;
+    }
+    if (!old) {
+        indexBookingFields(b.bookingID, b.routeID, b.userID, b.status == SYM_ACTIVE);
+    } else if ((old->status == SYM_ACTIVE) != (b.status == SYM_ACTIVE)) {
+        if (b.status == SYM_ACTIVE) bookingIndex.activeByRoute[b.routeID].insert(b.bookingID);
+        else bookingIndex.activeByRoute[b.routeID].erase(b.bookingID);
+    }
+}
+
+void setBookingStatus(Booking& b, Sym status) {
+    Booking updated = b;
+    updated.status = status;
+    reindexBooking(&b, updated);
+    b.status = status;
+}
+
+const vector<Sym>& indexedBookings(const unordered_map<Sym, vector<Sym>>& index, Sym key) {
+    static const vector<Sym> none;
+    auto it = index.find(key);
+    return it == index.end() ? none : it->second;
+}
 
 // For route search - built from routes.txt
-map<string, vector<int>> routeGraph; // lowercase stop -> list of route IDs
+RouteGraph routeGraph; // compiled from allStoredRoutes
+StopSearchIndex stopSearch; // over routeGraph's stops, built on demand
+StopSpatialIndex stopSpatial; // likewise
 map<int, Route> allStoredRoutes; // routeID -> Route (from routes.txt)
+time_t routesFileMtime = 0; // routes.txt stamp at last load, so a daemon can
+off_t routesFileSize = -1;  // notice routes appended by the admin API
+uint32_t routesFileCRC = 0; // CRC32 of the routes.txt contents loaded
+bool routesLoaded = false;  // routes.txt is read by the first command needing it
 
 // ========================
-// Data Persistence
+// Seat Inventory
 // ========================
-const string USERS_FILE = "backend/data_users.txt";
-const string BOOKINGS_FILE = "backend/data_bookings.txt";
-const string SEATS_FILE = "backend/data_seats.txt";
-const string ROUTES_FILE = "backend/routes.txt";
+// Seats are stored per route rather than in one seatID-keyed map. Seat
+// "R<route>S<n>" lives at index n-1 of its route's dense arrays; status is
+// kept as two bitsets (booked, reserved) next to a bitset of the seats that
+// exist, and each route keeps running counters so stats are O(1).
 
-void saveUsers() {
-    ofstream file(USERS_FILE);
-    if (!file.is_open()) return;
-    
-    for (const auto& pair : users) {
-        const User& u = pair.second;
-        file << u.userID << "|" << u.name << "|" << u.email << "|"
-             << u.totalBookings << "|" << fixed << setprecision(2) << u.totalSpent << "\n";
+const char* seatStatusName(SeatStatus st) {
+    switch (st) {
+        case SEAT_BOOKED: return "Booked";
+        case SEAT_RESERVED: return "Reserved";
+        default: return "Available";
     }
-    file.close();
 }
 
-void loadUsers() {
-    ifstream file(USERS_FILE);
-    if (!file.is_open()) return;
-    
-    string line;
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        
-        size_t pos1 = line.find('|');
-        size_t pos2 = line.find('|', pos1 + 1);
-        size_t pos3 = line.find('|', pos2 + 1);
-        size_t pos4 = line.find('|', pos3 + 1);
-        
-        if (pos1 != string::npos && pos2 != string::npos && pos3 != string::npos && pos4 != string::npos) {
-            string userID = line.substr(0, pos1);
-            string name = line.substr(pos1 + 1, pos2 - pos1 - 1);
-            string email = line.substr(pos2 + 1, pos3 - pos2 - 1);
-            int bookings = stoi(line.substr(pos3 + 1, pos4 - pos3 - 1));
-            double spent = stod(line.substr(pos4 + 1));
-            
-            users[userID] = {userID, name, email, {}, bookings, spent};
-        }
-    }
-    file.close();
+SeatStatus parseSeatStatus(string_view name) {
+    if (name == "Booked") return SEAT_BOOKED;
+    if (name == "Reserved") return SEAT_RESERVED;
+    return SEAT_AVAILABLE;
 }
 
-void saveBookings() {
-    ofstream file(BOOKINGS_FILE);
-    if (!file.is_open()) return;
-    
-    for (const auto& pair : bookings) {
-        const Booking& b = pair.second;
-        file << b.bookingID << "|" << b.routeID << "|" << b.routeInfo << "|"
-             << b.userID << "|";
-        
-        // Save seat IDs
-        for (size_t i = 0; i < b.seatIDs.size(); i++) {
-            if (i > 0) file << ",";
-            file << b.seatIDs[i];
-        }
-        file << "|" << fixed << setprecision(2) << b.totalPrice << "|"
-             << b.timestamp << "|" << b.status << "\n";
+struct RouteSeats {
+    int routeID = 0;
+    vector<uint64_t> present;   // bit i: seat i+1 exists
+    vector<uint64_t> booked;    // bit i: seat i+1 is booked
+    vector<uint64_t> reserved;  // bit i: seat i+1 is reserved
+    vector<Sym> userIDs;        // holder of a booked/reserved seat
+    vector<Sym> bookingIDs;
+    unordered_map<int, uint32_t> holdUntil; // reserved seat -> unix time its hold lapses
+    int available = 0;
+    int bookedCount = 0;
+    int reservedCount = 0;
+
+    int capacity() const { return (int)userIDs.size(); }
+    int total() const { return available + bookedCount + reservedCount; }
+
+    bool exists(int i) const {
+        return i >= 0 && i < capacity() && ((present[i >> 6] >> (i & 63)) & 1);
     }
-    file.close();
-}
 
-void loadBookings() {
-    ifstream file(BOOKINGS_FILE);
-    if (!file.is_open()) return;
-    
-    string line;
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        
-        size_t pos = 0;
-        vector<string> parts;
-        string part;
-        
-        for (int i = 0; i < 8; i++) {
-            size_t next = line.find('|', pos);
-            if (next == string::npos) {
-                parts.push_back(line.substr(pos));
-                break;
-            }
-            parts.push_back(line.substr(pos, next - pos));
-            pos = next + 1;
+    SeatStatus status(int i) const {
+        uint64_t bit = 1ULL << (i & 63);
+        if (booked[i >> 6] & bit) return SEAT_BOOKED;
+        if (reserved[i >> 6] & bit) return SEAT_RESERVED;
+        return SEAT_AVAILABLE;
+    }
+
+    uint32_t holdExpiry(int i) const {
+        if (holdUntil.empty()) return 0;
+        auto it = holdUntil.find(i);
+        return it == holdUntil.end() ? 0 : it->second;
+    }
+
+    void grow(int seats) {
+        if (seats <= capacity()) return;
+        size_t words = (seats + 63) / 64;
+        present.resize(words, 0);
+        booked.resize(words, 0);
+        reserved.resize(words, 0);
+        userIDs.resize(seats, 0);
+        bookingIDs.resize(seats, 0);
+    }
+
+    // Sets seat i (0-based), creating it if needed, and keeps the counters
+    // in step with the bitsets. expiresAt is the deadline of a reservation.
+    void set(int i, SeatStatus st, Sym userID, Sym bookingID, uint32_t expiresAt = 0) {
+        grow(i + 1);
+        uint64_t bit = 1ULL << (i & 63);
+        size_t w = i >> 6;
+        if (present[w] & bit) {
+            SeatStatus old = status(i);
+            if (old == SEAT_BOOKED) bookedCount--;
+            else if (old == SEAT_RESERVED) reservedCount--;
+            else available--;
         }
-        
-        if (parts.size() >= 8) {
-            string bookingID = parts[0];
-            int routeID = stoi(parts[1]);
-            string routeInfo = parts[2];
-            string userID = parts[3];
-            
-            vector<string> seatIDs;
-            stringstream ss(parts[4]);
-            string seat;
-            while (getline(ss, seat, ',')) {
-                if (!seat.empty()) seatIDs.push_back(seat);
-            }
-            
-            double totalPrice = stod(parts[5]);
-            string timestamp = parts[6];
-            string status = parts[7];
-            
-            bookings[bookingID] = {bookingID, routeID, routeInfo, userID, seatIDs, totalPrice, timestamp, status};
-            
-            // Update nextBookingID
-            int num = stoi(bookingID.substr(2));
-            if (num >= nextBookingID) nextBookingID = num + 1;
+        present[w] |= bit;
+        booked[w] &= ~bit;
+        reserved[w] &= ~bit;
+        if (st == SEAT_BOOKED) {
+            booked[w] |= bit;
+            bookedCount++;
+        } else if (st == SEAT_RESERVED) {
+            reserved[w] |= bit;
+            reservedCount++;
+        } else {
+            available++;
         }
+        userIDs[i] = userID;
+        bookingIDs[i] = bookingID;
+        if (st == SEAT_RESERVED && expiresAt) holdUntil[i] = expiresAt;
+        else if (!holdUntil.empty()) holdUntil.erase(i);
     }
-    file.close();
+};
+
+typedef map<int, RouteSeats> SeatTable;
+
+SeatTable seatInventory; // routeID -> seats on that route
+
+// bookSeats, cancelBooking, reserveSeat, releaseSeat, initSeats and the
+// user changes are safe to call from several threads at once; the servers
+// still run every command on one thread. Each route's seats are guarded by
+// one of a fixed set of striped locks, so bookings on different routes do
+// not wait for each other there. A booking checks, takes and stamps all of
+// its seats under its route's lock. inventoryMutex guards which routes
+// seatInventory holds. ledgerMutex guards users, bookings, the symbol table
+// and the journal records of a mutation; a booking holds it briefly before
+// and after taking its seats, and draws its number from an atomic counter.
+// A thread may take a route lock while holding ledgerMutex, never the other
+// way round. Journal flushes and compaction run on the serving thread.
+const size_t ROUTE_LOCK_STRIPES = 256;
+
+struct alignas(64) RouteLock {
+    mutex m;
+};
+
+RouteLock routeLocks[ROUTE_LOCK_STRIPES];
+shared_mutex inventoryMutex;
+mutex ledgerMutex;
+
+mutex& routeLock(int routeID) {
+    return routeLocks[(uint32_t)routeID % ROUTE_LOCK_STRIPES].m;
 }
 
-void saveSeatState() {
-    ofstream file(SEATS_FILE);
-    if (!file.is_open()) return;
-    
-    for (const auto& pair : seats) {
-        const Seat& s = pair.second;
-        file << s.seatID << "|" << s.status << "|" << s.userID << "|"
-             << s.routeID << "|" << s.bookingID << "\n";
-    }
-    file.close();
+string makeSeatID(int routeID, int index) {
+    return "R" + to_string(routeID) + "S" + to_string(index + 1);
 }
 
-void loadSeatState() {
-    ifstream file(SEATS_FILE);
-    if (!file.is_open()) return;
-    
-    string line;
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        
-        size_t pos1 = line.find('|');
-        size_t pos2 = line.find('|', pos1 + 1);
-        size_t pos3 = line.find('|', pos2 + 1);
-        size_t pos4 = line.find('|', pos3 + 1);
-        
-        if (pos1 != string::npos && pos2 != string::npos && pos3 != string::npos && pos4 != string::npos) {
-            string seatID = line.substr(0, pos1);
-            string status = line.substr(pos1 + 1, pos2 - pos1 - 1);
-            string userID = line.substr(pos2 + 1, pos3 - pos2 - 1);
-            int routeID = stoi(line.substr(pos3 + 1, pos4 - pos3 - 1));
-            string bookingID = line.substr(pos4 + 1);
-            
-            seats[seatID] = {seatID, status, userID, routeID, bookingID};
-        }
+// Splits an "R<route>S<n>" seat ID into route and 0-based seat index.
+bool parseSeatID(string_view seatID, int& routeID, int& index) {
+    if (seatID.size() < 4 || seatID[0] != 'R') return false;
+    size_t s = seatID.find('S', 1);
+    if (s == string_view::npos || s == 1 || s + 1 >= seatID.size()) return false;
+    long long r = 0, n = 0;
+    for (size_t i = 1; i < s; i++) {
+        if (!isdigit((unsigned char)seatID[i]) || r > INT32_MAX / 10) return false;
+        r = r * 10 + (seatID[i] - '0');
     }
-    file.close();
+    for (size_t i = s + 1; i < seatID.size(); i++) {
+        if (!isdigit((unsigned char)seatID[i]) || n > 1000000) return false;
+        n = n * 10 + (seatID[i] - '0');
+    }
+    if (n < 1) return false;
+    routeID = (int)r;
+    index = (int)n - 1;
+    return true;
 }
 
-// ========================
-// Utility Functions
-// ========================
-
-string generateBookingID() {
-    return "BK" + to_string(nextBookingID++);
+Seat seatRecord(const RouteSeats& r, int i) {
+    return {r.routeID, i, r.status(i), r.userIDs[i], r.bookingIDs[i], r.holdExpiry(i)};
 }
 
-string getCurrentTimestamp() {
-    time_t now = time(0);
-    char buf[80];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    return string(buf);
+RouteSeats& routeSeatsEntry(int routeID) {
+    RouteSeats& r = seatInventory[routeID];
+    r.routeID = routeID;
+    return r;
 }
 
-string toLowerCase(const string& str) {
-    string result = str;
-    transform(result.begin(), result.end(), result.begin(), ::tolower);
-    return result;
+// Seats on dated trips of the timetable, keyed by trip and service date
+// (yyyymmdd). Seat n of trip T100 on 17 Oct 2026 is "T100@20261017S<n>".
+// A seat is sold per segment: it keeps a mask of the trip's legs taken on
+// it (bit k = leg k, from stop k to stop k + 1), so riders whose journeys
+// do not overlap share it. A whole-trip booking takes every bit. Only trip
+// dates with a booking have an entry. Guarded by ledgerMutex.
+const uint64_t WHOLE_TRIP = ~0ULL;
+
+// Legs from stop position `from` to stop position `to` (from < to). Legs
+// past the 64th share the last bit, so long trips are booked conservatively.
+uint64_t tripSegmentLegs(int from, int to) {
+    uint64_t upto = to >= 64 ? WHOLE_TRIP : (1ULL << to) - 1;
+    return upto & (WHOLE_TRIP << min(from, 63));
 }
 
-// Load routes from routes.txt
-void loadRoutesFromFile() {
-    allStoredRoutes.clear();
-    routeGraph.clear();
-    
-    ifstream file(ROUTES_FILE);
-    if (!file.is_open()) return;
-    
-    string line;
-    int routeID = 1;
-    while (getline(file, line)) {
-        if (line.empty() || line[0] == '#') continue;
-        
-        size_t pos1 = line.find('|');
-        size_t pos2 = line.find('|', pos1 + 1);
-        size_t pos3 = line.find('|', pos2 + 1);
-        size_t pos4 = line.find('|', pos3 + 1);
-        
-        if (pos1 == string::npos || pos2 == string::npos || pos3 == string::npos) continue;
-        
-        string from = line.substr(0, pos1);
-        string to = line.substr(pos1 + 1, pos2 - pos1 - 1);
-        double distance = stod(line.substr(pos2 + 1, pos3 - pos2 - 1));
-        
-        double ticketPrice = 0;
-        string priceStr = line.substr(pos3 + 1, pos4 - pos3 - 1);
-        if (!priceStr.empty()) {
-            try {
-                ticketPrice = stod(priceStr);
-            } catch (...) {
-                ticketPrice = distance * 0.5;
-            }
-        } else {
-            ticketPrice = distance * 0.5;
-        }
-        
-        Route route = {routeID, from, to, distance, ticketPrice, {}};
-        allStoredRoutes[routeID] = route;
-        
-        string fromLower = toLowerCase(from);
-        routeGraph[fromLower].push_back(routeID);
-        
-        routeID++;
+// Seats among occupied[0 .. count-1] with none of `legs` taken.
+int countFreeSeats(const uint64_t* occupied, int count, uint64_t legs) {
+    int available = 0, i = 0;
+#ifdef LOGIC_SSE2
+    // Two seats per step: a 64-bit lane is free when both its 32-bit halves
+    // compare equal to zero, and its all-ones result counts as -1
+    const __m128i mask = _mm_set1_epi64x((long long)legs);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i counts = zero;
+    for (; i + 2 <= count; i += 2) {
+        __m128i taken = _mm_and_si128(_mm_loadu_si128((const __m128i*)(occupied + i)), mask);
+        __m128i halves = _mm_cmpeq_epi32(taken, zero);
+        counts = _mm_sub_epi64(counts, _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1))));
     }
-    file.close();
+    available = _mm_cvtsi128_si32(counts) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(counts, counts));
+#endif
+    for (; i < count; i++) available += (occupied[i] & legs) == 0;
+    return available;
 }
 
-struct PathNode {
-    string stop;
-    vector<int> path;
+struct TripSeatHold {
+    int index;
+    uint64_t legs;
+    Sym userID;
+    Sym bookingID;
 };
 
-vector<int> findRoutePath(const string& startStop, const string& endStop) {
-    string start = toLowerCase(startStop);
-    string end = toLowerCase(endStop);
-    
-    if (start == end) return {};
-    if (routeGraph.find(start) == routeGraph.end()) return {};
-    
-    queue<PathNode> q;
-    set<string> visited;
-    
-    q.push({start, {}});
-    visited.insert(start);
-    
-    while (!q.empty()) {
-        PathNode current = q.front();
-        q.pop();
-        
-        if (routeGraph.find(current.stop) != routeGraph.end()) {
-            for (int routeID : routeGraph[current.stop]) {
-                if (allStoredRoutes.find(routeID) == allStoredRoutes.end()) continue;
-                
-                Route& route = allStoredRoutes[routeID];
-                string nextStop = toLowerCase(route.to);
-                
-                if (nextStop == end) {
-                    vector<int> result = current.path;
-                    result.push_back(routeID);
-                    return result;
-                }
-                
-                if (visited.find(nextStop) == visited.end()) {
-                    visited.insert(nextStop);
-                    vector<int> newPath = current.path;
-                    newPath.push_back(routeID);
-                    q.push({nextStop, newPath});
-                }
-            }
-        }
+struct TripSeats {
+    vector<uint64_t> occupied;  // seat -> legs taken
+    vector<TripSeatHold> holds;
+
+    bool isFree(int i, uint64_t legs) const {
+        return i >= (int)occupied.size() || (occupied[i] & legs) == 0;
     }
-    
-    return {};
-}
 
-// ========================
-// Seat Management
-// ========================
+    // Free seats among the first `seats` for the given legs
+    int countFree(int seats, uint64_t legs) const {
+        int stored = min(seats, (int)occupied.size());
+        return countFreeSeats(occupied.data(), stored, legs) + (seats - stored);
+    }
 
-void initializeSeatsForRoute(int routeID, int totalSeats = 40) {
-    for (int i = 1; i <= totalSeats; i++) {
-        string seatID = "R" + to_string(routeID) + "S" + to_string(i);
-        seats[seatID] = {seatID, "Available", "", routeID, ""};
+    void hold(const TripSeatHold& h) {
+        if (h.index >= (int)occupied.size()) occupied.resize(h.index + 1, 0);
+        occupied[h.index] |= h.legs;
+        holds.push_back(h);
     }
-}
 
-int countAvailableSeats(int routeID) {
-    int count = 0;
-    for (const auto& pair : seats) {
-        if (pair.second.routeID == routeID && pair.second.status == "Available") {
-            count++;
-        }
+    vector<TripSeatHold>::const_iterator findHold(int index, uint64_t legs, Sym bookingID) const {
+        return find_if(holds.begin(), holds.end(), [&](const TripSeatHold& h) {
+            return h.index == index && h.legs == legs && h.bookingID == bookingID;
+        });
     }
-    return count;
-}
 
-int countBookedSeats(int routeID) {
-    int count = 0;
-    for (const auto& pair : seats) {
-        if (pair.second.routeID == routeID && pair.second.status == "Booked") {
-            count++;
-        }
+    bool held(int index, uint64_t legs, Sym bookingID) const {
+        return findHold(index, legs, bookingID) != holds.end();
     }
-    return count;
-}
 
-int countReservedSeats(int routeID) {
-    int count = 0;
-    for (const auto& pair : seats) {
-        if (pair.second.routeID == routeID && pair.second.status == "Reserved") {
-            count++;
+    // Drops the booking's hold on those legs of the seat; false if none.
+    bool release(int index, uint64_t legs, Sym bookingID) {
+        auto it = findHold(index, legs, bookingID);
+        if (it == holds.end()) return false;
+        holds.erase(it);
+        occupied[index] = 0;
+        for (const TripSeatHold& h : holds) {
+            if (h.index == index) occupied[index] |= h.legs;
         }
+        return true;
     }
-    return count;
-}
+};
 
-vector<string> getAvailableSeats(int routeID) {
-    vector<string> available;
-    for (const auto& pair : seats) {
-        if (pair.second.routeID == routeID && pair.second.status == "Available") {
-            available.push_back(pair.second.seatID);
-        }
+typedef pair<Sym, int> TripDate; // tripID, yyyymmdd
+typedef map<TripDate, TripSeats> TripSeatTable;
+
+TripSeatTable tripInventory;
+
+// Seat IDs of a segment end in ":<from>-<to>", the stop positions along the
+// trip: "T100@20261017S3:1-4" rides seat 3 from the second stop to the fifth.
+string makeTripSeatID(string_view tripID, int date, int index, uint64_t legs = WHOLE_TRIP) {
+    string id(tripID);
+    id += '@';
+    id += to_string(date);
+    id += 'S';
+    id += to_string(index + 1);
+    if (legs != WHOLE_TRIP) {
+        id += ':';
+        id += to_string(__builtin_ctzll(legs));
+        id += '-';
+        id += to_string(64 - __builtin_clzll(legs));
     }
-    sort(available.begin(), available.end());
-    return available;
+    return id;
 }
 
-vector<string> getBookedSeats(int routeID) {
-    vector<string> booked;
-    for (const auto& pair : seats) {
-        if (pair.second.routeID == routeID && pair.second.status == "Booked") {
-            booked.push_back(pair.second.seatID);
-        }
+// Splits "<trip>@<yyyymmdd>S<n>[:<from>-<to>]" into trip, date, 0-based
+// seat index and legs.
+bool parseTripSeatID(string_view seatID, string_view& tripID, int& date, int& index, uint64_t& legs) {
+    size_t at = seatID.rfind('@');
+    if (at == string_view::npos || at == 0 || seatID.size() < at + 11 || seatID[at + 9] != 'S') return false;
+    const char* end = seatID.data() + seatID.size();
+    auto d = from_chars(seatID.data() + at + 1, seatID.data() + at + 9, date);
+    auto n = from_chars(seatID.data() + at + 10, end, index);
+    if (d.ec != errc() || d.ptr != seatID.data() + at + 9 || n.ec != errc() || index < 1) return false;
+    legs = WHOLE_TRIP;
+    if (n.ptr != end) {
+        int from, to;
+        if (*n.ptr != ':') return false;
+        auto f = from_chars(n.ptr + 1, end, from);
+        if (f.ec != errc() || f.ptr == end || *f.ptr != '-') return false;
+        auto t = from_chars(f.ptr + 1, end, to);
+        if (t.ec != errc() || t.ptr != end || from < 0 || to <= from || to > 64) return false;
+        legs = tripSegmentLegs(from, to);
     }
-    sort(booked.begin(), booked.end());
-    return booked;
+    tripID = seatID.substr(0, at);
+    index--;
+    return true;
 }
 
-// ========================
-// User Management
-// ========================
+// Reservation expiry. Every hold with a deadline has a timer in a
+// hierarchical timing wheel: four levels of 64 one-second slots, with a
+// timer kept at the level of the highest 6-bit digit in which its deadline
+// differs from the wheel's clock. Starting a timer is O(1), and a timer
+// moves down a level at most three times before it fires. Refreshing or
+// releasing a hold leaves the old timer where it is. A timer whose
+// deadline no longer matches its seat's is dropped when it fires.
+const uint32_t RESERVATION_DEFAULT_TTL = 900; // seconds
+const uint32_t RESERVATION_MAX_TTL = 86400;
 
-bool createUser(const string& userID, const string& name, const string& email) {
-    if (users.find(userID) != users.end()) {
-        return false; // User already exists
+struct HoldTimer {
+    int routeID;
+    int index;
+    uint32_t deadline;
+};
+
+struct TimingWheel {
+    static const int LEVELS = 4;
+    static const int BITS = 6;
+    static const uint32_t SLOTS = 1 << BITS;
+    vector<HoldTimer> slots[LEVELS][SLOTS];
+    uint32_t now = 0; // every timer up to here has fired
+    size_t size = 0;
+    
+    // The deadline must be later than now.
+    void schedule(const HoldTimer& timer) {
+        int level = (31 - __builtin_clz(timer.deadline ^ now)) / BITS;
+        uint32_t slot;
+        if (level < LEVELS) {
+            slot = (timer.deadline >> (BITS * level)) & (SLOTS - 1);
+        } else {
+            // Past the wheel's span: park in the top level's last slot of
+            // this turn, to be placed again when it comes round
+            level = LEVELS - 1;
+            slot = ((now >> (BITS * level)) - 1) & (SLOTS - 1);
+        }
+        slots[level][slot].push_back(timer);
+        size++;
     }
-    users[userID] = {userID, name, email, {}, 0, 0.0};
-    saveUsers();  // Persist to file
-    return true;
+    
+    // Moves the clock to t and calls fire for every timer due by then.
+    template <typename F>
+    void advance(uint32_t t, F fire) {
+        if (t <= now) return;
+        if (size == 0 || t - now > SLOTS * SLOTS) {
+            rebuild(t, fire);
+            return;
+        }
+        while (now < t) {
+            now++;
+            // Bring down the timers whose higher digits the clock just reached
+            for (int level = LEVELS - 1; level > 0; level--) {
+                if (now & ((1u << (BITS * level)) - 1)) continue;
+                cascade(level, (now >> (BITS * level)) & (SLOTS - 1), fire);
+            }
+            cascade(0, now & (SLOTS - 1), fire);
+        }
+    }
+    
+    template <typename F>
+    void cascade(int level, uint32_t slot, F& fire) {
+        if (slots[level][slot].empty()) return;
+        vector<HoldTimer> due;
+        due.swap(slots[level][slot]);
+        size -= due.size();
+        for (const HoldTimer& timer : due) {
+            if (timer.deadline <= now) fire(timer);
+            else schedule(timer);
+        }
+    }
+    
+    // After a long gap (or to start the clock) re-place every timer directly.
+    template <typename F>
+    void rebuild(uint32_t t, F& fire) {
+        vector<HoldTimer> all;
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                all.insert(all.end(), slot.begin(), slot.end());
+                slot.clear();
+            }
+        }
+        now = t;
+        size = 0;
+        for (const HoldTimer& timer : all) {
+            if (timer.deadline <= now) fire(timer);
+            else schedule(timer);
+        }
+    }
+};
+
+// holdTimersMutex guards both; routes faulted in from the snapshot add
+// timers without holding the ledger. Take it last.
+TimingWheel holdTimers;
+vector<pair<int, int>> unstampedHolds; // holds loaded without a deadline
+mutex holdTimersMutex;
+
+uint32_t holdClock() {
+    return (uint32_t)time(nullptr);
 }
 
-bool updateUser(const string& userID, const string& name, const string& email) {
-    if (users.find(userID) == users.end()) {
-        return false;
+void scheduleHold(int routeID, int index, uint32_t deadline) {
+    lock_guard<mutex> lock(holdTimersMutex);
+    if (holdTimers.now == 0) holdTimers.now = holdClock();
+    holdTimers.schedule({routeID, index, deadline});
+}
+
+// Stores a seat while loading (text file, journal, snapshot). A hold whose
+// deadline has passed is released here, so every load sees it expired
+// without writing anything. A hold saved before deadlines existed gets the
+// default TTL, starting now.
+void storeSeat(RouteSeats& route, int index, SeatStatus st, Sym userID, Sym bookingID, uint32_t holdUntil) {
+    if (st == SEAT_RESERVED) {
+        uint32_t now = holdClock();
+        if (holdUntil == 0) {
+            holdUntil = now + RESERVATION_DEFAULT_TTL;
+            lock_guard<mutex> lock(holdTimersMutex);
+            unstampedHolds.push_back({route.routeID, index});
+        }
+        if (holdUntil <= now) {
+            st = SEAT_AVAILABLE;
+            userID = bookingID = 0;
+            holdUntil = 0;
+        } else {
+            scheduleHold(route.routeID, index, holdUntil);
+        }
     }
-    users[userID].name = name;
-    users[userID].email = email;
-    saveUsers();  // Persist to file
-    return true;
+    route.set(index, st, userID, bookingID, holdUntil);
 }
 
-bool userExists(const string& userID) {
-    return users.find(userID) != users.end();
+// Stores a seat given in record form (text line, journal, snapshot).
+void storeSeatRecord(const Seat& s) {
+    storeSeat(routeSeatsEntry(s.routeID), s.index, s.status, s.userID, s.bookingID, s.holdUntil);
 }
 
 // ========================
-// Booking Management
+// Metrics
 // ========================
+// Latency histograms for every command and for each phase of a run
+// (reading input, loading and saving each table, journal replay and
+// flushes, writing output), plus byte and record counters. A command's
+// time includes parsing its request. getMetrics reports them, and
+// --metrics-file appends one JSON line per process. Recording costs two
+// timestamp reads and a few relaxed atomic adds.
+// Building with -DLOGIC_NO_METRICS compiles every probe out.
 
-string bookSeats(int routeID, const string& routeInfo, const string& userID, 
-                 const vector<string>& seatIDs, double pricePerSeat) {
+enum MetricPhase {
+    PHASE_READ_INPUT,
+    PHASE_OPEN_SNAPSHOT,
+    PHASE_LOAD_USERS,
+    PHASE_LOAD_BOOKINGS,
+    PHASE_LOAD_SEATS,
+    PHASE_LOAD_ROUTES,
+    PHASE_LOAD_TIMETABLE,
+    PHASE_REPLAY_JOURNAL,
+    PHASE_FLUSH_JOURNAL,
+    PHASE_SAVE_USERS,
+    PHASE_SAVE_BOOKINGS,
+    PHASE_SAVE_SEATS,
+    PHASE_SAVE_SNAPSHOT,
+    PHASE_WRITE_OUTPUT,
+    PHASE_COUNT
+};
+
+const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "readInput", "openSnapshot", "loadUsers", "loadBookings", "loadSeats", "loadRoutes",
+    "loadTimetable", "replayJournal", "flushJournal", "saveUsers", "saveBookings", "saveSeats",
+    "saveSnapshot", "writeOutput"
+};
+
+enum MetricCounter {
+    COUNT_BYTES_READ,     // data files and requests
+    COUNT_BYTES_WRITTEN,  // data files and the journal
+    COUNT_USERS_PARSED,
+    COUNT_BOOKINGS_PARSED,
+    COUNT_SEATS_PARSED,
+    COUNT_ROUTES_PARSED,
+    COUNT_JOURNAL_RECORDS,
+    COUNTER_COUNT
+};
+
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "bytesRead", "bytesWritten", "usersParsed", "bookingsParsed", "seatsParsed", "routesParsed",
+    "journalRecords"
+};
+
+#ifndef LOGIC_NO_METRICS
+
+// Timestamps for the histograms. The TSC on x86-64 costs about half of
+// steady_clock::now(), which matters at a few ticks per command; ticks are
+// converted to nanoseconds only when reported. Elsewhere a tick is 1 ns.
+inline uint64_t metricTicks() {
+#ifdef LOGIC_TSC
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Log-linear histogram of durations in ticks, after HdrHistogram: each power
+// of two is split into 16 linear buckets, so a value is known to within
+// 1/16 of itself. Fixed size; values past 2^40 ticks land in the top bucket.
+struct LatencyHistogram {
+    static const int SUB_BITS = 4;
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAX_EXPONENT = 40;
+    static const int BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB;
     
-    if (!userExists(userID)) {
-        return "ERROR:User does not exist";
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> total{0};
+    atomic<uint64_t> sumTicks{0};
+    atomic<uint64_t> maxTicks{0};
+    
+    static int bucketOf(uint64_t ticks) {
+        if (ticks < (uint64_t)SUB) return (int)ticks;
+        int e = min(63 - __builtin_clzll(ticks), MAX_EXPONENT);
+        if (e == MAX_EXPONENT) return BUCKETS - 1;
+        return (e - SUB_BITS + 1) * SUB + (int)((ticks >> (e - SUB_BITS)) & (SUB - 1));
     }
     
-    // Check if all seats are available
-    for (const string& seatID : seatIDs) {
-        if (seats.find(seatID) == seats.end()) {
-            return "ERROR:Seat " + seatID + " does not exist";
-        }
-        if (seats[seatID].status != "Available") {
-            return "ERROR:Seat " + seatID + " is not available";
-        }
-        if (seats[seatID].routeID != routeID) {
-            return "ERROR:Seat " + seatID + " does not belong to this route";
-        }
+    // Highest value that falls in bucket b
+    static uint64_t bucketLimit(int b) {
+        if (b < SUB) return b;
+        int e = b / SUB + SUB_BITS - 1;
+        uint64_t width = 1ull << (e - SUB_BITS);
+        return (uint64_t)(SUB + b % SUB) * width + width - 1;
     }
     
-    // Create booking
-    string bookingID = generateBookingID();
-    double totalPrice = pricePerSeat * seatIDs.size();
+    void record(uint64_t ticks) {
+        counts[bucketOf(ticks)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sumTicks.fetch_add(ticks, memory_order_relaxed);
+        if (ticks > maxTicks.load(memory_order_relaxed)) maxTicks.store(ticks, memory_order_relaxed);
+    }
     
-    Booking booking = {
-        bookingID,
-        routeID,
-        routeInfo,
-        userID,
-        seatIDs,
-        totalPrice,
-        getCurrentTimestamp(),
-        "Active"
-    };
+    // Same as record() without locked instructions; only for histograms that
+    // a single thread writes (the per-command ones)
+    void recordOwned(uint64_t ticks) {
+        auto bump = [](atomic<uint64_t>& a, uint64_t n) { a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed); };
+        bump(counts[bucketOf(ticks)], 1);
+        bump(total, 1);
+        bump(sumTicks, ticks);
+        if (ticks > maxTicks.load(memory_order_relaxed)) maxTicks.store(ticks, memory_order_relaxed);
+    }
     
-    bookings[bookingID] = booking;
+    // Smallest bucket limit covering fraction q of the values
+    uint64_t quantile(double q) const {
+        uint64_t n = total.load(memory_order_relaxed);
+        if (n == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(q * n)), seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen >= rank) return min(bucketLimit(b), maxTicks.load(memory_order_relaxed));
+        }
+        return maxTicks.load(memory_order_relaxed);
+    }
     
-    // Update seats
-    for (const string& seatID : seatIDs) {
-        seats[seatID].status = "Booked";
-        seats[seatID].userID = userID;
-        seats[seatID].bookingID = bookingID;
+    void reset() {
+        for (auto& c : counts) c.store(0, memory_order_relaxed);
+        total = 0;
+        sumTicks = 0;
+        maxTicks = 0;
     }
+};
+
+struct Metrics {
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    // Calibration for ticks to nanoseconds; unlike started, never reset
+    const chrono::steady_clock::time_point clockBase = chrono::steady_clock::now();
+    const uint64_t tickBase = metricTicks();
+    LatencyHistogram phases[PHASE_COUNT];
+    atomic<uint64_t> counters[COUNTER_COUNT];
+    // Per command name; only the thread serving requests adds to the map
+    unordered_map<string, unique_ptr<LatencyHistogram>> commands;
     
-    // Update user
-    users[userID].bookingIDs.push_back(bookingID);
-    users[userID].totalBookings++;
-    users[userID].totalSpent += totalPrice;
+    LatencyHistogram& command(const string& name) {
+        auto it = commands.find(name);
+        if (it == commands.end()) {
+            it = commands.emplace(string(name), unique_ptr<LatencyHistogram>(new LatencyHistogram())).first;
+        }
+        return *it->second;
+    }
     
-    // Persist changes
-    saveBookings();
-    saveSeatState();
-    saveUsers();
+    void reset() {
+        started = chrono::steady_clock::now();
+        for (auto& h : phases) h.reset();
+        for (auto& c : counters) c.store(0, memory_order_relaxed);
+        // Kept, not cleared: the running command's timer points into one
+        for (auto& entry : commands) entry.second->reset();
+    }
     
-    return bookingID;
+    double nanosPerTick() const {
+        uint64_t ticks = metricTicks() - tickBase;
+        if (ticks == 0) return 1;
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - clockBase).count() / ticks;
+    }
+};
+
+Metrics metrics;
+
+// Records the time from construction to destruction into a histogram.
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& h) : histogram(h), start(metricTicks()) {}
+    ~ScopedLatency() { histogram.record(metricTicks() - start); }
+private:
+    LatencyHistogram& histogram;
+    uint64_t start;
+};
+
+// Times a command from before parsing to the end of its response; the
+// histogram is picked once the command name is known.
+class CommandLatency {
+public:
+    CommandLatency() : start(metricTicks()) {}
+    ~CommandLatency() { if (histogram) histogram->recordOwned(metricTicks() - start); }
+    void into(LatencyHistogram& h) { histogram = &h; }
+private:
+    LatencyHistogram* histogram = nullptr;
+    uint64_t start;
+};
+
+#define METRIC_PHASE(phase) ScopedLatency metricPhase(metrics.phases[phase])
+#define METRIC_COMMAND_START() CommandLatency metricCommand
+#define METRIC_COMMAND(name) metricCommand.into(metrics.command(name))
+#define METRIC_COUNT(counter, n) metrics.counters[counter].fetch_add((n), memory_order_relaxed)
+
+#else
+
+#define METRIC_PHASE(phase) ((void)0)
+#define METRIC_COMMAND_START() ((void)0)
+#define METRIC_COMMAND(name) ((void)0)
+#define METRIC_COUNT(counter, n) ((void)0)
+
+#endif // LOGIC_NO_METRICS
+
+string metricsFile; // --metrics-file; one-shot and batch runs append a line
+
+// ========================
+// Data Persistence
+// ========================
+// data_*.txt hold a snapshot of each table. Mutations are not written there
+// directly; they go to the journal below and are folded into the snapshot
+// files by compaction.
+const string USERS_FILE = "backend/data_users.txt";
+const string BOOKINGS_FILE = "backend/data_bookings.txt";
+const string SEATS_FILE = "backend/data_seats.txt";
+const string TRIP_SEATS_FILE = "backend/data_trip_seats.txt";
+const string ROUTES_FILE = "backend/routes.txt";
+
+void appendUTF8(string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | cp >> 6);
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | cp >> 12);
+        out += (char)(0x80 | (cp >> 6 & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | cp >> 18);
+        out += (char)(0x80 | (cp >> 12 & 0x3F));
+        out += (char)(0x80 | (cp >> 6 & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
 }
 
-bool cancelBooking(const string& bookingID, const string& userID) {
-    if (bookings.find(bookingID) == bookings.end()) {
-        return false;
+bool parseHex4(const char* p, const char* end, uint32_t& value) {
+    if (end - p < 4) return false;
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return false;
+        value = value << 4 | digit;
     }
+    return true;
+}
+
+// Records saved while request strings were stored undecoded hold JSON
+// escapes such as "\u2192" verbatim; turn them back into text on load.
+// Escapes that would yield a control character or a field separator stay.
+string decodeLegacyEscapes(string_view text) {
+    if (text.find('\\') == string_view::npos) return string(text);
+    string out;
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end) {
+        uint32_t cp = 0;
+        if (*p == '\\' && p + 1 < end && (p[1] == '"' || p[1] == '\\' || p[1] == '/')) {
+            out += p[1];
+            p += 2;
+        } else if (*p == '\\' && p + 1 < end && p[1] == 'u' && parseHex4(p + 2, end, cp) &&
+                   cp >= 0x20 && cp != '|') {
+            p += 6;
+            uint32_t low;
+            if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                parseHex4(p + 2, end, low) && low >= 0xDC00 && low < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                p += 6;
+            }
+            appendUTF8(out, cp);
+        } else {
+            out += *p++;
+        }
+    }
+    return out;
+}
+
+// The whole of text as a number; false for anything else, so a damaged
+// record is dropped instead of throwing.
+template <typename T>
+bool parseNumber(string_view text, T& value) {
+    const char* end = text.data() + text.size();
+    auto r = from_chars(text.data(), end, value);
+    return !text.empty() && r.ec == errc() && r.ptr == end;
+}
+
+string formatUserLine(const User& u) {
+    ostringstream oss;
+    oss << sv(u.userID) << "|" << sv(u.name) << "|" << u.email << "|"
+        << u.totalBookings << "|" << fixed << setprecision(2) << u.totalSpent;
+    return oss.str();
+}
+
+bool parseUserLine(const string& line, User& u) {
+    size_t pos1 = line.find('|');
+    size_t pos2 = line.find('|', pos1 + 1);
+    size_t pos3 = line.find('|', pos2 + 1);
+    size_t pos4 = line.find('|', pos3 + 1);
     
-    Booking& booking = bookings[bookingID];
-    
-    if (booking.userID != userID) {
-        return false; // User doesn't own this booking
+    if (pos1 == string::npos || pos2 == string::npos || pos3 == string::npos || pos4 == string::npos) {
+        return false;
+    }
+    string_view view(line);
+    if (!parseNumber(view.substr(pos3 + 1, pos4 - pos3 - 1), u.totalBookings) ||
+        !parseNumber(view.substr(pos4 + 1), u.totalSpent)) {
+        return false;
     }
+    u.userID = intern(view.substr(0, pos1));
+    u.name = intern(decodeLegacyEscapes(view.substr(pos1 + 1, pos2 - pos1 - 1)));
+    u.email = line.substr(pos2 + 1, pos3 - pos2 - 1);
+    return true;
+}
+
+string formatBookingLine(const Booking& b) {
+    ostringstream oss;
+    oss << sv(b.bookingID) << "|" << b.routeID << "|" << sv(b.routeInfo) << "|"
+        << sv(b.userID) << "|";
     
-    if (booking.status == "Cancelled") {
-        return false; // Already cancelled
+    // Save seat IDs
+    for (size_t i = 0; i < b.seatIDs.size(); i++) {
+        if (i > 0) oss << ",";
+        oss << sv(b.seatIDs[i]);
     }
+    oss << "|" << fixed << setprecision(2) << b.totalPrice << "|"
+        << b.timestamp << "|" << sv(b.status);
+    return oss.str();
+}
+
+bool parseBookingLine(const string& line, Booking& b) {
+    string_view view(line);
+    size_t pos = 0;
+    string_view parts[8];
+    int count = 0;
     
-    // Free up seats
-    for (const string& seatID : booking.seatIDs) {
-        if (seats.find(seatID) != seats.end()) {
-            seats[seatID].status = "Available";
-            seats[seatID].userID = "";
-            seats[seatID].bookingID = "";
+    for (; count < 8; count++) {
+        size_t next = view.find('|', pos);
+        if (next == string_view::npos) {
+            parts[count++] = view.substr(pos);
+            break;
         }
+        parts[count] = view.substr(pos, next - pos);
+        pos = next + 1;
     }
     
-    // Update booking status
-    booking.status = "Cancelled";
+    if (count < 8) return false;
+    if (!parseNumber(parts[1], b.routeID) || !parseNumber(parts[5], b.totalPrice)) return false;
     
-    // Update user stats
-    users[userID].totalSpent -= booking.totalPrice;
+    b.bookingID = intern(parts[0]);
+    b.routeInfo = intern(decodeLegacyEscapes(parts[2]));
+    b.userID = intern(parts[3]);
     
+    b.seatIDs.clear();
+    string_view seats = parts[4];
+    while (!seats.empty()) {
+        size_t comma = seats.find(',');
+        string_view seat = seats.substr(0, comma);
+        if (!seat.empty()) b.seatIDs.push_back(intern(seat));
+        if (comma == string_view::npos) break;
+        seats.remove_prefix(comma + 1);
+    }
+    
+    b.timestamp = string(parts[6]);
+    b.status = intern(parts[7]);
     return true;
 }
 
-bool reserveSeat(const string& seatID, const string& userID) {
-    if (seats.find(seatID) == seats.end()) {
-        return false;
+string formatSeatLine(const Seat& s) {
+    string line = makeSeatID(s.routeID, s.index);
+    line += '|';
+    line += seatStatusName(s.status);
+    line += '|';
+    line += sv(s.userID);
+    line += '|';
+    line += to_string(s.routeID);
+    line += '|';
+    line += sv(s.bookingID);
+    if (s.holdUntil) {
+        line += '|';
+        line += to_string(s.holdUntil);
     }
+    return line;
+}
+
+bool parseSeatLine(const string& line, Seat& s) {
+    size_t pos1 = line.find('|');
+    size_t pos2 = line.find('|', pos1 + 1);
+    size_t pos3 = line.find('|', pos2 + 1);
+    size_t pos4 = line.find('|', pos3 + 1);
     
-    if (seats[seatID].status != "Available") {
+    if (pos1 == string::npos || pos2 == string::npos || pos3 == string::npos || pos4 == string::npos) {
         return false;
     }
-    
-    seats[seatID].status = "Reserved";
-    seats[seatID].userID = userID;
+    // Records whose ID is not of the R<route>S<n> form are dropped
+    string_view view(line);
+    if (!parseSeatID(view.substr(0, pos1), s.routeID, s.index)) return false;
+    size_t pos5 = line.find('|', pos4 + 1);
+    s.holdUntil = 0;
+    if (pos5 != string::npos && !parseNumber(view.substr(pos5 + 1), s.holdUntil)) return false;
+    s.status = parseSeatStatus(view.substr(pos1 + 1, pos2 - pos1 - 1));
+    s.userID = intern(view.substr(pos2 + 1, pos3 - pos2 - 1));
+    // An optional sixth field holds a reservation's deadline, read above
+    s.bookingID = intern(view.substr(pos4 + 1, pos5 == string::npos ? string::npos : pos5 - pos4 - 1));
     return true;
 }
 
-bool releaseSeat(const string& seatID, const string& userID) {
-    if (seats.find(seatID) == seats.end()) {
-        return false;
-    }
-    
-    if (seats[seatID].userID != userID) {
-        return false;
-    }
-    
-    if (seats[seatID].status == "Reserved") {
-        seats[seatID].status = "Available";
-        seats[seatID].userID = "";
-        return true;
-    }
-    
-    return false;
+struct TripSeat {
+    TripDate trip;
+    TripSeatHold hold;
+    bool released; // the hold was given up
+};
+
+// <trip>@<yyyymmdd>S<n>[:<from>-<to>]|userID|bookingID; a released hold
+// has no userID.
+string formatTripSeatLine(const TripSeat& s) {
+    string line = makeTripSeatID(sv(s.trip.first), s.trip.second, s.hold.index, s.hold.legs);
+    line += '|';
+    if (!s.released) line += sv(s.hold.userID);
+    line += '|';
+    line += sv(s.hold.bookingID);
+    return line;
 }
 
-// ========================
-// JSON Output Functions
-// ========================
+bool parseTripSeatLine(string_view line, TripSeat& s) {
+    size_t pos1 = line.find('|');
+    size_t pos2 = line.find('|', pos1 + 1);
+    if (pos1 == string_view::npos || pos2 == string_view::npos) return false;
+    string_view tripID;
+    if (!parseTripSeatID(line.substr(0, pos1), tripID, s.trip.second, s.hold.index, s.hold.legs)) return false;
+    s.trip.first = intern(tripID);
+    s.hold.userID = intern(line.substr(pos1 + 1, pos2 - pos1 - 1));
+    s.hold.bookingID = intern(line.substr(pos2 + 1));
+    s.released = s.hold.userID == 0;
+    return true;
+}
 
-string vectorToJSON(const vector<string>& vec) {
-    ostringstream oss;
-    oss << "[";
-    for (size_t i = 0; i < vec.size(); i++) {
-        oss << "\"" << vec[i] << "\"";
-        if (i < vec.size() - 1) oss << ",";
+void storeTripSeat(const TripSeat& s) {
+    if (!s.released) {
+        tripInventory[s.trip].hold(s.hold);
+        return;
     }
-    oss << "]";
-    return oss.str();
+    auto it = tripInventory.find(s.trip);
+    if (it == tripInventory.end()) return;
+    it->second.release(s.hold.index, s.hold.legs, s.hold.bookingID);
+    if (it->second.holds.empty()) tripInventory.erase(it);
 }
 
-string seatsToJSON(int routeID) {
-    ostringstream oss;
-    oss << "[";
-    bool first = true;
-    for (const auto& pair : seats) {
-        if (pair.second.routeID == routeID) {
-            if (!first) oss << ",";
-            first = false;
-            oss << "{"
-                << "\"seatID\":\"" << pair.second.seatID << "\","
-                << "\"status\":\"" << pair.second.status << "\","
-                << "\"userID\":\"" << pair.second.userID << "\","
-                << "\"bookingID\":\"" << pair.second.bookingID << "\""
-                << "}";
-        }
-    }
-    oss << "]";
-    return oss.str();
+void applyBooking(const Booking& b) {
+    auto it = bookings.find(b.bookingID);
+    reindexBooking(it == bookings.end() ? nullptr : &it->second, b);
+    bookings[b.bookingID] = b;
+    raiseNextBookingID(bookingNumber(sv(b.bookingID)) + 1);
 }
 
-string allSeatsToJSON() {
-    ostringstream oss;
-    oss << "[";
-    bool first = true;
-    for (const auto& pair : seats) {
-        if (!first) oss << ",";
-        first = false;
-        oss << "{"
-            << "\"seatID\":\"" << pair.second.seatID << "\","
-            << "\"status\":\"" << pair.second.status << "\","
-            << "\"userID\":\"" << pair.second.userID << "\","
-            << "\"routeID\":" << pair.second.routeID << ","
-            << "\"bookingID\":\"" << pair.second.bookingID << "\""
-            << "}";
-    }
-    oss << "]";
-    return oss.str();
+int openForAppend(const string& path) {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
 }
 
-string userToJSON(const string& userID) {
-    if (users.find(userID) == users.end()) {
-        return "{}";
+bool writeAll(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+#ifdef _WIN32
+        int n = _write(fd, data.data() + done, (unsigned)(data.size() - done));
+#else
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        done += n;
     }
-    
-    const User& u = users[userID];
-    ostringstream oss;
-    oss << "{"
-        << "\"userID\":\"" << u.userID << "\","
-        << "\"name\":\"" << u.name << "\","
-        << "\"email\":\"" << u.email << "\","
-        << "\"totalBookings\":" << u.totalBookings << ","
-        << "\"totalSpent\":" << fixed << setprecision(2) << u.totalSpent << ","
-        << "\"bookingIDs\":" << vectorToJSON(u.bookingIDs)
-        << "}";
-    return oss.str();
+    METRIC_COUNT(COUNT_BYTES_WRITTEN, data.size());
+    return true;
 }
 
-string allUsersToJSON() {
-    ostringstream oss;
-    oss << "[";
-    bool first = true;
-    for (const auto& pair : users) {
-        if (!first) oss << ",";
-        first = false;
-        oss << userToJSON(pair.first);
-    }
-    oss << "]";
-    return oss.str();
+void syncFile(int fd) {
+#ifdef _WIN32
+    _commit(fd);
+#elif defined(__APPLE__)
+    fsync(fd);
+#else
+    fdatasync(fd);
+#endif
 }
 
-string bookingToJSON(const string& bookingID) {
-    if (bookings.find(bookingID) == bookings.end()) {
-        return "{}";
-    }
-    
-    const Booking& b = bookings[bookingID];
-    ostringstream oss;
-    oss << "{"
-        << "\"bookingID\":\"" << b.bookingID << "\","
-        << "\"routeID\":" << b.routeID << ","
-        << "\"routeInfo\":\"" << b.routeInfo << "\","
-        << "\"userID\":\"" << b.userID << "\","
-        << "\"seatIDs\":" << vectorToJSON(b.seatIDs) << ","
-        << "\"totalPrice\":" << fixed << setprecision(2) << b.totalPrice << ","
-        << "\"timestamp\":\"" << b.timestamp << "\","
-        << "\"status\":\"" << b.status << "\""
-        << "}";
-    return oss.str();
+void closeFile(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
 }
 
-string allBookingsToJSON() {
-    ostringstream oss;
-    oss << "[";
-    bool first = true;
-    for (const auto& pair : bookings) {
-        if (!first) oss << ",";
-        first = false;
-        oss << bookingToJSON(pair.first);
-    }
-    oss << "]";
-    return oss.str();
+// Writes to a temp file, syncs it and renames it over path, so readers see
+// either the old or the new snapshot, never a half-written one.
+bool writeFileAtomically(const string& path, const string& contents) {
+    string tmp = path + ".tmp";
+    remove(tmp.c_str());
+    int fd = openForAppend(tmp);
+    if (fd < 0) return false;
+    bool ok = writeAll(fd, contents);
+    if (ok) syncFile(fd);
+    closeFile(fd);
+    if (!ok) return false;
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    return rename(tmp.c_str(), path.c_str()) == 0;
 }
 
-string userBookingsToJSON(const string& userID) {
-    if (users.find(userID) == users.end()) {
-        return "[]";
-    }
-    
-    ostringstream oss;
-    oss << "[";
-    bool first = true;
-    for (const string& bookingID : users[userID].bookingIDs) {
-        if (!first) oss << ",";
-        first = false;
-        oss << bookingToJSON(bookingID);
+// Read-only view of a whole file: mmap'ed where available, read into
+// memory otherwise.
+struct MappedFile {
+    const char* base = nullptr;
+    size_t size = 0;
+    vector<char> buffer;
+};
+
+bool mapFile(const string& path, MappedFile& f) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
     }
-    oss << "]";
-    return oss.str();
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    f.base = (const char*)p;
+    f.size = st.st_size;
+#else
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return false;
+    f.buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    if (f.buffer.empty()) return false;
+    f.base = f.buffer.data();
+    f.size = f.buffer.size();
+#endif
+    return true;
 }
 
-string seatStatsToJSON(int routeID) {
-    ostringstream oss;
-    oss << "{"
-        << "\"routeID\":" << routeID << ","
-        << "\"total\":40,"
-        << "\"available\":" << countAvailableSeats(routeID) << ","
-        << "\"booked\":" << countBookedSeats(routeID) << ","
-        << "\"reserved\":" << countReservedSeats(routeID)
-        << "}";
-    return oss.str();
+void unmapFile(MappedFile& f) {
+#ifndef _WIN32
+    if (f.base) munmap((void*)f.base, f.size);
+#endif
+    f.base = nullptr;
+    f.size = 0;
+    f.buffer.clear();
 }
 
-// ========================
-// JSON Input Parser
-// ========================
+const string LOCK_FILE = "backend/data.lock";
 
-string extractValue(const string& input, const string& key) {
-    size_t keyPos = input.find("\"" + key + "\"");
-    if (keyPos == string::npos) return "";
-    
-    size_t colonPos = input.find(':', keyPos);
-    if (colonPos == string::npos) return "";
-    
-    size_t valueStart = input.find_first_not_of(" \t\n\r", colonPos + 1);
-    if (valueStart == string::npos) return "";
-    
-    if (input[valueStart] == '"') {
-        size_t valueEnd = input.find('"', valueStart + 1);
-        if (valueEnd == string::npos) return "";
-        return input.substr(valueStart + 1, valueEnd - valueStart - 1);
-    } else if (isdigit(input[valueStart]) || input[valueStart] == '-') {
-        size_t valueEnd = input.find_first_of(",}\n", valueStart);
-        if (valueEnd == string::npos) valueEnd = input.length();
-        return input.substr(valueStart, valueEnd - valueStart);
+// One-shot and batch runs load the data files, change them and write them
+// back, so two at once would lose each other's bookings. Each holds an
+// exclusive lock on LOCK_FILE until it exits and waits for its turn. A
+// daemon holds the lock for its whole life and writes DAEMON_LOCK_MARK into
+// the file; other runs then fail at once rather than wait for it, since
+// its compactions would overwrite their writes. Returns false in that case.
+const char DAEMON_LOCK_MARK[] = "serve\n";
+const char DAEMON_RUNNING_ERROR[] = "A logic --serve daemon is using the data files; send commands to it";
+int dataLockFd = -1;
+
+bool lockDataFiles(bool daemon = false) {
+#ifndef _WIN32
+    int fd = open(LOCK_FILE.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return true;
+    while (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        if (errno != EWOULDBLOCK && errno != EINTR) return true;
+        char mark[sizeof(DAEMON_LOCK_MARK)] = {};
+        if (pread(fd, mark, sizeof(mark) - 1, 0) > 0 && strcmp(mark, DAEMON_LOCK_MARK) == 0) {
+            close(fd);
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(5));
     }
-    
-    return "";
+    dataLockFd = fd;
+    // A daemon that died left its mark behind
+    if (ftruncate(fd, 0) == 0 && daemon) {
+        ssize_t n = pwrite(fd, DAEMON_LOCK_MARK, sizeof(DAEMON_LOCK_MARK) - 1, 0);
+        (void)n;
+    }
+#else
+    (void)daemon;
+#endif
+    return true;
 }
 
-vector<string> extractArray(const string& input, const string& key) {
-    vector<string> result;
-    size_t keyPos = input.find("\"" + key + "\"");
-    if (keyPos == string::npos) return result;
-    
-    size_t arrayStart = input.find('[', keyPos);
-    size_t arrayEnd = input.find(']', arrayStart);
-    if (arrayStart == string::npos || arrayEnd == string::npos) return result;
-    
-    string arrayContent = input.substr(arrayStart + 1, arrayEnd - arrayStart - 1);
-    size_t pos = 0;
-    while (pos < arrayContent.length()) {
-        size_t quoteStart = arrayContent.find('"', pos);
-        if (quoteStart == string::npos) break;
-        size_t quoteEnd = arrayContent.find('"', quoteStart + 1);
-        if (quoteEnd == string::npos) break;
-        result.push_back(arrayContent.substr(quoteStart + 1, quoteEnd - quoteStart - 1));
-        pos = quoteEnd + 1;
-    }
-    
-    return result;
+// Clears the daemon's mark; the lock itself goes with the process.
+void unmarkDataFiles() {
+#ifndef _WIN32
+    if (dataLockFd < 0) return;
+    int rc = ftruncate(dataLockFd, 0);
+    (void)rc;
+#endif
 }
 
-// ========================
-// Main Command Processor
-// ========================
+// Text file index. Each data_*.txt file has a sidecar index (data_users.idx,
+// ...) so that single records can be read without parsing the whole file.
+// The index has one section per key: users by userID; bookings by
+// bookingID, userID and routeID; seats by routeID. A section is an array
+// of (key hash, offset, length) entries sorted by hash, each covering a
+// run of consecutive lines with that key. Only FNV-1a hashes of keys are
+// stored, so callers check the lines they get back. The header records
+// the size, mtime and inode of the text file it describes. If they no
+// longer match, the index is ignored, the file is loaded in full and the
+// index is rebuilt from it. Saving a table writes both.
+const char TEXT_INDEX_MAGIC[8] = {'B', 'R', 'F', 'T', 'I', 'D', 'X', '\0'};
+const uint32_t TEXT_INDEX_VERSION = 1;
+const int TEXT_INDEX_MAX_KEYS = 3;
 
-int main(int argc, char* argv[]) {
-    string input, line;
-    while (getline(cin, line)) {
-        input += line;
-    }
-    
-    // Load persisted data so this process knows about existing users/bookings/seats
-    loadUsers();
-    loadBookings();
-    loadSeatState();
-    loadRoutesFromFile();
+enum BookingKey { BOOKINGS_BY_ID, BOOKINGS_BY_USER, BOOKINGS_BY_ROUTE };
 
-    string cmd = extractValue(input, "cmd");
-    
-    if (cmd.empty()) {
-        cout << "{\"error\":\"No command specified\"}" << endl;
-        return 1;
+struct FileStamp {
+    uint64_t size;
+    int64_t mtimeNs;
+    uint64_t inode;
+};
+
+bool fileStamp(const string& path, FileStamp& out) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    out.size = st.st_size;
+#if defined(__APPLE__)
+    out.mtimeNs = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    out.mtimeNs = (int64_t)st.st_mtime * 1000000000;
+#else
+    out.mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    out.inode = st.st_ino;
+    return true;
+}
+
+struct TextIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyCount;
+    uint64_t dataSize;      // FileStamp of the text file
+    int64_t dataMtimeNs;
+    uint64_t dataInode;
+    uint32_t entryCount[TEXT_INDEX_MAX_KEYS];
+    int32_t nextBookingID;  // bookings: one past the highest BK number
+};
+
+struct TextIndexEntry {
+    uint64_t keyHash;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t padding;
+};
+
+static_assert(sizeof(TextIndexHeader) == 56, "text index header layout");
+static_assert(sizeof(TextIndexEntry) == 24, "text index entry layout");
+
+struct TextIndex {
+    string dataPath;
+    string indexPath;
+    uint32_t keyCount;
+    MappedFile file;
+    const TextIndexHeader* header = nullptr;
+    ifstream data; // opened on first lookup
+
+    TextIndex(string data, string index, uint32_t keys)
+        : dataPath(move(data)), indexPath(move(index)), keyCount(keys) {}
+
+    bool isOpen() const { return header != nullptr; }
+
+    const TextIndexEntry* entries(int key) const {
+        size_t offset = sizeof(TextIndexHeader);
+        for (int k = 0; k < key; k++) offset += header->entryCount[k] * sizeof(TextIndexEntry);
+        return (const TextIndexEntry*)(file.base + offset);
     }
-    
-    // User Management Commands
-    if (cmd == "createUser") {
-        string userID = extractValue(input, "userID");
-        string name = extractValue(input, "name");
-        string email = extractValue(input, "email");
-        
-        if (createUser(userID, name, email)) {
-            cout << "{\"success\":true,\"user\":" << userToJSON(userID) << "}" << endl;
+};
+
+TextIndex usersText(USERS_FILE, "backend/data_users.idx", 1);
+TextIndex bookingsText(BOOKINGS_FILE, "backend/data_bookings.idx", 3);
+TextIndex seatsText(SEATS_FILE, "backend/data_seats.idx", 1);
+
+// Collects a text file's index while it is written or read in full.
+struct TextIndexBuilder {
+    vector<TextIndexEntry> entries[TEXT_INDEX_MAX_KEYS];
+    int32_t nextBookingID = 0;
+
+    // Files the line at offset (length bytes with its newline) under key,
+    // extending the previous entry when the line continues its run.
+    void add(int k, string_view key, uint64_t offset, uint64_t length) {
+        uint64_t hash = fnv1a(key);
+        vector<TextIndexEntry>& v = entries[k];
+        if (!v.empty() && v.back().keyHash == hash && v.back().offset + v.back().length == offset) {
+            v.back().length += (uint32_t)length;
         } else {
-            cout << "{\"error\":\"User already exists\"}" << endl;
+            v.push_back({hash, offset, (uint32_t)length, 0});
+        }
+    }
+
+    bool write(const TextIndex& target, const FileStamp& stamp) {
+        TextIndexHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, TEXT_INDEX_MAGIC, sizeof(TEXT_INDEX_MAGIC));
+        h.version = TEXT_INDEX_VERSION;
+        h.keyCount = target.keyCount;
+        h.dataSize = stamp.size;
+        h.dataMtimeNs = stamp.mtimeNs;
+        h.dataInode = stamp.inode;
+        h.nextBookingID = nextBookingID;
+        string out((const char*)&h, sizeof(h));
+        for (uint32_t k = 0; k < target.keyCount; k++) {
+            vector<TextIndexEntry>& v = entries[k];
+            // Entries for one key stay in file order
+            stable_sort(v.begin(), v.end(),
+                [](const TextIndexEntry& a, const TextIndexEntry& b) { return a.keyHash < b.keyHash; });
+            h.entryCount[k] = (uint32_t)v.size();
+            out.append((const char*)v.data(), v.size() * sizeof(TextIndexEntry));
+        }
+        memcpy(&out[0], &h, sizeof(h));
+        return writeFileAtomically(target.indexPath, out);
+    }
+};
+
+// Maps ix's index if it was built from the text file as it is now.
+bool openTextIndex(TextIndex& ix) {
+    FileStamp stamp;
+    if (!fileStamp(ix.dataPath, stamp) || !mapFile(ix.indexPath, ix.file)) return false;
+    const TextIndexHeader* h = (const TextIndexHeader*)ix.file.base;
+    uint64_t entryBytes = 0;
+    bool valid = ix.file.size >= sizeof(TextIndexHeader) &&
+                 memcmp(h->magic, TEXT_INDEX_MAGIC, sizeof(TEXT_INDEX_MAGIC)) == 0 &&
+                 h->version == TEXT_INDEX_VERSION && h->keyCount == ix.keyCount &&
+                 h->dataSize == stamp.size && h->dataMtimeNs == stamp.mtimeNs && h->dataInode == stamp.inode;
+    if (valid) {
+        for (uint32_t k = 0; k < ix.keyCount; k++) entryBytes += (uint64_t)h->entryCount[k] * sizeof(TextIndexEntry);
+        valid = entryBytes == ix.file.size - sizeof(TextIndexHeader);
+    }
+    if (!valid) {
+        unmapFile(ix.file);
+        return false;
+    }
+    ix.header = h;
+    return true;
+}
+
+void closeTextIndex(TextIndex& ix) {
+    unmapFile(ix.file);
+    ix.header = nullptr;
+    ix.data.close();
+}
+
+// Appends the lines filed under key in section k, in file order. They
+// include lines of other keys with the same hash.
+void textIndexLookup(TextIndex& ix, int k, string_view key, vector<string>& lines) {
+    const TextIndexEntry* begin = ix.entries(k);
+    const TextIndexEntry* end = begin + ix.header->entryCount[k];
+    uint64_t hash = fnv1a(key);
+    const TextIndexEntry* e = lower_bound(begin, end, hash,
+        [](const TextIndexEntry& a, uint64_t h) { return a.keyHash < h; });
+    if (e == end || e->keyHash != hash) return;
+    if (!ix.data.is_open()) ix.data.open(ix.dataPath, ios::binary);
+    string run;
+    for (; e != end && e->keyHash == hash; ++e) {
+        run.resize(e->length);
+        ix.data.clear();
+        ix.data.seekg(e->offset);
+        ix.data.read(&run[0], e->length);
+        run.resize(ix.data.gcount());
+        METRIC_COUNT(COUNT_BYTES_READ, run.size());
+        istringstream in(run);
+        string line;
+        while (getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) lines.push_back(move(line));
+        }
+    }
+}
+
+// getline over a data file opened in binary mode, so offsets are byte
+// positions. start is where the line began; a trailing '\r' is dropped.
+bool nextDataLine(istream& in, string& line, uint64_t& offset, uint64_t& start) {
+    if (!getline(in, line)) return false;
+    start = offset;
+    offset += line.size() + 1;
+    METRIC_COUNT(COUNT_BYTES_READ, line.size() + 1);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    return true;
+}
+
+void saveUsers(const UserTable& table) {
+    METRIC_PHASE(PHASE_SAVE_USERS);
+    string out;
+    TextIndexBuilder index;
+    for (const auto& pair : table) {
+        size_t start = out.size();
+        out += formatUserLine(pair.second);
+        out += '\n';
+        index.add(0, sv(pair.first), start, out.size() - start);
+    }
+    FileStamp stamp;
+    if (writeFileAtomically(USERS_FILE, out) && fileStamp(USERS_FILE, stamp)) index.write(usersText, stamp);
+}
+
+// Loads every user in the file. Users already in memory are newer (from
+// the journal, or read through the index) and are kept. The index is
+// rebuilt on the way unless the current one is open.
+void loadUsers() {
+    METRIC_PHASE(PHASE_LOAD_USERS);
+    FileStamp stamp;
+    ifstream file(USERS_FILE, ios::binary);
+    if (!file.is_open() || !fileStamp(USERS_FILE, stamp)) return;
+    
+    bool buildIndex = !usersText.isOpen();
+    TextIndexBuilder index;
+    UserTable loaded;
+    string line;
+    User u;
+    uint64_t offset = 0, start;
+    while (nextDataLine(file, line, offset, start)) {
+        if (line.empty()) continue;
+        if (parseUserLine(line, u)) {
+            if (buildIndex) index.add(0, sv(u.userID), start, offset - start);
+            loaded[u.userID] = u;
+            METRIC_COUNT(COUNT_USERS_PARSED, 1);
+        }
+    }
+    file.close();
+    users.merge(loaded);
+    if (buildIndex) index.write(usersText, stamp);
+}
+
+// Files a booking line under its ID, user and route.
+void indexBookingLine(TextIndexBuilder& index, const Booking& b, uint64_t start, uint64_t length) {
+    index.add(BOOKINGS_BY_ID, sv(b.bookingID), start, length);
+    index.add(BOOKINGS_BY_USER, sv(b.userID), start, length);
+    index.add(BOOKINGS_BY_ROUTE, to_string(b.routeID), start, length);
+    index.nextBookingID = max(index.nextBookingID, bookingNumber(sv(b.bookingID)) + 1);
+}
+
+void saveBookings(const BookingTable& table) {
+    METRIC_PHASE(PHASE_SAVE_BOOKINGS);
+    string out;
+    TextIndexBuilder index;
+    for (const auto& pair : table) {
+        size_t start = out.size();
+        out += formatBookingLine(pair.second);
+        out += '\n';
+        indexBookingLine(index, pair.second, start, out.size() - start);
+    }
+    FileStamp stamp;
+    if (writeFileAtomically(BOOKINGS_FILE, out) && fileStamp(BOOKINGS_FILE, stamp)) index.write(bookingsText, stamp);
+}
+
+// As loadUsers: bookings already in memory are kept.
+void loadBookings() {
+    METRIC_PHASE(PHASE_LOAD_BOOKINGS);
+    FileStamp stamp;
+    ifstream file(BOOKINGS_FILE, ios::binary);
+    if (!file.is_open() || !fileStamp(BOOKINGS_FILE, stamp)) return;
+    
+    bool buildIndex = !bookingsText.isOpen();
+    TextIndexBuilder index;
+    BookingTable loaded;
+    vector<Sym> fileOrder; // the booking index lists them as first seen
+    string line;
+    Booking b;
+    uint64_t offset = 0, start;
+    while (nextDataLine(file, line, offset, start)) {
+        if (line.empty()) continue;
+        if (parseBookingLine(line, b)) {
+            if (buildIndex) indexBookingLine(index, b, start, offset - start);
+            raiseNextBookingID(bookingNumber(sv(b.bookingID)) + 1);
+            auto inserted = loaded.emplace(b.bookingID, b);
+            if (inserted.second) fileOrder.push_back(b.bookingID);
+            else inserted.first->second = b;
+            METRIC_COUNT(COUNT_BOOKINGS_PARSED, 1);
+        }
+    }
+    file.close();
+    for (Sym id : fileOrder) {
+        if (!bookings.count(id)) reindexBooking(nullptr, loaded[id]);
+    }
+    bookings.merge(loaded);
+    if (buildIndex) index.write(bookingsText, stamp);
+}
+
+void saveSeatState(const SeatTable& table) {
+    METRIC_PHASE(PHASE_SAVE_SEATS);
+    string out;
+    TextIndexBuilder index;
+    for (const auto& pair : table) {
+        const RouteSeats& r = pair.second;
+        size_t start = out.size();
+        for (int i = 0; i < r.capacity(); i++) {
+            if (!r.exists(i)) continue;
+            out += formatSeatLine(seatRecord(r, i));
+            out += '\n';
+        }
+        if (out.size() > start) index.add(0, to_string(pair.first), start, out.size() - start);
+    }
+    FileStamp stamp;
+    if (writeFileAtomically(SEATS_FILE, out) && fileStamp(SEATS_FILE, stamp)) index.write(seatsText, stamp);
+}
+
+// As loadUsers, per route: routes already in memory are kept whole.
+void loadSeatState() {
+    METRIC_PHASE(PHASE_LOAD_SEATS);
+    FileStamp stamp;
+    ifstream file(SEATS_FILE, ios::binary);
+    if (!file.is_open() || !fileStamp(SEATS_FILE, stamp)) return;
+    
+    bool buildIndex = !seatsText.isOpen();
+    TextIndexBuilder index;
+    unordered_set<int> inMemory;
+    for (const auto& pair : seatInventory) inMemory.insert(pair.first);
+    string line;
+    Seat s;
+    uint64_t offset = 0, start;
+    while (nextDataLine(file, line, offset, start)) {
+        if (line.empty()) continue;
+        if (parseSeatLine(line, s)) {
+            if (buildIndex) index.add(0, to_string(s.routeID), start, offset - start);
+            if (!inMemory.count(s.routeID)) storeSeatRecord(s);
+            METRIC_COUNT(COUNT_SEATS_PARSED, 1);
+        }
+    }
+    file.close();
+    if (buildIndex) index.write(seatsText, stamp);
+}
+
+// data_trip_seats.txt is small (held seats only) and kept as text in both
+// snapshot formats. It is read whole the first time a trip seat is needed.
+bool tripSeatsLoaded = false;
+
+void saveTripSeats(const TripSeatTable& table) {
+    METRIC_PHASE(PHASE_SAVE_SEATS);
+    string out;
+    for (const auto& pair : table) {
+        for (const TripSeatHold& h : pair.second.holds) {
+            out += formatTripSeatLine({pair.first, h, false});
+            out += '\n';
+        }
+    }
+    writeFileAtomically(TRIP_SEATS_FILE, out);
+}
+
+void ensureTripSeats() {
+    if (tripSeatsLoaded) return;
+    METRIC_PHASE(PHASE_LOAD_SEATS);
+    tripSeatsLoaded = true;
+    ifstream file(TRIP_SEATS_FILE, ios::binary);
+    string line;
+    TripSeat s;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        METRIC_COUNT(COUNT_BYTES_READ, line.size() + 1);
+        if (parseTripSeatLine(line, s)) storeTripSeat(s);
+    }
+}
+
+// ========================
+// Binary Snapshot
+// ========================
+// backend/data_snapshot.bin holds the users, bookings and seats tables as
+// fixed-width little-endian records plus a shared string pool, so it can be
+// mmap'ed and queried in place instead of parsed:
+//
+//   SnapHeader | users[] | bookings[] | bookingSeats[] | seats[] | seatRoutes[] | string pool
+//
+// users are sorted by userID and bookings by bookingID (std::string order),
+// seats by (routeID, seatID) with seatRoutes giving each route's range. Only
+// the header and the section extents are checked at open; --verify-snapshot
+// checks the data CRC. Strings and seat ranges are bounds-checked as records
+// are read, so a data section damaged in place yields empty strings and
+// dropped seats (reported once) rather than reads outside the mapping.
+// Records are copied into the in-memory maps on first use (findUser,
+// ensureRouteSeats, ...), and entries already in a map (from the journal)
+// always win over the snapshot.
+//
+// If the file is missing the data_*.txt files are used instead, through
+// their .idx sidecars when those are current (see openTextData); note the
+// text files are only as fresh as the last --export-text once a binary
+// snapshot is in use.
+const string SNAPSHOT_FILE = "backend/data_snapshot.bin";
+const char SNAPSHOT_MAGIC[8] = {'B', 'R', 'F', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerCRC;   // CRC32 of the header with this field zeroed
+    uint32_t dataCRC;     // CRC32 of everything after the header
+    int32_t nextBookingID;
+    uint32_t userCount;
+    uint32_t bookingCount;
+    uint32_t bookingSeatCount;
+    uint32_t seatCount;
+    uint32_t seatRouteCount;
+    uint32_t reserved;
+    uint64_t usersOffset;
+    uint64_t bookingsOffset;
+    uint64_t bookingSeatsOffset;
+    uint64_t seatsOffset;
+    uint64_t seatRoutesOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+struct SnapUser {
+    SnapString userID;
+    SnapString name;
+    SnapString email;
+    int32_t totalBookings;
+    uint32_t padding;
+    double totalSpent;
+};
+
+struct SnapBooking {
+    SnapString bookingID;
+    SnapString routeInfo;
+    SnapString userID;
+    SnapString timestamp;
+    SnapString status;
+    int32_t routeID;
+    uint32_t firstSeat;   // index into bookingSeats
+    uint32_t seatCount;
+    uint32_t padding;
+    double totalPrice;
+};
+
+struct SnapSeat {
+    SnapString seatID;
+    SnapString status;
+    SnapString userID;
+    SnapString bookingID;
+    int32_t routeID;
+    uint32_t holdUntil; // 0 if none; padding in files written before holds expired
+};
+
+struct SnapRoute {
+    int32_t routeID;
+    uint32_t firstSeat;
+    uint32_t seatCount;
+};
+
+static_assert(sizeof(SnapHeader) == 104, "snapshot header layout");
+static_assert(sizeof(SnapUser) == 40, "snapshot user layout");
+static_assert(sizeof(SnapBooking) == 64, "snapshot booking layout");
+static_assert(sizeof(SnapSeat) == 40, "snapshot seat layout");
+static_assert(sizeof(SnapRoute) == 12, "snapshot route layout");
+
+uint32_t crc32(const char* data, size_t len, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t snapshotHeaderCRC(SnapHeader h) {
+    h.headerCRC = 0;
+    return crc32((const char*)&h, sizeof(h));
+}
+
+struct SnapshotView : MappedFile {
+    const SnapHeader* header = nullptr;
+
+    bool isOpen() const { return header != nullptr; }
+
+    string_view str(const SnapString& s) const {
+        if (s.offset > header->stringsSize || s.length > header->stringsSize - s.offset) {
+            damaged();
+            return string_view();
+        }
+        return string_view(base + header->stringsOffset + s.offset, s.length);
+    }
+    // count records from first lie within a section of total records
+    bool inRange(uint32_t first, uint32_t count, uint32_t total) const {
+        if (first <= total && count <= total - first) return true;
+        damaged();
+        return false;
+    }
+    void damaged() const {
+        static bool reported = false;
+        if (reported) return;
+        reported = true;
+        cerr << "Damaged records in " << SNAPSHOT_FILE << " skipped; run --verify-snapshot" << endl;
+    }
+    const SnapUser* users() const { return (const SnapUser*)(base + header->usersOffset); }
+    const SnapBooking* bookings() const { return (const SnapBooking*)(base + header->bookingsOffset); }
+    const SnapString* bookingSeats() const { return (const SnapString*)(base + header->bookingSeatsOffset); }
+    const SnapSeat* seats() const { return (const SnapSeat*)(base + header->seatsOffset); }
+    const SnapRoute* seatRoutes() const { return (const SnapRoute*)(base + header->seatRoutesOffset); }
+};
+
+SnapshotView snapshot;
+bool useBinarySnapshot = false; // compaction writes SNAPSHOT_FILE instead of data_*.txt
+
+// Which tables have been fully copied into memory, out of the snapshot or
+// out of text files with a current index (see openTextData). All true
+// when the text files were loaded up front. A route present in
+// seatInventory always has its stored seats loaded.
+bool usersLoaded = true;
+bool bookingsLoaded = true;
+bool bookingIndexComplete = true; // snapshot bookings not in memory are indexed too
+bool seatsLoaded = true;
+
+bool validateSnapshot(const SnapshotView& v) {
+    if (v.size < sizeof(SnapHeader)) return false;
+    const SnapHeader* h = (const SnapHeader*)v.base;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) return false;
+    if (h->version != SNAPSHOT_VERSION) return false;
+    if (h->headerCRC != snapshotHeaderCRC(*h)) return false;
+    
+    auto fits = [&](uint64_t offset, uint64_t bytes) {
+        return offset <= v.size && bytes <= v.size - offset;
+    };
+    return fits(h->usersOffset, (uint64_t)h->userCount * sizeof(SnapUser)) &&
+           fits(h->bookingsOffset, (uint64_t)h->bookingCount * sizeof(SnapBooking)) &&
+           fits(h->bookingSeatsOffset, (uint64_t)h->bookingSeatCount * sizeof(SnapString)) &&
+           fits(h->seatsOffset, (uint64_t)h->seatCount * sizeof(SnapSeat)) &&
+           fits(h->seatRoutesOffset, (uint64_t)h->seatRouteCount * sizeof(SnapRoute)) &&
+           fits(h->stringsOffset, h->stringsSize);
+}
+
+bool verifySnapshotData(const SnapshotView& v) {
+    return crc32(v.base + sizeof(SnapHeader), v.size - sizeof(SnapHeader)) == v.header->dataCRC;
+}
+
+bool openSnapshot() {
+    METRIC_PHASE(PHASE_OPEN_SNAPSHOT);
+    if (!mapFile(SNAPSHOT_FILE, snapshot)) return false;
+    if (!validateSnapshot(snapshot)) {
+        cerr << "Ignoring invalid " << SNAPSHOT_FILE << ", falling back to text files" << endl;
+        unmapFile(snapshot);
+        snapshot = SnapshotView();
+        return false;
+    }
+    snapshot.header = (const SnapHeader*)snapshot.base;
+    raiseNextBookingID(snapshot.header->nextBookingID);
+    useBinarySnapshot = true;
+    usersLoaded = bookingsLoaded = seatsLoaded = bookingIndexComplete = false;
+    return true;
+}
+
+User userFromSnapshot(const SnapUser& r) {
+    return {intern(snapshot.str(r.userID)), intern(snapshot.str(r.name)),
+            string(snapshot.str(r.email)), r.totalBookings, r.totalSpent};
+}
+
+Booking bookingFromSnapshot(const SnapBooking& r) {
+    vector<Sym> seatIDs;
+    if (snapshot.inRange(r.firstSeat, r.seatCount, snapshot.header->bookingSeatCount)) {
+        seatIDs.reserve(r.seatCount);
+        const SnapString* ids = snapshot.bookingSeats() + r.firstSeat;
+        for (uint32_t i = 0; i < r.seatCount; i++) seatIDs.push_back(intern(snapshot.str(ids[i])));
+    }
+    return {intern(snapshot.str(r.bookingID)), r.routeID, intern(snapshot.str(r.routeInfo)),
+            intern(snapshot.str(r.userID)), seatIDs, r.totalPrice,
+            string(snapshot.str(r.timestamp)), intern(snapshot.str(r.status))};
+}
+
+void loadRouteFromSnapshot(const SnapRoute& route) {
+    RouteSeats& seats = routeSeatsEntry(route.routeID);
+    if (!snapshot.inRange(route.firstSeat, route.seatCount, snapshot.header->seatCount)) return;
+    const SnapSeat* recs = snapshot.seats() + route.firstSeat;
+    int routeID, index;
+    for (uint32_t i = 0; i < route.seatCount; i++) {
+        if (!parseSeatID(snapshot.str(recs[i].seatID), routeID, index)) continue;
+        storeSeat(seats, index, parseSeatStatus(snapshot.str(recs[i].status)),
+                  intern(snapshot.str(recs[i].userID)), intern(snapshot.str(recs[i].bookingID)),
+                  recs[i].holdUntil);
+    }
+}
+
+// Binary search over records sorted by a SnapString key.
+template <typename Rec>
+const Rec* snapshotLookup(const Rec* recs, uint32_t count, SnapString Rec::*key, string_view id) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = snapshot.str(recs[mid].*key).compare(id);
+        if (c == 0) return &recs[mid];
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return nullptr;
+}
+
+void ensureAllUsers() {
+    if (usersLoaded) return;
+    if (!snapshot.isOpen()) {
+        loadUsers();
+        usersLoaded = true;
+        return;
+    }
+    const SnapUser* recs = snapshot.users();
+    for (uint32_t i = 0; i < snapshot.header->userCount; i++) {
+        Sym id = intern(snapshot.str(recs[i].userID));
+        if (!users.count(id)) users.emplace(id, userFromSnapshot(recs[i]));
+    }
+    usersLoaded = true;
+}
+
+// Adds a booking read from the snapshot or a text file to the table. Once
+// the index pass below has run, the index already lists it.
+Booking& faultInBooking(Booking b) {
+    if (!bookingIndexComplete) reindexBooking(nullptr, b);
+    return bookings.emplace(b.bookingID, move(b)).first->second;
+}
+
+void ensureAllBookings() {
+    if (bookingsLoaded) return;
+    if (!snapshot.isOpen()) {
+        loadBookings();
+        bookingsLoaded = bookingIndexComplete = true;
+        return;
+    }
+    const SnapBooking* recs = snapshot.bookings();
+    for (uint32_t i = 0; i < snapshot.header->bookingCount; i++) {
+        Sym id = intern(snapshot.str(recs[i].bookingID));
+        if (!bookings.count(id)) faultInBooking(bookingFromSnapshot(recs[i]));
+    }
+    bookingsLoaded = true;
+}
+
+// Indexes the snapshot's bookings in one pass over their records, without
+// loading them. Bookings already in memory were indexed when they arrived.
+// Text files have no such pass; their bookings are loaded instead.
+void ensureBookingIndex() {
+    if (bookingIndexComplete) return;
+    if (!snapshot.isOpen()) {
+        ensureAllBookings();
+        return;
+    }
+    const SnapBooking* recs = snapshot.bookings();
+    for (uint32_t i = 0; i < snapshot.header->bookingCount; i++) {
+        Sym id;
+        if (symbols.lookup(snapshot.str(recs[i].bookingID), id) && bookings.count(id)) continue;
+        indexBookingFields(intern(snapshot.str(recs[i].bookingID)), recs[i].routeID,
+                           intern(snapshot.str(recs[i].userID)), snapshot.str(recs[i].status) == sv(SYM_ACTIVE));
+    }
+    bookingIndexComplete = true;
+}
+
+// From indexed text files: the records filed under key in section k that
+// parse and pass match, keeping the last line per record as a full load
+// would.
+template <typename Rec, typename Match>
+void textRecords(TextIndex& ix, int k, string_view key, bool (*parse)(const string&, Rec&),
+                 Match match, vector<Rec>& out) {
+    vector<string> lines;
+    textIndexLookup(ix, k, key, lines);
+    Rec rec;
+    for (const string& line : lines) {
+        if (parse(line, rec) && match(rec)) out.push_back(rec);
+    }
+}
+
+template <typename Rec, typename Match>
+bool lastTextRecord(TextIndex& ix, int k, string_view key, bool (*parse)(const string&, Rec&),
+                    Match match, Rec& out) {
+    vector<Rec> found;
+    textRecords(ix, k, key, parse, match, found);
+    if (found.empty()) return false;
+    out = move(found.back());
+    return true;
+}
+
+// Text files only: users and routes whose bookings are all in memory,
+// and so indexed, while bookingsLoaded is still false.
+unordered_set<Sym> userBookingsLoaded;
+unordered_set<int> routeBookingsLoaded;
+
+// Reads the bookings filed under key in section k of the bookings index.
+template <typename Match>
+void faultInTextBookings(int k, string_view key, Match match) {
+    vector<Booking> found;
+    textRecords(bookingsText, k, key, parseBookingLine, match, found);
+    // The last line of each booking, in order of first appearance
+    unordered_map<Sym, size_t> slot;
+    vector<Booking> latest;
+    for (Booking& b : found) {
+        auto it = slot.emplace(b.bookingID, latest.size()).first;
+        if (it->second == latest.size()) latest.push_back(move(b));
+        else latest[it->second] = move(b);
+    }
+    for (Booking& b : latest) {
+        if (!bookings.count(b.bookingID)) faultInBooking(move(b));
+    }
+}
+
+// Makes bookingIndex complete for one user or route. Text files read
+// just that key's lines; the snapshot falls back to the whole index pass.
+void ensureUserBookings(Sym userID) {
+    if (bookingIndexComplete) return;
+    if (snapshot.isOpen()) {
+        ensureBookingIndex();
+        return;
+    }
+    if (!userBookingsLoaded.insert(userID).second) return;
+    faultInTextBookings(BOOKINGS_BY_USER, sv(userID), [&](const Booking& b) { return b.userID == userID; });
+}
+
+void ensureRouteBookings(int routeID) {
+    if (bookingIndexComplete) return;
+    if (snapshot.isOpen()) {
+        ensureBookingIndex();
+        return;
+    }
+    if (!routeBookingsLoaded.insert(routeID).second) return;
+    faultInTextBookings(BOOKINGS_BY_ROUTE, to_string(routeID), [&](const Booking& b) { return b.routeID == routeID; });
+}
+
+void ensureAllSeats() {
+    if (seatsLoaded) return;
+    if (!snapshot.isOpen()) {
+        loadSeatState();
+        seatsLoaded = true;
+        return;
+    }
+    const SnapRoute* routesIdx = snapshot.seatRoutes();
+    for (uint32_t i = 0; i < snapshot.header->seatRouteCount; i++) {
+        if (seatInventory.count(routesIdx[i].routeID)) continue;
+        loadRouteFromSnapshot(routesIdx[i]);
+    }
+    seatsLoaded = true;
+}
+
+void ensureRouteSeats(int routeID) {
+    if (seatsLoaded || seatInventory.count(routeID)) return;
+    if (!snapshot.isOpen()) {
+        vector<string> lines;
+        textIndexLookup(seatsText, 0, to_string(routeID), lines);
+        Seat s;
+        for (const string& line : lines) {
+            if (parseSeatLine(line, s) && s.routeID == routeID) storeSeatRecord(s);
+        }
+        return;
+    }
+    
+    const SnapRoute* routesIdx = snapshot.seatRoutes();
+    const SnapRoute* end = routesIdx + snapshot.header->seatRouteCount;
+    const SnapRoute* r = lower_bound(routesIdx, end, routeID,
+        [](const SnapRoute& a, int id) { return a.routeID < id; });
+    if (r == end || r->routeID != routeID) return;
+    loadRouteFromSnapshot(*r);
+}
+
+// Lookups by request string never intern it: an unknown ID is not a
+// symbol, so it cannot be in the table either.
+User* findUser(string_view userID) {
+    Sym id;
+    if (symbols.lookup(userID, id)) {
+        auto it = users.find(id);
+        if (it != users.end()) return &it->second;
+    }
+    if (usersLoaded) return nullptr;
+    User u;
+    if (snapshot.isOpen()) {
+        const SnapUser* r = snapshotLookup(snapshot.users(), snapshot.header->userCount, &SnapUser::userID, userID);
+        if (!r) return nullptr;
+        u = userFromSnapshot(*r);
+    } else if (!lastTextRecord(usersText, 0, userID, parseUserLine,
+                               [&](const User& found) { return sv(found.userID) == userID; }, u)) {
+        return nullptr;
+    }
+    return &users.emplace(u.userID, u).first->second;
+}
+
+Booking* findBooking(string_view bookingID) {
+    Sym id;
+    if (symbols.lookup(bookingID, id)) {
+        auto it = bookings.find(id);
+        if (it != bookings.end()) return &it->second;
+    }
+    if (bookingsLoaded) return nullptr;
+    Booking b;
+    if (snapshot.isOpen()) {
+        const SnapBooking* r = snapshotLookup(snapshot.bookings(), snapshot.header->bookingCount,
+                                              &SnapBooking::bookingID, bookingID);
+        if (!r) return nullptr;
+        b = bookingFromSnapshot(*r);
+    } else if (!lastTextRecord(bookingsText, BOOKINGS_BY_ID, bookingID, parseBookingLine,
+                               [&](const Booking& found) { return sv(found.bookingID) == bookingID; }, b)) {
+        return nullptr;
+    }
+    return &faultInBooking(move(b));
+}
+
+// Map nodes never move, so the pointer stays valid after the lock is gone
+RouteSeats* findRouteSeats(int routeID) {
+    {
+        shared_lock<shared_mutex> shared(inventoryMutex);
+        auto it = seatInventory.find(routeID);
+        if (it != seatInventory.end()) return &it->second;
+        if (seatsLoaded) return nullptr;
+    }
+    unique_lock<shared_mutex> exclusive(inventoryMutex);
+    ensureRouteSeats(routeID);
+    auto it = seatInventory.find(routeID);
+    return it == seatInventory.end() ? nullptr : &it->second;
+}
+
+// Resolves a seat ID to its route and index; false if no such seat.
+bool findSeat(string_view seatID, RouteSeats*& route, int& index) {
+    int routeID;
+    if (!parseSeatID(seatID, routeID, index)) return false;
+    route = findRouteSeats(routeID);
+    return route && route->exists(index);
+}
+
+// findSeat without reading the seat itself, which concurrent callers only
+// do under the route's lock.
+RouteSeats* findSeatRoute(string_view seatID, int& index) {
+    int routeID;
+    if (!parseSeatID(seatID, routeID, index)) return nullptr;
+    return findRouteSeats(routeID);
+}
+
+void ensureAllData() {
+    ensureAllUsers();
+    ensureAllBookings();
+    ensureAllSeats();
+    ensureTripSeats();
+}
+
+// Serializes the given tables into the snapshot layout described above.
+string buildSnapshot(const UserTable& u, const BookingTable& b, const SeatTable& s) {
+    // Symbols (statuses, route info, user IDs) are written to the pool once
+    string pool;
+    vector<SnapString> pooled(symbolsView->count(), SnapString{0, UINT32_MAX});
+    auto addString = [&](string_view str) {
+        SnapString ref = {(uint32_t)pool.size(), (uint32_t)str.size()};
+        pool.append(str.data(), str.size());
+        return ref;
+    };
+    auto addSym = [&](Sym sym) {
+        if (pooled[sym].length == UINT32_MAX) pooled[sym] = addString(sv(sym));
+        return pooled[sym];
+    };
+    SnapString statusRefs[3];
+    for (int st = 0; st < 3; st++) statusRefs[st] = addString(seatStatusName((SeatStatus)st));
+    
+    vector<SnapUser> userRecs;
+    userRecs.reserve(u.size());
+    for (const auto& pair : u) {
+        const User& x = pair.second;
+        userRecs.push_back({addSym(x.userID), addSym(x.name), addString(x.email),
+                            x.totalBookings, 0, x.totalSpent});
+    }
+    
+    vector<SnapBooking> bookingRecs;
+    vector<SnapString> bookingSeatRecs;
+    bookingRecs.reserve(b.size());
+    for (const auto& pair : b) {
+        const Booking& x = pair.second;
+        SnapBooking rec = {addSym(x.bookingID), addSym(x.routeInfo), addSym(x.userID),
+                           addString(x.timestamp), addSym(x.status), x.routeID,
+                           (uint32_t)bookingSeatRecs.size(), (uint32_t)x.seatIDs.size(), 0,
+                           x.totalPrice};
+        for (Sym id : x.seatIDs) bookingSeatRecs.push_back(addSym(id));
+        bookingRecs.push_back(rec);
+    }
+    
+    vector<SnapSeat> seatRecs;
+    vector<SnapRoute> routeRecs;
+    for (const auto& pair : s) {
+        const RouteSeats& r = pair.second;
+        SnapRoute route = {r.routeID, (uint32_t)seatRecs.size(), 0};
+        for (int i = 0; i < r.capacity(); i++) {
+            if (!r.exists(i)) continue;
+            seatRecs.push_back({addString(makeSeatID(r.routeID, i)), statusRefs[r.status(i)],
+                                addSym(r.userIDs[i]), addSym(r.bookingIDs[i]), r.routeID, r.holdExpiry(i)});
+            route.seatCount++;
+        }
+        if (route.seatCount > 0) routeRecs.push_back(route);
+    }
+    
+    SnapHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    h.version = SNAPSHOT_VERSION;
+    h.nextBookingID = nextBookingID;
+    h.userCount = userRecs.size();
+    h.bookingCount = bookingRecs.size();
+    h.bookingSeatCount = bookingSeatRecs.size();
+    h.seatCount = seatRecs.size();
+    h.seatRouteCount = routeRecs.size();
+    
+    string out(sizeof(SnapHeader), '\0');
+    auto appendSection = [&](const void* data, size_t bytes) {
+        while (out.size() % 8) out += '\0';
+        uint64_t offset = out.size();
+        out.append((const char*)data, bytes);
+        return offset;
+    };
+    h.usersOffset = appendSection(userRecs.data(), userRecs.size() * sizeof(SnapUser));
+    h.bookingsOffset = appendSection(bookingRecs.data(), bookingRecs.size() * sizeof(SnapBooking));
+    h.bookingSeatsOffset = appendSection(bookingSeatRecs.data(), bookingSeatRecs.size() * sizeof(SnapString));
+    h.seatsOffset = appendSection(seatRecs.data(), seatRecs.size() * sizeof(SnapSeat));
+    h.seatRoutesOffset = appendSection(routeRecs.data(), routeRecs.size() * sizeof(SnapRoute));
+    h.stringsOffset = appendSection(pool.data(), pool.size());
+    h.stringsSize = pool.size();
+    h.dataCRC = crc32(out.data() + sizeof(SnapHeader), out.size() - sizeof(SnapHeader));
+    h.headerCRC = snapshotHeaderCRC(h);
+    memcpy(&out[0], &h, sizeof(h));
+    return out;
+}
+
+bool saveBinarySnapshot(const UserTable& u, const BookingTable& b, const SeatTable& s) {
+    METRIC_PHASE(PHASE_SAVE_SNAPSHOT);
+    return writeFileAtomically(SNAPSHOT_FILE, buildSnapshot(u, b, s));
+}
+
+// ========================
+// Write-Ahead Journal
+// ========================
+// Each mutation appends the new state of every record it touched as
+// U|<user>, B|<booking> or S|<seat> lines (same layout as the snapshot
+// files), followed by a "C|" commit marker. Replay applies complete groups
+// only, so a torn write at the tail is dropped. Records are full upserts,
+// which makes replaying a journal over a snapshot that already contains
+// some of its effects harmless.
+//
+// Group commit: committed mutations are buffered and written + synced
+// together by flushJournal(). The daemon holds back responses to mutating
+// commands until the flush that makes them durable, and waits up to
+// groupCommitMs for more mutations before flushing.
+//
+// Compaction: once the journal grows past compactThresholdBytes it is
+// rotated to JOURNAL_COMPACTING_FILE and a copy of the tables is written
+// out as new snapshot files in the background; the rotated journal is
+// deleted after all three snapshot files are in place.
+const string JOURNAL_FILE = "backend/data_journal.txt";
+const string JOURNAL_COMPACTING_FILE = "backend/data_journal.compacting.txt";
+
+struct Journal {
+    int fd = -1;
+    string txn;                 // records of the mutation in progress
+    string pending;             // committed, not yet written + synced
+    chrono::steady_clock::time_point pendingSince;
+    size_t fileBytes = 0;       // size of the live journal file
+};
+
+Journal journal;
+long long journalValidBytes = -1; // committed prefix of the journal found at replay
+int groupCommitMs = 0;
+size_t compactThresholdBytes = 4 << 20;
+thread compactionThread;
+atomic<bool> compactionRunning(false);
+
+void journalUser(const User& u) {
+    journal.txn += "U|" + formatUserLine(u) + "\n";
+}
+
+void journalBooking(const Booking& b) {
+    journal.txn += "B|" + formatBookingLine(b) + "\n";
+}
+
+void journalSeat(const Seat& s) {
+    journal.txn += "S|" + formatSeatLine(s) + "\n";
+}
+
+void journalTripSeat(const TripSeat& s) {
+    journal.txn += "T|" + formatTripSeatLine(s) + "\n";
+}
+
+void commitMutation() {
+    if (journal.txn.empty()) return;
+    if (journal.pending.empty()) journal.pendingSince = chrono::steady_clock::now();
+    journal.pending += journal.txn;
+    journal.pending += "C|\n";
+    journal.txn.clear();
+}
+
+bool journalHasPending() {
+    return !journal.pending.empty();
+}
+
+// Before-images for all-or-nothing batches (--batch --atomic). While the
+// log is active, mutations save each user, booking and route inventory the
+// first time the batch touches it; rollbackUndo() puts them all back and
+// drops the batch's journal records, which are not flushed before the end.
+struct UndoLog {
+    bool active = false;
+    map<Sym, pair<bool, User>> users;       // existed before, prior state
+    map<Sym, pair<bool, Booking>> bookings;
+    map<int, pair<bool, RouteSeats>> routes;
+    map<TripDate, pair<bool, TripSeats>> trips;
+    int nextBookingID = 0;
+    size_t journalPending = 0;
+};
+
+UndoLog undoLog;
+
+void beginUndo() {
+    undoLog = UndoLog();
+    undoLog.active = true;
+    undoLog.nextBookingID = nextBookingID;
+    undoLog.journalPending = journal.pending.size();
+}
+
+void endUndo() {
+    undoLog = UndoLog();
+}
+
+void undoSaveUser(Sym userID) {
+    if (!undoLog.active || undoLog.users.count(userID)) return;
+    auto it = users.find(userID);
+    undoLog.users[userID] = it != users.end() ? make_pair(true, it->second) : make_pair(false, User());
+}
+
+void undoSaveBooking(Sym bookingID) {
+    if (!undoLog.active || undoLog.bookings.count(bookingID)) return;
+    auto it = bookings.find(bookingID);
+    undoLog.bookings[bookingID] = it != bookings.end() ? make_pair(true, it->second) : make_pair(false, Booking());
+}
+
+void undoSaveRoute(int routeID) {
+    if (!undoLog.active || undoLog.routes.count(routeID)) return;
+    auto it = seatInventory.find(routeID);
+    undoLog.routes[routeID] = it != seatInventory.end() ? make_pair(true, it->second) : make_pair(false, RouteSeats());
+}
+
+void undoSaveTrip(const TripDate& trip) {
+    if (!undoLog.active || undoLog.trips.count(trip)) return;
+    auto it = tripInventory.find(trip);
+    undoLog.trips[trip] = it != tripInventory.end() ? make_pair(true, it->second) : make_pair(false, TripSeats());
+}
+
+void rollbackUndo() {
+    for (auto& entry : undoLog.users) {
+        if (entry.second.first) users[entry.first] = move(entry.second.second);
+        else users.erase(entry.first);
+    }
+    for (auto& entry : undoLog.bookings) {
+        auto it = bookings.find(entry.first);
+        const Booking* current = it == bookings.end() ? nullptr : &it->second;
+        if (entry.second.first) {
+            reindexBooking(current, entry.second.second);
+            bookings[entry.first] = move(entry.second.second);
+        } else if (current) {
+            unindexBooking(*current);
+            bookings.erase(it);
+        }
+    }
+    for (auto& entry : undoLog.routes) {
+        if (entry.second.first) seatInventory[entry.first] = move(entry.second.second);
+        else seatInventory.erase(entry.first);
+    }
+    for (auto& entry : undoLog.trips) {
+        if (entry.second.first) tripInventory[entry.first] = move(entry.second.second);
+        else tripInventory.erase(entry.first);
+    }
+    nextBookingID = undoLog.nextBookingID;
+    journal.txn.clear();
+    journal.pending.resize(undoLog.journalPending);
+    endUndo();
+}
+
+// True while the oldest unflushed mutation is younger than the group
+// commit window, i.e. it is still worth waiting for company.
+bool journalWithinWindow() {
+    if (journal.pending.empty() || groupCommitMs <= 0) return false;
+    auto age = chrono::steady_clock::now() - journal.pendingSince;
+    return age < chrono::milliseconds(groupCommitMs);
+}
+
+int journalWindowRemainingMs() {
+    if (!journalWithinWindow()) return 0;
+    auto age = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - journal.pendingSince).count();
+    return max(1, groupCommitMs - (int)age);
+}
+
+void openJournal() {
+    if (journal.fd >= 0) return;
+    journal.fd = openForAppend(JOURNAL_FILE);
+    struct stat st;
+    journal.fileBytes = (stat(JOURNAL_FILE.c_str(), &st) == 0) ? st.st_size : 0;
+    
+    // Cut off an uncommitted tail left by a crash, otherwise the next
+    // commit marker would adopt those records
+    if (journal.fd >= 0 && journalValidBytes >= 0 && journal.fileBytes > (size_t)journalValidBytes) {
+#ifdef _WIN32
+        _chsize(journal.fd, (long)journalValidBytes);
+#else
+        if (ftruncate(journal.fd, journalValidBytes) != 0) return;
+#endif
+        journal.fileBytes = journalValidBytes;
+    }
+}
+
+bool flushJournal() {
+    if (journal.pending.empty()) return true;
+    METRIC_PHASE(PHASE_FLUSH_JOURNAL);
+    openJournal();
+    if (journal.fd < 0) return false;
+    if (!writeAll(journal.fd, journal.pending)) return false;
+    syncFile(journal.fd);
+    journal.fileBytes += journal.pending.size();
+    journal.pending.clear();
+    return true;
+}
+
+void applyJournalRecords(const vector<string>& group) {
+    User u;
+    Booking b;
+    Seat s;
+    TripSeat t;
+    for (const string& rec : group) {
+        string body = rec.substr(2);
+        if (rec[0] == 'U' && parseUserLine(body, u)) users[u.userID] = u;
+        else if (rec[0] == 'B' && parseBookingLine(body, b)) applyBooking(b);
+        else if (rec[0] == 'S' && parseSeatLine(body, s)) {
+            ensureRouteSeats(s.routeID);
+            storeSeatRecord(s);
+        } else if (rec[0] == 'T' && parseTripSeatLine(body, t)) {
+            ensureTripSeats();
+            storeTripSeat(t);
+        }
+    }
+}
+
+// Returns the number of bytes up to and including the last commit marker.
+long long replayJournalFile(const string& path) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return -1;
+    
+    string line;
+    vector<string> group;
+    long long offset = 0, committed = 0;
+    while (getline(file, line)) {
+        offset += line.size() + 1;
+        if (file.eof()) break; // no trailing newline: torn write
+        if (line.size() < 2 || line[1] != '|') continue;
+        if (line[0] == 'C') {
+            METRIC_COUNT(COUNT_JOURNAL_RECORDS, group.size());
+            applyJournalRecords(group);
+            group.clear();
+            committed = offset;
+        } else {
+            group.push_back(line);
+        }
+    }
+    // Anything left in group was never committed
+    METRIC_COUNT(COUNT_BYTES_READ, offset);
+    return committed;
+}
+
+void replayJournal() {
+    METRIC_PHASE(PHASE_REPLAY_JOURNAL);
+    replayJournalFile(JOURNAL_COMPACTING_FILE);
+    journalValidBytes = replayJournalFile(JOURNAL_FILE);
+}
+
+// Moves the live journal aside for compaction. If an earlier compaction
+// never finished, its leftovers are kept and the live journal is appended
+// to them instead of overwriting them.
+bool rotateJournal() {
+    if (!flushJournal()) return false;
+    if (journal.fd >= 0) {
+        closeFile(journal.fd);
+        journal.fd = -1;
+    }
+    
+    struct stat st;
+    if (stat(JOURNAL_COMPACTING_FILE.c_str(), &st) != 0) {
+        if (rename(JOURNAL_FILE.c_str(), JOURNAL_COMPACTING_FILE.c_str()) != 0) return false;
+    } else {
+        ifstream live(JOURNAL_FILE, ios::binary);
+        ostringstream contents;
+        contents << live.rdbuf();
+        live.close();
+        int fd = openForAppend(JOURNAL_COMPACTING_FILE);
+        if (fd < 0) return false;
+        bool ok = writeAll(fd, contents.str());
+        if (ok) syncFile(fd);
+        closeFile(fd);
+        if (!ok) return false;
+        remove(JOURNAL_FILE.c_str());
+    }
+    journalValidBytes = -1;
+    openJournal();
+    return true;
+}
+
+void writeSnapshot(const UserTable& u, const BookingTable& b, const SeatTable& s, const TripSeatTable& t) {
+    if (useBinarySnapshot) {
+        if (!saveBinarySnapshot(u, b, s)) return;
+    } else {
+        saveUsers(u);
+        saveBookings(b);
+        saveSeatState(s);
+    }
+    saveTripSeats(t);
+    remove(JOURNAL_COMPACTING_FILE.c_str());
+}
+
+void waitForCompaction() {
+    if (compactionThread.joinable()) compactionThread.join();
+}
+
+// background: run the snapshot write on a thread over copies of the tables
+// and symbols (daemon mode). Otherwise the caller is a one-shot process about to exit,
+// which forks the write where it can so the response is not delayed.
+void compactJournal(bool background) {
+    if (compactionRunning) return;
+    waitForCompaction();
+    if (!rotateJournal()) return;
+    
+    if (background) {
+        ensureAllData();
+        compactionRunning = true;
+        compactionThread = thread([u = users, b = bookings, s = seatInventory, t = tripInventory, syms = symbols]() {
+            symbolsView = &syms;
+            writeSnapshot(u, b, s, t);
+            compactionRunning = false;
+        });
+        return;
+    }
+#ifndef _WIN32
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Detach from the caller's pipes so it is not kept waiting
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        ensureAllData();
+        writeSnapshot(users, bookings, seatInventory, tripInventory);
+        _exit(0);
+    }
+    if (pid > 0) return;
+#endif
+    ensureAllData();
+    writeSnapshot(users, bookings, seatInventory, tripInventory);
+}
+
+void maybeCompactJournal(bool background) {
+    if (journal.fileBytes >= compactThresholdBytes) compactJournal(background);
+}
+
+// ========================
+// Utility Functions
+// ========================
+
+string bookingName(int number) {
+    return "BK" + to_string(number);
+}
+
+string generateBookingID() {
+    return bookingName(nextBookingID++);
+}
+
+// Gives back a number no booking used, unless a later one was taken since.
+void returnBookingNumber(int number) {
+    int next = number + 1;
+    nextBookingID.compare_exchange_strong(next, number);
+}
+
+string getCurrentTimestamp() {
+    time_t now = time(0);
+    char buf[80];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    return string(buf);
+}
+
+string toLowerCase(const string& str) {
+    string result = str;
+    transform(result.begin(), result.end(), result.begin(), ::tolower);
+    return result;
+}
+
+// Compiles allStoredRoutes into routeGraph. Each stop's edges stay in
+// routeID order, like the per-stop lists they replace.
+void buildRouteGraph() {
+    RouteGraph g;
+    auto stopOf = [&g](Sym key, Sym name) {
+        auto it = g.stopIndex.find(key);
+        if (it != g.stopIndex.end()) return it->second;
+        int stop = g.stopCount();
+        g.stopKeys.push_back(key);
+        g.stopNames.push_back(name);
+        g.stopIndex.emplace(key, stop);
+        return stop;
+    };
+    
+    vector<int> from, to;
+    from.reserve(allStoredRoutes.size());
+    to.reserve(allStoredRoutes.size());
+    for (const auto& pair : allStoredRoutes) {
+        from.push_back(stopOf(pair.second.fromKey, pair.second.from));
+        to.push_back(stopOf(pair.second.toKey, pair.second.to));
+    }
+    
+    int n = g.stopCount();
+    size_t m = from.size();
+    g.edgeStart.assign(n + 1, 0);
+    for (int s : from) g.edgeStart[s + 1]++;
+    for (int s = 0; s < n; s++) g.edgeStart[s + 1] += g.edgeStart[s];
+    
+    g.edgeFrom.resize(m);
+    g.edgeTo.resize(m);
+    g.edgeRoute.resize(m);
+    g.edgeDistance.resize(m);
+    g.edgePrice.resize(m);
+    vector<uint32_t> next(g.edgeStart.begin(), g.edgeStart.end() - 1);
+    size_t i = 0;
+    for (const auto& pair : allStoredRoutes) {
+        const Route& r = pair.second;
+        uint32_t e = next[from[i]]++;
+        g.edgeFrom[e] = from[i];
+        g.edgeTo[e] = to[i];
+        g.edgeRoute[e] = r.routeID;
+        // Non-negative whole hundredths, so path sums are exact and equal
+        // paths compare equal whatever order they were added up in
+        g.edgeDistance[e] = max(0.0, round(r.distance * 100));
+        g.edgePrice[e] = max(0.0, round(r.ticketPrice * 100));
+        i++;
+    }
+    
+    g.inStart.assign(n + 1, 0);
+    for (int t : to) g.inStart[t + 1]++;
+    for (int s = 0; s < n; s++) g.inStart[s + 1] += g.inStart[s];
+    g.inEdge.resize(m);
+    next.assign(g.inStart.begin(), g.inStart.end() - 1);
+    for (uint32_t e = 0; e < m; e++) g.inEdge[next[g.edgeTo[e]]++] = e;
+    // A route's coordinates run from its from stop to its to stop
+    g.stopCoords.assign(n, {NAN, NAN});
+    i = 0;
+    for (const auto& pair : allStoredRoutes) {
+        const vector<Coordinate>& coords = pair.second.coords;
+        if (!coords.empty()) {
+            if (std::isnan(g.stopCoords[from[i]].lat)) g.stopCoords[from[i]] = coords.front();
+            if (std::isnan(g.stopCoords[to[i]].lat)) g.stopCoords[to[i]] = coords.back();
+        }
+        i++;
+    }
+    routeGraph = move(g);
+    stopSearch = StopSearchIndex();
+    stopSpatial = StopSpatialIndex();
+}
+
+// Parses a routes.txt coords field, [{"lat":..,"lng":..},...]. Points
+// without both values, or outside the valid ranges, are skipped.
+vector<Coordinate> parseCoords(const string& field) {
+    vector<Coordinate> coords;
+    size_t pos = 0;
+    while ((pos = field.find('{', pos)) != string::npos) {
+        size_t end = field.find('}', pos);
+        if (end == string::npos) break;
+        auto number = [&](const char* key) {
+            size_t at = field.find(key, pos);
+            if (at == string::npos || at > end) return (double)NAN;
+            at = field.find(':', at);
+            if (at == string::npos || at > end) return (double)NAN;
+            char* stop = nullptr;
+            double value = strtod(field.c_str() + at + 1, &stop);
+            return stop == field.c_str() + at + 1 ? (double)NAN : value;
+        };
+        Coordinate c = {number("\"lat\""), number("\"lng\"")};
+        if (c.lat >= -90 && c.lat <= 90 && c.lng >= -180 && c.lng <= 180) coords.push_back(c);
+        pos = end + 1;
+    }
+    return coords;
+}
+
+// Load routes from routes.txt
+void loadRoutesFromFile() {
+    METRIC_PHASE(PHASE_LOAD_ROUTES);
+    allStoredRoutes.clear();
+    routeGraph = RouteGraph();
+    stopSearch = StopSearchIndex();
+    stopSpatial = StopSpatialIndex();
+    routesFileCRC = 0;
+    routesLoaded = true;
+    
+    struct stat st;
+    if (stat(ROUTES_FILE.c_str(), &st) == 0) {
+        routesFileMtime = st.st_mtime;
+        routesFileSize = st.st_size;
+    }
+    
+    ifstream raw(ROUTES_FILE, ios::binary);
+    if (!raw.is_open()) return;
+    string contents((istreambuf_iterator<char>(raw)), istreambuf_iterator<char>());
+    raw.close();
+    routesFileCRC = crc32(contents.data(), contents.size());
+    METRIC_COUNT(COUNT_BYTES_READ, contents.size());
+    
+    istringstream file(contents);
+    string line;
+    int routeID = 1;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        
+        size_t pos1 = line.find('|');
+        size_t pos2 = line.find('|', pos1 + 1);
+        size_t pos3 = line.find('|', pos2 + 1);
+        size_t pos4 = line.find('|', pos3 + 1);
+        
+        if (pos1 == string::npos || pos2 == string::npos || pos3 == string::npos) continue;
+        
+        string from = line.substr(0, pos1);
+        string to = line.substr(pos1 + 1, pos2 - pos1 - 1);
+        double distance = stod(line.substr(pos2 + 1, pos3 - pos2 - 1));
+        
+        double ticketPrice = 0;
+        string priceStr = line.substr(pos3 + 1, pos4 - pos3 - 1);
+        if (!priceStr.empty()) {
+            try {
+                ticketPrice = stod(priceStr);
+            } catch (...) {
+                ticketPrice = distance * 0.5;
+            }
+        } else {
+            ticketPrice = distance * 0.5;
+        }
+        
+        vector<Coordinate> coords;
+        if (pos4 != string::npos) coords = parseCoords(line.substr(pos4 + 1));
+        
+        Route route = {routeID, intern(from), intern(to), distance, ticketPrice, move(coords),
+                       intern(toLowerCase(from)), intern(toLowerCase(to))};
+        allStoredRoutes[routeID] = move(route);
+        METRIC_COUNT(COUNT_ROUTES_PARSED, 1);
+        
+        routeID++;
+    }
+    buildRouteGraph();
+}
+
+void ensureRoutes() {
+    if (!routesLoaded) loadRoutesFromFile();
+}
+
+// Reloads the route network if routes.txt changed since the last load.
+// Only matters for long-running processes; one-shot runs always load fresh.
+void refreshRoutesIfChanged() {
+    if (!routesLoaded) return;
+    struct stat st;
+    if (stat(ROUTES_FILE.c_str(), &st) != 0) return;
+    if (st.st_mtime != routesFileMtime || st.st_size != routesFileSize) {
+        loadRoutesFromFile();
+    }
+}
+
+// Path cost compared by weight first, then by number of legs.
+struct PathCost {
+    double weight;
+    int legs;
+
+    bool operator<(const PathCost& o) const {
+        return weight < o.weight || (weight == o.weight && legs < o.legs);
+    }
+    PathCost operator+(const PathCost& o) const {
+        return {weight + o.weight, legs + o.legs};
+    }
+};
+
+const PathCost UNREACHED = {INFINITY, INT32_MAX};
+
+// One direction of a bidirectional search: per-stop best cost and the
+// edge it was reached by, plus an indexed 4-ary min-heap with
+// decrease-key so each stop is queued at most once. Arrays are kept
+// between queries and only the stops touched are reset.
+struct SearchSide {
+    vector<PathCost> cost;
+    vector<int> parentEdge;
+    vector<int> touched;
+    vector<int> heap;
+    vector<int> pos; // stop -> index in heap, -1 if not queued
+
+    void reset(int stops) {
+        if ((int)cost.size() != stops) {
+            cost.assign(stops, UNREACHED);
+            parentEdge.assign(stops, -1);
+            pos.assign(stops, -1);
+            touched.clear();
+            heap.clear();
+        }
+        for (int v : touched) {
+            cost[v] = UNREACHED;
+            parentEdge[v] = -1;
+            pos[v] = -1;
+        }
+        touched.clear();
+        heap.clear();
+    }
+
+    bool empty() const { return heap.empty(); }
+    const PathCost& top() const { return cost[heap[0]]; }
+
+    void place(size_t i, int v) {
+        heap[i] = v;
+        pos[v] = (int)i;
+    }
+
+    void siftUp(size_t i) {
+        int v = heap[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / 4;
+            if (!(cost[v] < cost[heap[parent]])) break;
+            place(i, heap[parent]);
+            i = parent;
+        }
+        place(i, v);
+    }
+
+    void siftDown(size_t i) {
+        int v = heap[i];
+        size_t n = heap.size();
+        while (true) {
+            size_t first = i * 4 + 1;
+            if (first >= n) break;
+            size_t best = first;
+            size_t last = min(first + 4, n);
+            for (size_t k = first + 1; k < last; k++) {
+                if (cost[heap[k]] < cost[heap[best]]) best = k;
+            }
+            if (!(cost[heap[best]] < cost[v])) break;
+            place(i, heap[best]);
+            i = best;
+        }
+        place(i, v);
+    }
+
+    // Records a better cost for v and (re)queues it.
+    void improve(int v, PathCost c, int edge) {
+        if (cost[v].legs == INT32_MAX) touched.push_back(v);
+        cost[v] = c;
+        parentEdge[v] = edge;
+        if (pos[v] < 0) {
+            heap.push_back(v);
+            siftUp(heap.size() - 1);
+        } else {
+            siftUp(pos[v]);
+        }
+    }
+
+    int pop() {
+        int top = heap[0];
+        int last = heap.back();
+        heap.pop_back();
+        if (!heap.empty()) {
+            place(0, last);
+            siftDown(0);
+        }
+        pos[top] = -1;
+        return top;
+    }
+};
+
+enum RouteCriteria {
+    BY_DISTANCE,
+    BY_PRICE
+};
+
+// Route index: a contraction hierarchy over routeGraph, built offline
+// with --build-route-index and stored in ROUTE_INDEX_FILE next to
+// routes.txt. Stops are contracted one at a time, cheapest first by edge
+// difference, adding a shortcut arc wherever the contracted stop lay on
+// the only shortest path between two of its remaining neighbours. A query
+// is then a bidirectional search that only climbs to higher-ranked stops,
+// and shortcuts are unpacked back into routes afterwards. One hierarchy
+// is kept per criteria. The file records a CRC of routes.txt and is
+// ignored once routes.txt changes; findRoute falls back to the plain
+// search until the index is rebuilt.
+const string ROUTE_INDEX_FILE = "backend/routes.ch";
+const char ROUTE_INDEX_MAGIC[8] = {'B', 'R', 'F', 'R', 'I', 'D', 'X', '\0'};
+const uint32_t ROUTE_INDEX_VERSION = 1;
+const int WITNESS_SETTLE_LIMIT = 500;
+
+struct ChArc {
+    int32_t from;
+    int32_t to;
+    PathCost cost;
+    int32_t edge;    // routeGraph edge of an original arc, -1 for a shortcut
+    int32_t first;   // the two arcs a shortcut replaces, -1 otherwise
+    int32_t second;
+    int32_t padding;
+};
+
+static_assert(sizeof(ChArc) == 40, "route index arc layout");
+
+struct ChIndex {
+    vector<int32_t> rank;
+    vector<ChArc> arcs;
+    vector<uint32_t> upStart;    // arcs from a stop to higher-ranked stops
+    vector<uint32_t> up;
+    vector<uint32_t> downStart;  // arcs into a stop from higher-ranked stops
+    vector<uint32_t> down;
+};
+
+struct RouteIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t routesCRC;   // CRC32 of the routes.txt the index was built from
+    uint32_t stopCount;
+    uint32_t edgeCount;
+    uint32_t dataCRC;     // CRC32 of everything after the header
+    uint32_t reserved;
+};
+
+static_assert(sizeof(RouteIndexHeader) == 32, "route index header layout");
+
+struct RouteIndex {
+    bool checked = false; // ROUTE_INDEX_FILE looked at for routesCRC
+    bool valid = false;
+    uint32_t routesCRC = 0;
+    ChIndex byCriteria[2];
+};
+
+RouteIndex routeIndex;
+
+// Contracts every stop of g under the given edge weights.
+ChIndex buildContractionHierarchy(const RouteGraph& g, const vector<double>& weight) {
+    int n = g.stopCount();
+    ChIndex ch;
+    vector<vector<int>> out(n), in(n);
+    auto addArc = [&](const ChArc& a) {
+        int id = (int)ch.arcs.size();
+        ch.arcs.push_back(a);
+        out[a.from].push_back(id);
+        in[a.to].push_back(id);
+        return id;
+    };
+    
+    // Original arcs, keeping only the best of parallel routes
+    for (int u = 0; u < n; u++) {
+        for (uint32_t e = g.edgeStart[u]; e < g.edgeStart[u + 1]; e++) {
+            int v = g.edgeTo[e];
+            if (v == u) continue;
+            PathCost c = {weight[e], 1};
+            bool covered = false;
+            for (int id : out[u]) {
+                ChArc& a = ch.arcs[id];
+                if (a.to != v) continue;
+                if (c < a.cost) {
+                    a.cost = c;
+                    a.edge = (int)e;
+                }
+                covered = true;
+            }
+            if (!covered) addArc({u, v, c, (int)e, -1, -1, 0});
+        }
+    }
+    
+    vector<bool> contracted(n, false);
+    vector<int> contractedNeighbours(n, 0);
+    SearchSide witness;
+    witness.reset(n);
+    
+    // Searches from u without passing through v, up to limit.
+    auto witnessSearch = [&](int u, int v, PathCost limit) {
+        witness.reset(n);
+        witness.improve(u, {0, 0}, -1);
+        int settled = 0;
+        while (!witness.empty() && settled < WITNESS_SETTLE_LIMIT) {
+            if (limit < witness.top()) break;
+            int x = witness.pop();
+            settled++;
+            for (int id : out[x]) {
+                const ChArc& a = ch.arcs[id];
+                if (a.to == v || contracted[a.to]) continue;
+                PathCost c = witness.cost[x] + a.cost;
+                if (c < witness.cost[a.to]) witness.improve(a.to, c, id);
+            }
+        }
+    };
+    
+    // Number of shortcuts contracting v needs; adds them if add is set.
+    auto contract = [&](int v, bool add) {
+        int shortcuts = 0;
+        for (size_t i = 0; i < in[v].size(); i++) {
+            int inId = in[v][i];
+            ChArc inArc = ch.arcs[inId];
+            int u = inArc.from;
+            if (contracted[u]) continue;
+            
+            PathCost limit = {0, 0};
+            bool any = false;
+            for (int outId : out[v]) {
+                const ChArc& a = ch.arcs[outId];
+                if (contracted[a.to] || a.to == u) continue;
+                PathCost c = inArc.cost + a.cost;
+                if (limit < c) limit = c;
+                any = true;
+            }
+            if (!any) continue;
+            witnessSearch(u, v, limit);
+            
+            for (size_t j = 0; j < out[v].size(); j++) {
+                int outId = out[v][j];
+                ChArc outArc = ch.arcs[outId];
+                int w = outArc.to;
+                if (contracted[w] || w == u) continue;
+                PathCost c = inArc.cost + outArc.cost;
+                if (!(c < witness.cost[w])) continue; // a path avoiding v is as good
+                shortcuts++;
+                if (add) addArc({u, w, c, -1, inId, outId, 0});
+            }
+        }
+        return shortcuts;
+    };
+    
+    // Edge difference, plus terms that spread contraction evenly
+    vector<int> depth(n, 0);
+    auto priority = [&](int v) {
+        int degree = (int)(in[v].size() + out[v].size());
+        return 2 * (contract(v, false) - degree) + contractedNeighbours[v] + depth[v];
+    };
+    
+    // Lazy updates: a popped stop whose priority got worse goes back in
+    priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> order;
+    for (int v = 0; v < n; v++) order.push({priority(v), v});
+    ch.rank.assign(n, 0);
+    int nextRank = 0;
+    while (!order.empty()) {
+        int v = order.top().second;
+        order.pop();
+        if (contracted[v]) continue;
+        int p = priority(v);
+        if (!order.empty() && p > order.top().first) {
+            order.push({p, v});
+            continue;
+        }
+        contract(v, true);
+        contracted[v] = true;
+        ch.rank[v] = nextRank++;
+        
+        // Drop arcs to v from the neighbours' working lists
+        auto prune = [&](vector<int>& arcs, bool byTarget) {
+            arcs.erase(remove_if(arcs.begin(), arcs.end(), [&](int id) {
+                return contracted[byTarget ? ch.arcs[id].to : ch.arcs[id].from];
+            }), arcs.end());
+        };
+        for (int id : in[v]) {
+            int u = ch.arcs[id].from;
+            contractedNeighbours[u]++;
+            depth[u] = max(depth[u], depth[v] + 1);
+            prune(out[u], true);
+        }
+        for (int id : out[v]) {
+            int w = ch.arcs[id].to;
+            contractedNeighbours[w]++;
+            depth[w] = max(depth[w], depth[v] + 1);
+            prune(in[w], false);
+        }
+    }
+    
+    // Upward arcs are searched from their lower end in both directions
+    ch.upStart.assign(n + 1, 0);
+    ch.downStart.assign(n + 1, 0);
+    for (const ChArc& a : ch.arcs) {
+        if (ch.rank[a.to] > ch.rank[a.from]) ch.upStart[a.from + 1]++;
+        else ch.downStart[a.to + 1]++;
+    }
+    for (int v = 0; v < n; v++) {
+        ch.upStart[v + 1] += ch.upStart[v];
+        ch.downStart[v + 1] += ch.downStart[v];
+    }
+    ch.up.resize(ch.upStart[n]);
+    ch.down.resize(ch.downStart[n]);
+    vector<uint32_t> upNext(ch.upStart.begin(), ch.upStart.end() - 1);
+    vector<uint32_t> downNext(ch.downStart.begin(), ch.downStart.end() - 1);
+    for (uint32_t id = 0; id < ch.arcs.size(); id++) {
+        const ChArc& a = ch.arcs[id];
+        if (ch.rank[a.to] > ch.rank[a.from]) ch.up[upNext[a.from]++] = id;
+        else ch.down[downNext[a.to]++] = id;
+    }
+    return ch;
+}
+
+template <typename T>
+void appendVector(string& out, const vector<T>& v) {
+    uint64_t count = v.size();
+    out.append((const char*)&count, sizeof(count));
+    out.append((const char*)v.data(), v.size() * sizeof(T));
+}
+
+template <typename T>
+bool readVector(const string& in, size_t& pos, vector<T>& v) {
+    uint64_t count;
+    if (in.size() - pos < sizeof(count)) return false;
+    memcpy(&count, in.data() + pos, sizeof(count));
+    pos += sizeof(count);
+    if (count > (in.size() - pos) / sizeof(T)) return false;
+    v.resize(count);
+    memcpy(v.data(), in.data() + pos, count * sizeof(T));
+    pos += count * sizeof(T);
+    return true;
+}
+
+bool saveRouteIndex(const ChIndex (&byCriteria)[2]) {
+    RouteIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ROUTE_INDEX_MAGIC, sizeof(ROUTE_INDEX_MAGIC));
+    h.version = ROUTE_INDEX_VERSION;
+    h.routesCRC = routesFileCRC;
+    h.stopCount = routeGraph.stopCount();
+    h.edgeCount = routeGraph.edgeTo.size();
+    
+    string out(sizeof(h), '\0');
+    for (const ChIndex& ch : byCriteria) {
+        appendVector(out, ch.rank);
+        appendVector(out, ch.arcs);
+        appendVector(out, ch.upStart);
+        appendVector(out, ch.up);
+        appendVector(out, ch.downStart);
+        appendVector(out, ch.down);
+    }
+    h.dataCRC = crc32(out.data() + sizeof(h), out.size() - sizeof(h));
+    memcpy(&out[0], &h, sizeof(h));
+    return writeFileAtomically(ROUTE_INDEX_FILE, out);
+}
+
+// Loads ROUTE_INDEX_FILE once per routes.txt version; the index is used
+// only if it was built from the same routes.txt.
+bool ensureRouteIndex() {
+    if (routeIndex.checked && routeIndex.routesCRC == routesFileCRC) return routeIndex.valid;
+    routeIndex = RouteIndex();
+    routeIndex.checked = true;
+    routeIndex.routesCRC = routesFileCRC;
+    
+    ifstream file(ROUTE_INDEX_FILE, ios::binary | ios::ate);
+    if (!file.is_open()) return false;
+    string in((size_t)file.tellg(), '\0');
+    file.seekg(0);
+    if (!file.read(&in[0], in.size()) || in.size() < sizeof(RouteIndexHeader)) return false;
+    RouteIndexHeader h;
+    memcpy(&h, in.data(), sizeof(h));
+    if (memcmp(h.magic, ROUTE_INDEX_MAGIC, sizeof(ROUTE_INDEX_MAGIC)) != 0 ||
+        h.version != ROUTE_INDEX_VERSION || h.routesCRC != routesFileCRC ||
+        h.stopCount != (uint32_t)routeGraph.stopCount() || h.edgeCount != routeGraph.edgeTo.size() ||
+        h.dataCRC != crc32(in.data() + sizeof(h), in.size() - sizeof(h))) {
+        return false;
+    }
+    
+    size_t pos = sizeof(h);
+    for (ChIndex& ch : routeIndex.byCriteria) {
+        if (!readVector(in, pos, ch.rank) || !readVector(in, pos, ch.arcs) ||
+            !readVector(in, pos, ch.upStart) || !readVector(in, pos, ch.up) ||
+            !readVector(in, pos, ch.downStart) || !readVector(in, pos, ch.down)) {
+            routeIndex.byCriteria[0] = routeIndex.byCriteria[1] = ChIndex();
+            return false;
+        }
+    }
+    routeIndex.valid = true;
+    return true;
+}
+
+// Appends the routes an index arc stands for, expanding shortcuts.
+void unpackArc(const ChIndex& ch, int arc, vector<int>& path) {
+    vector<int> stack = {arc};
+    while (!stack.empty()) {
+        const ChArc& a = ch.arcs[stack.back()];
+        stack.pop_back();
+        if (a.edge >= 0) {
+            path.push_back(routeGraph.edgeRoute[a.edge]);
+        } else {
+            stack.push_back(a.second);
+            stack.push_back(a.first);
+        }
+    }
+}
+
+// Bidirectional upward search over a contraction hierarchy. Each side
+// stops once its next stop cannot improve on the best meeting found. A
+// stop that a higher-ranked stop already reaches more cheaply is not
+// expanded (stall-on-demand): its upward arcs cannot be on a shortest path.
+vector<int> indexPath(const ChIndex& ch, int start, int target) {
+    static SearchSide fwd, bwd;
+    int n = (int)ch.rank.size();
+    fwd.reset(n);
+    bwd.reset(n);
+    fwd.improve(start, {0, 0}, -1);
+    bwd.improve(target, {0, 0}, -1);
+    
+    PathCost best = UNREACHED;
+    int meet = -1;
+    while (true) {
+        bool forwardOpen = !fwd.empty() && fwd.top() < best;
+        bool backwardOpen = !bwd.empty() && bwd.top() < best;
+        if (!forwardOpen && !backwardOpen) break;
+        bool forward = forwardOpen && (!backwardOpen || fwd.heap.size() <= bwd.heap.size());
+        SearchSide& side = forward ? fwd : bwd;
+        SearchSide& other = forward ? bwd : fwd;
+        
+        int u = side.pop();
+        if (other.cost[u].legs != INT32_MAX && side.cost[u] + other.cost[u] < best) {
+            best = side.cost[u] + other.cost[u];
+            meet = u;
+        }
+        const vector<uint32_t>& stallFirst = forward ? ch.downStart : ch.upStart;
+        const vector<uint32_t>& stallArcs = forward ? ch.down : ch.up;
+        bool stalled = false;
+        for (uint32_t k = stallFirst[u]; k < stallFirst[u + 1] && !stalled; k++) {
+            const ChArc& a = ch.arcs[stallArcs[k]];
+            int w = forward ? a.from : a.to;
+            stalled = side.cost[w] + a.cost < side.cost[u];
+        }
+        if (stalled) continue;
+        
+        const vector<uint32_t>& first = forward ? ch.upStart : ch.downStart;
+        const vector<uint32_t>& arcs = forward ? ch.up : ch.down;
+        for (uint32_t k = first[u]; k < first[u + 1]; k++) {
+            const ChArc& a = ch.arcs[arcs[k]];
+            int v = forward ? a.to : a.from;
+            PathCost c = side.cost[u] + a.cost;
+            if (c < side.cost[v]) side.improve(v, c, (int)arcs[k]);
+        }
+    }
+    
+    if (meet < 0) return {};
+    vector<int> upArcs, path;
+    for (int v = meet; v != start; v = ch.arcs[fwd.parentEdge[v]].from) upArcs.push_back(fwd.parentEdge[v]);
+    for (auto it = upArcs.rbegin(); it != upArcs.rend(); ++it) unpackArc(ch, *it, path);
+    for (int v = meet; v != target; v = ch.arcs[bwd.parentEdge[v]].to) unpackArc(ch, bwd.parentEdge[v], path);
+    return path;
+}
+
+// Maps stop names to graph stops; false if either is unknown or both are
+// the same stop.
+bool resolveStops(const string& startStop, const string& endStop, int& start, int& target) {
+    string startName = toLowerCase(startStop);
+    string endName = toLowerCase(endStop);
+    
+    if (startName == endName) return false;
+    // Stops not in routes.txt were never interned
+    Sym startKey, endKey;
+    if (!symbols.lookup(startName, startKey) || !symbols.lookup(endName, endKey)) return false;
+    
+    auto startIt = routeGraph.stopIndex.find(startKey);
+    auto endIt = routeGraph.stopIndex.find(endKey);
+    if (startIt == routeGraph.stopIndex.end() || endIt == routeGraph.stopIndex.end()) return false;
+    start = startIt->second;
+    target = endIt->second;
+    return true;
+}
+
+// Shortest path by the chosen weight, ties broken by fewer legs. Uses the
+// route index when it is current, otherwise a bidirectional Dijkstra (forward over outgoing edges from the start,
+// backward over incoming edges from the destination). Returns the route
+// IDs along the path; empty if none.
+vector<int> findRoutePath(const string& startStop, const string& endStop,
+                          RouteCriteria criteria = BY_DISTANCE) {
+    int start, target;
+    if (!resolveStops(startStop, endStop, start, target)) return {};
+    if (ensureRouteIndex()) return indexPath(routeIndex.byCriteria[criteria], start, target);
+    
+    const RouteGraph& g = routeGraph;
+    const vector<double>& weight = (criteria == BY_PRICE) ? g.edgePrice : g.edgeDistance;
+    
+    static SearchSide fwd, bwd;
+    fwd.reset(g.stopCount());
+    bwd.reset(g.stopCount());
+    fwd.improve(start, {0, 0}, -1);
+    bwd.improve(target, {0, 0}, -1);
+    
+    PathCost best = UNREACHED;
+    int meetEdge = -1;
+    while (!fwd.empty() && !bwd.empty()) {
+        // No path through unsettled stops can beat best any more
+        if (!(fwd.top() + bwd.top() < best)) break;
+        
+        bool forward = fwd.heap.size() <= bwd.heap.size();
+        SearchSide& side = forward ? fwd : bwd;
+        SearchSide& other = forward ? bwd : fwd;
+        int u = side.pop();
+        uint32_t first = forward ? g.edgeStart[u] : g.inStart[u];
+        uint32_t last = forward ? g.edgeStart[u + 1] : g.inStart[u + 1];
+        
+        for (uint32_t k = first; k < last; k++) {
+            int e = forward ? (int)k : (int)g.inEdge[k];
+            int v = forward ? g.edgeTo[e] : g.edgeFrom[e];
+            PathCost c = side.cost[u] + PathCost{weight[e], 1};
+            if (c < side.cost[v]) side.improve(v, c, e);
+            if (other.cost[v].legs != INT32_MAX && c + other.cost[v] < best) {
+                best = c + other.cost[v];
+                meetEdge = e;
+            }
+        }
+    }
+    
+    if (meetEdge < 0) return {};
+    // Walk back to the start from the meeting edge's tail, then forward
+    // to the destination from its head
+    vector<int> path;
+    for (int v = g.edgeFrom[meetEdge]; v != start; v = g.edgeFrom[fwd.parentEdge[v]]) {
+        path.push_back(g.edgeRoute[fwd.parentEdge[v]]);
+    }
+    reverse(path.begin(), path.end());
+    path.push_back(g.edgeRoute[meetEdge]);
+    for (int v = g.edgeTo[meetEdge]; v != target; v = g.edgeTo[bwd.parentEdge[v]]) {
+        path.push_back(g.edgeRoute[bwd.parentEdge[v]]);
+    }
+    return path;
+}
+
+// Label of the multi-criteria search: one way of reaching stop after
+// round legs. Labels live in one flat pool; each stop's current Pareto
+// bag is a linked list through nextAtStop.
+struct ParetoLabel {
+    double fare;
+    double distance;
+    int stop;
+    int legs;
+    int parent;      // label this one extends, -1 at the start
+    int edge;        // edge taken from the parent's stop
+    int nextAtStop;  // next label in the same stop's bag, -1 at the end
+    bool dominated;  // dropped from its bag after being queued
+};
+
+const int PARETO_DEFAULT_LEGS = 6;
+const int PARETO_MAX_LEGS = 12;
+const size_t PARETO_MAX_LABELS = 1 << 20;
+
+// Pareto-optimal journeys over (total fare, total distance, legs), found
+// in RAPTOR-style rounds: round k extends the labels improved in round
+// k-1 by one route, so the rounds bound the number of legs. A label is
+// kept only if no label at its stop with fewer or equal legs is at least
+// as good on both fare and distance, and none at the destination is.
+// Returns route ID lists ordered by legs, then fare. If the label pool
+// fills up the search stops there and sets truncated: the journeys found
+// so far may then be missing some, or be beaten by ones not found.
+vector<vector<int>> findRoutesPareto(const string& startStop, const string& endStop, int maxLegs,
+                                     bool* truncated = nullptr) {
+    if (truncated) *truncated = false;
+    int start, target;
+    if (!resolveStops(startStop, endStop, start, target)) return {};
+    
+    const RouteGraph& g = routeGraph;
+    maxLegs = max(1, min(maxLegs, PARETO_MAX_LEGS));
+    
+    static vector<ParetoLabel> labels;
+    static vector<int> bagHead;      // stop -> first label, -1 if none
+    static vector<int> touched;
+    static vector<int> frontier, next;
+    if (labels.capacity() < PARETO_MAX_LABELS) labels.reserve(PARETO_MAX_LABELS);
+    if ((int)bagHead.size() != g.stopCount()) {
+        bagHead.assign(g.stopCount(), -1);
+        touched.clear();
+    }
+    for (int v : touched) bagHead[v] = -1;
+    touched.clear();
+    labels.clear();
+    frontier.clear();
+    
+    // True if some label in stop's bag is at least as good on both
+    auto coveredAt = [&](int stop, double fare, double distance) {
+        for (int l = bagHead[stop]; l >= 0; l = labels[l].nextAtStop) {
+            if (labels[l].fare <= fare && labels[l].distance <= distance) return true;
+        }
+        return false;
+    };
+    
+    labels.push_back({0, 0, start, 0, -1, -1, -1, false});
+    bagHead[start] = 0;
+    touched.push_back(start);
+    frontier.push_back(0);
+    
+    bool full = false;
+    for (int round = 1; round <= maxLegs && !frontier.empty() && !full; round++) {
+        next.clear();
+        for (int from : frontier) {
+            if (full) break;
+            if (labels[from].dominated) continue;
+            int u = labels[from].stop;
+            for (uint32_t e = g.edgeStart[u]; e < g.edgeStart[u + 1]; e++) {
+                int v = g.edgeTo[e];
+                if (v == start) continue;
+                double fare = labels[from].fare + g.edgePrice[e];
+                double distance = labels[from].distance + g.edgeDistance[e];
+                if (coveredAt(target, fare, distance) || coveredAt(v, fare, distance)) continue;
+                if (labels.size() >= PARETO_MAX_LABELS) {
+                    full = true;
+                    break;
+                }
+                
+                // Drop labels of this round that the new one beats; labels
+                // from earlier rounds have fewer legs and stay
+                int prev = -1;
+                for (int l = bagHead[v]; l >= 0; l = labels[l].nextAtStop) {
+                    ParetoLabel& old = labels[l];
+                    if (old.legs == round && old.fare >= fare && old.distance >= distance) {
+                        old.dominated = true;
+                        if (prev < 0) bagHead[v] = old.nextAtStop;
+                        else labels[prev].nextAtStop = old.nextAtStop;
+                    } else {
+                        prev = l;
+                    }
+                }
+                
+                int id = (int)labels.size();
+                if (bagHead[v] < 0) touched.push_back(v);
+                labels.push_back({fare, distance, v, round, from, (int)e, bagHead[v], false});
+                bagHead[v] = id;
+                if (v != target) next.push_back(id);
+            }
+        }
+        swap(frontier, next);
+    }
+    if (truncated) *truncated = full;
+    
+    vector<int> found;
+    for (int l = bagHead[target]; l >= 0; l = labels[l].nextAtStop) found.push_back(l);
+    sort(found.begin(), found.end(), [](int a, int b) {
+        if (labels[a].legs != labels[b].legs) return labels[a].legs < labels[b].legs;
+        return labels[a].fare < labels[b].fare;
+    });
+    
+    vector<vector<int>> paths;
+    for (int l : found) {
+        vector<int> path;
+        for (int at = l; labels[at].parent >= 0; at = labels[at].parent) {
+            path.push_back(g.edgeRoute[labels[at].edge]);
+        }
+        reverse(path.begin(), path.end());
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+// Appends JSON text to a reusable buffer: strings escaped, numbers written
+// with to_chars. With a sink, the buffer is handed to it in chunks as it
+// fills, so large listings stream out without being built up whole;
+// without one, the finished text is taken with str().
+class JsonWriter {
+public:
+    explicit JsonWriter(ostream* sink = nullptr) : sink(sink) {
+        buf.reserve(sink ? CHUNK + 1024 : 256);
+    }
+    ~JsonWriter() { flush(); }
+    
+    JsonWriter& raw(string_view text) {
+        buf.append(text);
+        if (buf.size() >= CHUNK) flush();
+        return *this;
+    }
+    
+    JsonWriter& str(string_view text) {
+        buf += '"';
+        size_t run = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            unsigned char c = text[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            buf.append(text.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+                case '"': buf += "\\\""; break;
+                case '\\': buf += "\\\\"; break;
+                case '\n': buf += "\\n"; break;
+                case '\r': buf += "\\r"; break;
+                case '\t': buf += "\\t"; break;
+                default: {
+                    static const char hex[] = "0123456789abcdef";
+                    char esc[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                    buf.append(esc, sizeof(esc));
+                }
+            }
+        }
+        buf.append(text.data() + run, text.size() - run);
+        buf += '"';
+        if (buf.size() >= CHUNK) flush();
+        return *this;
+    }
+    
+    JsonWriter& num(long long value) {
+        char digits[24];
+        auto end = to_chars(digits, digits + sizeof(digits), value).ptr;
+        buf.append(digits, end - digits);
+        return *this;
+    }
+    
+    // Fixed-point with the given number of decimals, like fixed << setprecision
+    JsonWriter& num(double value, int decimals) {
+        char digits[64];
+        auto result = to_chars(digits, digits + sizeof(digits), value, chars_format::fixed, decimals);
+        if (result.ec != errc()) return raw("0");
+        buf.append(digits, result.ptr - digits);
+        return *this;
+    }
+    
+    JsonWriter& boolean(bool value) {
+        return raw(value ? "true" : "false");
+    }
+    
+    void flush() {
+        if (!sink || buf.empty()) return;
+        sink->write(buf.data(), buf.size());
+        buf.clear();
+    }
+    
+    string& str() { return buf; }
+    
+private:
+    static const size_t CHUNK = 1 << 16;
+    ostream* sink;
+    string buf;
+};
+
+// {"error":"<message>"} with the message escaped.
+string errorJSON(string_view message) {
+    JsonWriter w;
+    w.raw("{\"error\":").str(message).raw("}");
+    return move(w.str());
+}
+
+// ========================
+// Route Cache
+// ========================
+// Finished findRoute responses in LRU order, keyed by the lowercased
+// from/to pair and criteria. Entries belong to the routes.txt contents
+// they were computed from (routesFileCRC) and are all dropped once that
+// changes. The cache is saved to ROUTE_CACHE_FILE when the process exits,
+// so it survives daemon restarts and carries over between one-shot runs.
+// Counters cover the current process only.
+const string ROUTE_CACHE_FILE = "backend/route_cache.txt";
+
+struct RouteCache {
+    size_t capacity = 1024; // 0 disables the cache
+    uint32_t routesCRC = 0;
+    list<pair<string, string>> entries; // key -> response, most recent first
+    unordered_map<string, list<pair<string, string>>::iterator> index;
+    long long hits = 0;
+    long long misses = 0;
+    long long evictions = 0;
+    long long invalidations = 0;
+    bool loaded = false;
+    bool dirty = false; // entries changed since load
+};
+
+RouteCache routeCache;
+
+string routeCacheKey(const string& from, const string& to, RouteCriteria criteria) {
+    return toLowerCase(from) + "|" + toLowerCase(to) + "|" + (criteria == BY_PRICE ? "ticketPrice" : "distance");
+}
+
+void clearRouteCache() {
+    routeCache.entries.clear();
+    routeCache.index.clear();
+}
+
+void routeCacheInsert(const string& key, const string& response) {
+    routeCache.entries.emplace_front(key, response);
+    routeCache.index[key] = routeCache.entries.begin();
+    while (routeCache.entries.size() > routeCache.capacity) {
+        routeCache.index.erase(routeCache.entries.back().first);
+        routeCache.entries.pop_back();
+        routeCache.evictions++;
+    }
+}
+
+// Reads ROUTE_CACHE_FILE on first use; a file from other routes is ignored.
+// The header is checked against routes.txt, so that is loaded first.
+void loadRouteCache() {
+    if (routeCache.loaded) return;
+    ensureRoutes();
+    routeCache.loaded = true;
+    routeCache.routesCRC = routesFileCRC;
+    
+    ifstream file(ROUTE_CACHE_FILE);
+    if (!file.is_open()) return;
+    string line;
+    if (!getline(file, line)) return;
+    if (line != "ROUTECACHE|1|" + to_string(routesFileCRC)) {
+        routeCache.invalidations++;
+        routeCache.dirty = true;
+        return;
+    }
+    vector<pair<string, string>> saved;
+    while (getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (tab == string::npos) continue;
+        saved.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+    }
+    // Saved most recent first; insert oldest first to keep that order
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (!routeCache.index.count(it->first)) routeCacheInsert(it->first, it->second);
+    }
+}
+
+void saveRouteCache() {
+    if (!routeCache.dirty) return;
+    string out = "ROUTECACHE|1|" + to_string(routeCache.routesCRC) + "\n";
+    for (const auto& entry : routeCache.entries) {
+        out += entry.first;
+        out += '\t';
+        out += entry.second;
+        out += '\n';
+    }
+    if (writeFileAtomically(ROUTE_CACHE_FILE, out)) routeCache.dirty = false;
+}
+
+// Cached response for key, or nullptr. Drops everything first if
+// routes.txt changed since the entries were computed.
+const string* routeCacheGet(const string& key) {
+    if (routeCache.capacity == 0) return nullptr;
+    loadRouteCache();
+    if (routeCache.routesCRC != routesFileCRC) {
+        if (!routeCache.entries.empty()) routeCache.invalidations++;
+        clearRouteCache();
+        routeCache.routesCRC = routesFileCRC;
+        routeCache.dirty = true;
+    }
+    auto it = routeCache.index.find(key);
+    if (it == routeCache.index.end()) {
+        routeCache.misses++;
+        return nullptr;
+    }
+    routeCache.hits++;
+    routeCache.entries.splice(routeCache.entries.begin(), routeCache.entries, it->second);
+    return &it->second->second;
+}
+
+void routeCachePut(const string& key, const string& response) {
+    if (routeCache.capacity == 0) return;
+    // Keys and responses are stored one per line
+    if (key.find_first_of("\t\n") != string::npos || response.find('\n') != string::npos) return;
+    routeCacheInsert(key, response);
+    routeCache.dirty = true;
+}
+
+string routeCacheStatsToJSON() {
+    if (routeCache.capacity > 0) loadRouteCache();
+    long long lookups = routeCache.hits + routeCache.misses;
+    JsonWriter w;
+    w.raw("{\"entries\":").num((long long)routeCache.entries.size())
+     .raw(",\"capacity\":").num((long long)routeCache.capacity)
+     .raw(",\"hits\":").num(routeCache.hits)
+     .raw(",\"misses\":").num(routeCache.misses)
+     .raw(",\"evictions\":").num(routeCache.evictions)
+     .raw(",\"invalidations\":").num(routeCache.invalidations)
+     .raw(",\"hitRate\":").num(lookups > 0 ? (double)routeCache.hits / lookups : 0.0, 3)
+     .raw("}");
+    return move(w.str());
+}
+
+// ========================
+// Stop Search
+// ========================
+const uint32_t SUGGEST_NODE_TOP = 10;  // stops kept per radix node
+const int SUGGEST_DEFAULT_LIMIT = 10;
+const int SUGGEST_MAX_LIMIT = 50;
+
+bool isWordByte(unsigned char c) {
+    return isalnum(c) || c >= 0x80; // UTF-8 bytes count as letters
+}
+
+// Distinct trigrams of " word word ... " over the word runs of name, sorted.
+// A query leaves its end open, as its last word may be incomplete.
+void nameTrigrams(string_view name, vector<uint32_t>& grams, bool padEnd = true) {
+    string padded = " ";
+    for (size_t i = 0; i < name.size(); i++) {
+        if (isWordByte(name[i])) padded += (char)tolower((unsigned char)name[i]);
+        else if (padded.back() != ' ') padded += ' ';
+    }
+    if (padEnd && padded.back() != ' ') padded += ' ';
+    grams.clear();
+    for (size_t i = 0; i + 2 < padded.size(); i++) {
+        grams.push_back((uint32_t)(unsigned char)padded[i] << 16 |
+                        (uint32_t)(unsigned char)padded[i + 1] << 8 |
+                        (uint32_t)(unsigned char)padded[i + 2]);
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+}
+
+string_view stopSuffix(const StopSearchIndex& ix, const StopSearchIndex::Entry& e) {
+    return string_view(ix.text).substr(e.pos, ix.nameEnd[e.stop] - e.pos);
+}
+
+// Fills node with the sorted entries lo..hi-1, which share their first
+// depth characters, and builds its subtree.
+void buildStopNode(StopSearchIndex& ix, uint32_t node, uint32_t lo, uint32_t hi, uint32_t depth) {
+    string_view first = stopSuffix(ix, ix.entries[lo]);
+    string_view last = stopSuffix(ix, ix.entries[hi - 1]);
+    uint32_t d = depth;
+    while (d < first.size() && d < last.size() && first[d] == last[d]) d++;
+    
+    uint32_t i = lo;
+    while (i < hi && stopSuffix(ix, ix.entries[i]).size() == d) i++; // names ending here
+    vector<pair<uint32_t, uint32_t>> groups;
+    for (uint32_t j = i; j < hi;) {
+        char c = stopSuffix(ix, ix.entries[j])[d];
+        uint32_t k = j + 1;
+        while (k < hi && stopSuffix(ix, ix.entries[k])[d] == c) k++;
+        groups.emplace_back(j, k);
+        j = k;
+    }
+    
+    uint32_t firstChild = (uint32_t)ix.nodes.size();
+    ix.nodes.resize(ix.nodes.size() + groups.size());
+    StopSearchIndex::Node& n = ix.nodes[node];
+    n.lo = lo;
+    n.hi = hi;
+    n.labelPos = ix.entries[lo].pos + depth;
+    n.labelLen = d - depth;
+    n.firstChild = firstChild;
+    n.childCount = (uint32_t)groups.size();
+    for (size_t g = 0; g < groups.size(); g++) {
+        buildStopNode(ix, firstChild + (uint32_t)g, groups[g].first, groups[g].second, d);
+    }
+    
+    // Best entry per stop among the names ending here and the children's lists
+    vector<uint32_t> candidates;
+    for (uint32_t e = lo; e < i; e++) candidates.push_back(e);
+    for (size_t g = 0; g < groups.size(); g++) {
+        const StopSearchIndex::Node& child = ix.nodes[firstChild + g];
+        candidates.insert(candidates.end(), ix.top.begin() + child.topStart,
+                          ix.top.begin() + child.topStart + child.topCount);
+    }
+    auto byScore = [&ix](uint32_t a, uint32_t b) { return ix.entries[a].score < ix.entries[b].score; };
+    sort(candidates.begin(), candidates.end(), byScore);
+    uint32_t topStart = (uint32_t)ix.top.size();
+    for (uint32_t e : candidates) {
+        if (ix.top.size() - topStart == SUGGEST_NODE_TOP) break;
+        bool seen = false;
+        for (size_t t = topStart; t < ix.top.size(); t++) {
+            if (ix.entries[ix.top[t]].stop == ix.entries[e].stop) seen = true;
+        }
+        if (!seen) ix.top.push_back(e);
+    }
+    ix.nodes[node].topStart = topStart;
+    ix.nodes[node].topCount = (uint32_t)ix.top.size() - topStart;
+}
+
+void buildStopSearchIndex() {
+    StopSearchIndex& ix = stopSearch;
+    ix = StopSearchIndex();
+    ix.built = true;
+    const RouteGraph& g = routeGraph;
+    int n = g.stopCount();
+    
+    vector<uint32_t> nameStart(n);
+    ix.nameEnd.resize(n);
+    ix.stopRoutes.resize(n);
+    for (int s = 0; s < n; s++) {
+        nameStart[s] = (uint32_t)ix.text.size();
+        ix.text += sv(g.stopKeys[s]);
+        ix.nameEnd[s] = (uint32_t)ix.text.size();
+        ix.stopRoutes[s] = (g.edgeStart[s + 1] - g.edgeStart[s]) + (g.inStart[s + 1] - g.inStart[s]);
+    }
+    vector<int> order(n);
+    for (int s = 0; s < n; s++) order[s] = s;
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        if (ix.stopRoutes[a] != ix.stopRoutes[b]) return ix.stopRoutes[a] > ix.stopRoutes[b];
+        uint32_t lenA = ix.nameEnd[a] - nameStart[a], lenB = ix.nameEnd[b] - nameStart[b];
+        if (lenA != lenB) return lenA < lenB;
+        return sv(g.stopKeys[a]) < sv(g.stopKeys[b]);
+    });
+    ix.stopRank.resize(n);
+    for (int r = 0; r < n; r++) ix.stopRank[order[r]] = r;
+    
+    // One entry per word start; matches at the start of the name rank first
+    for (int s = 0; s < n; s++) {
+        for (uint32_t p = nameStart[s]; p < ix.nameEnd[s]; p++) {
+            if (!isWordByte(ix.text[p])) continue;
+            if (p > nameStart[s] && isWordByte(ix.text[p - 1])) continue;
+            uint32_t score = ix.stopRank[s] + (p == nameStart[s] ? 0 : (uint32_t)n);
+            ix.entries.push_back({p, (uint32_t)s, score});
+        }
+    }
+    // Sorted on the first 8 bytes packed big-endian, which settles most
+    // comparisons without touching text
+    vector<pair<uint64_t, uint32_t>> keys(ix.entries.size());
+    for (size_t i = 0; i < ix.entries.size(); i++) {
+        string_view suffix = stopSuffix(ix, ix.entries[i]);
+        uint64_t head = 0;
+        for (size_t j = 0; j < 8; j++) head = head << 8 | (j < suffix.size() ? (unsigned char)suffix[j] : 0);
+        keys[i] = {head, (uint32_t)i};
+    }
+    sort(keys.begin(), keys.end(), [&ix](const pair<uint64_t, uint32_t>& a, const pair<uint64_t, uint32_t>& b) {
+        if (a.first != b.first) return a.first < b.first;
+        const StopSearchIndex::Entry& x = ix.entries[a.second];
+        const StopSearchIndex::Entry& y = ix.entries[b.second];
+        string_view sx = stopSuffix(ix, x), sy = stopSuffix(ix, y);
+        return sx != sy ? sx < sy : x.score < y.score;
+    });
+    vector<StopSearchIndex::Entry> sorted(ix.entries.size());
+    for (size_t i = 0; i < keys.size(); i++) sorted[i] = ix.entries[keys[i].second];
+    ix.entries = move(sorted);
+    if (!ix.entries.empty()) {
+        ix.nodes.resize(1);
+        buildStopNode(ix, 0, 0, (uint32_t)ix.entries.size(), 0);
+    }
+    
+    // Trigram postings by counting: number the distinct trigrams, size each
+    // list, then fill them in stop order so every list comes out sorted
+    vector<uint32_t> stopGrams; // per stop, its trigrams as vocabulary ids
+    unordered_map<uint32_t, uint32_t> vocabulary;
+    vector<uint32_t> grams;
+    ix.nameGrams.resize(n);
+    for (int s = 0; s < n; s++) {
+        nameTrigrams(sv(g.stopKeys[s]), grams);
+        grams.resize(min<size_t>(grams.size(), UINT16_MAX));
+        ix.nameGrams[s] = (uint16_t)grams.size();
+        for (uint32_t gram : grams) {
+            auto it = vocabulary.find(gram);
+            if (it == vocabulary.end()) it = vocabulary.emplace(gram, (uint32_t)vocabulary.size()).first;
+            stopGrams.push_back(it->second);
+        }
+    }
+    vector<pair<uint32_t, uint32_t>> codes(vocabulary.begin(), vocabulary.end());
+    sort(codes.begin(), codes.end());
+    vector<uint32_t> slot(codes.size()); // vocabulary id -> position in gramCodes
+    ix.gramCodes.resize(codes.size());
+    for (size_t i = 0; i < codes.size(); i++) {
+        ix.gramCodes[i] = codes[i].first;
+        slot[codes[i].second] = (uint32_t)i;
+    }
+    ix.gramStart.assign(codes.size() + 1, 0);
+    for (uint32_t id : stopGrams) ix.gramStart[slot[id] + 1]++;
+    for (size_t i = 0; i < codes.size(); i++) ix.gramStart[i + 1] += ix.gramStart[i];
+    ix.gramStops.resize(stopGrams.size());
+    vector<uint32_t> fill(ix.gramStart.begin(), ix.gramStart.end() - 1);
+    size_t next = 0;
+    for (int s = 0; s < n; s++) {
+        for (uint16_t k = 0; k < ix.nameGrams[s]; k++) ix.gramStops[fill[slot[stopGrams[next++]]]++] = s;
+    }
+    ix.hitCount.assign(n, 0);
+}
+
+// Up to limit stops having a word that starts with query, best first.
+void prefixStopMatches(const StopSearchIndex& ix, string_view query, size_t limit, vector<uint32_t>& out) {
+    if (ix.nodes.empty() || query.empty()) return;
+    uint32_t node = 0;
+    size_t i = 0;
+    while (true) {
+        const StopSearchIndex::Node& n = ix.nodes[node];
+        size_t len = min<size_t>(n.labelLen, query.size() - i);
+        if (ix.text.compare(n.labelPos, len, query.data() + i, len) != 0) return;
+        i += n.labelLen;
+        if (i >= query.size()) break;
+        uint32_t next = UINT32_MAX;
+        uint32_t lo = n.firstChild, hi = n.firstChild + n.childCount;
+        while (lo < hi) { // children are ordered by their first character
+            uint32_t mid = (lo + hi) / 2;
+            unsigned char c = ix.text[ix.nodes[mid].labelPos];
+            if (c < (unsigned char)query[i]) lo = mid + 1;
+            else { if (c == (unsigned char)query[i]) next = mid; hi = mid; }
+        }
+        if (next == UINT32_MAX) return;
+        node = next;
+    }
+    
+    const StopSearchIndex::Node& n = ix.nodes[node];
+    if (limit <= n.topCount || n.topCount < SUGGEST_NODE_TOP) {
+        for (uint32_t t = 0; t < n.topCount && out.size() < limit; t++) {
+            out.push_back(ix.entries[ix.top[n.topStart + t]].stop);
+        }
+        return;
+    }
+    // More than the node keeps: rank the whole subtree
+    vector<pair<uint32_t, uint32_t>> best; // score, stop
+    for (uint32_t e = n.lo; e < n.hi; e++) best.emplace_back(ix.entries[e].score, ix.entries[e].stop);
+    sort(best.begin(), best.end());
+    unordered_set<uint32_t> seen;
+    for (const auto& b : best) {
+        if (out.size() >= limit) break;
+        if (seen.insert(b.second).second) out.push_back(b.second);
+    }
+}
+
+// Stops sharing about two thirds of the query's trigrams (roughly one typo
+// per three or four letters), best first, until out holds limit stops.
+void fuzzyStopMatches(StopSearchIndex& ix, string_view query, size_t limit, vector<uint32_t>& out) {
+    vector<uint32_t> grams;
+    nameTrigrams(query, grams, false);
+    size_t q = grams.size();
+    if (q == 0 || out.size() >= limit) return;
+    
+    vector<pair<uint32_t, uint32_t>> lists; // posting ranges in gramStops
+    for (uint32_t gram : grams) {
+        auto it = lower_bound(ix.gramCodes.begin(), ix.gramCodes.end(), gram);
+        if (it == ix.gramCodes.end() || *it != gram) continue;
+        size_t i = it - ix.gramCodes.begin();
+        lists.emplace_back(ix.gramStart[i], ix.gramStart[i + 1]);
+    }
+    size_t minHits = max<size_t>(1, (2 * q + 2) / 3);
+    if (lists.size() < minHits) return;
+    sort(lists.begin(), lists.end(), [](const pair<uint32_t, uint32_t>& a, const pair<uint32_t, uint32_t>& b) {
+        return a.second - a.first < b.second - b.first;
+    });
+    
+    // A stop with minHits hits is in at least one of the shortest
+    // lists.size() - minHits + 1 lists; only those admit candidates
+    size_t admitting = lists.size() - minHits + 1;
+    vector<uint32_t> touched;
+    for (size_t l = 0; l < admitting; l++) {
+        for (uint32_t p = lists[l].first; p < lists[l].second; p++) {
+            uint32_t s = ix.gramStops[p];
+            if (ix.hitCount[s]++ == 0) touched.push_back(s);
+        }
+    }
+    for (size_t l = admitting; l < lists.size(); l++) {
+        // Drop stops that cannot reach minHits even by matching every list left
+        size_t left = lists.size() - l;
+        size_t kept = 0;
+        for (uint32_t s : touched) {
+            if (ix.hitCount[s] + left >= minHits) touched[kept++] = s;
+            else ix.hitCount[s] = 0;
+        }
+        touched.resize(kept);
+        const uint32_t* begin = ix.gramStops.data() + lists[l].first;
+        const uint32_t* end = ix.gramStops.data() + lists[l].second;
+        if (touched.size() * 16 < (size_t)(end - begin)) {
+            for (uint32_t s : touched) {
+                if (binary_search(begin, end, s)) ix.hitCount[s]++;
+            }
+        } else {
+            for (const uint32_t* p = begin; p != end; p++) {
+                if (ix.hitCount[*p] > 0) ix.hitCount[*p]++;
+            }
+        }
+    }
+    
+    vector<uint32_t> matches;
+    for (uint32_t s : touched) {
+        if (ix.hitCount[s] >= minHits) matches.push_back(s);
+    }
+    // More shared trigrams first, then fewer extra ones (closer in length)
+    auto better = [&ix](uint32_t a, uint32_t b) {
+        if (ix.hitCount[a] != ix.hitCount[b]) return ix.hitCount[a] > ix.hitCount[b];
+        if (ix.nameGrams[a] != ix.nameGrams[b]) return ix.nameGrams[a] < ix.nameGrams[b];
+        return ix.stopRank[a] < ix.stopRank[b];
+    };
+    size_t take = min(matches.size(), limit - out.size());
+    partial_sort(matches.begin(), matches.begin() + take, matches.end(), better);
+    out.insert(out.end(), matches.begin(), matches.begin() + take);
+    for (uint32_t s : touched) ix.hitCount[s] = 0;
+}
+
+// {"suggestions":[...]} for a partly typed stop name: stops with a word
+// starting with it, or failing that, near misspellings.
+string suggestStopsToJSON(const string& query, int limit) {
+    if (!stopSearch.built) buildStopSearchIndex();
+    string key = toLowerCase(query);
+    size_t start = 0;
+    while (start < key.size() && !isWordByte(key[start])) start++;
+    key.erase(0, start);
+    
+    vector<uint32_t> stops;
+    prefixStopMatches(stopSearch, key, (size_t)limit, stops);
+    bool fuzzy = stops.empty();
+    if (fuzzy) fuzzyStopMatches(stopSearch, key, (size_t)limit, stops);
+    
+    JsonWriter w;
+    w.raw("{\"suggestions\":[");
+    for (size_t i = 0; i < stops.size(); i++) {
+        if (i > 0) w.raw(",");
+        w.raw("{\"stop\":").str(sv(routeGraph.stopNames[stops[i]]))
+         .raw(",\"routes\":").num((long long)stopSearch.stopRoutes[stops[i]])
+         .raw(fuzzy ? ",\"match\":\"fuzzy\"}" : ",\"match\":\"prefix\"}");
+    }
+    w.raw("]}");
+    return move(w.str());
+}
+
+const double EARTH_RADIUS_KM = 6371.0088;
+const int NEAREST_DEFAULT_K = 5;
+const int NEAREST_MAX_K = 1000;
+
+void unitVector(const Coordinate& c, double out[3]) {
+    double lat = c.lat * M_PI / 180, lng = c.lng * M_PI / 180;
+    out[0] = cos(lat) * cos(lng);
+    out[1] = cos(lat) * sin(lng);
+    out[2] = sin(lat);
+}
+
+double haversineKm(const Coordinate& a, const Coordinate& b) {
+    double dLat = (b.lat - a.lat) * M_PI / 180, dLng = (b.lng - a.lng) * M_PI / 180;
+    double h = sin(dLat / 2) * sin(dLat / 2) +
+               cos(a.lat * M_PI / 180) * cos(b.lat * M_PI / 180) * sin(dLng / 2) * sin(dLng / 2);
+    return 2 * EARTH_RADIUS_KM * asin(min(1.0, sqrt(h)));
+}
+
+// Orders points lo..hi-1 into a subtree, splitting on its widest axis.
+void buildKdSubtree(vector<StopSpatialIndex::Point>& points, size_t lo, size_t hi) {
+    if (hi - lo <= 1) return;
+    double minP[3] = {2, 2, 2}, maxP[3] = {-2, -2, -2};
+    for (size_t i = lo; i < hi; i++) {
+        for (int a = 0; a < 3; a++) {
+            minP[a] = min(minP[a], points[i].p[a]);
+            maxP[a] = max(maxP[a], points[i].p[a]);
+        }
+    }
+    uint32_t axis = 0;
+    for (uint32_t a = 1; a < 3; a++) {
+        if (maxP[a] - minP[a] > maxP[axis] - minP[axis]) axis = a;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    nth_element(points.begin() + lo, points.begin() + mid, points.begin() + hi,
+                [axis](const StopSpatialIndex::Point& a, const StopSpatialIndex::Point& b) { return a.p[axis] < b.p[axis]; });
+    points[mid].axis = axis;
+    buildKdSubtree(points, lo, mid);
+    buildKdSubtree(points, mid + 1, hi);
+}
+
+void buildStopSpatialIndex() {
+    stopSpatial = StopSpatialIndex();
+    stopSpatial.built = true;
+    vector<StopSpatialIndex::Point>& points = stopSpatial.points;
+    for (int s = 0; s < routeGraph.stopCount(); s++) {
+        const Coordinate& c = routeGraph.stopCoords[s];
+        if (std::isnan(c.lat)) continue;
+        StopSpatialIndex::Point point;
+        unitVector(c, point.p);
+        point.stop = s;
+        point.axis = 0;
+        points.push_back(point);
+    }
+    buildKdSubtree(points, 0, points.size());
+}
+
+// Keeps the k points closest to q with squared chord distance at most
+// bound in a max-heap; bound shrinks to the k-th distance once it is full.
+void kdNearest(const vector<StopSpatialIndex::Point>& points, size_t lo, size_t hi, const double q[3],
+               size_t k, double& bound, vector<pair<double, uint32_t>>& heap) {
+    if (lo >= hi) return;
+    size_t mid = lo + (hi - lo) / 2;
+    const StopSpatialIndex::Point& point = points[mid];
+    double dx = point.p[0] - q[0], dy = point.p[1] - q[1], dz = point.p[2] - q[2];
+    double d = dx * dx + dy * dy + dz * dz;
+    if (d <= bound) {
+        heap.emplace_back(d, point.stop);
+        push_heap(heap.begin(), heap.end());
+        if (heap.size() > k) {
+            pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+        if (heap.size() == k) bound = heap.front().first;
+    }
+    double diff = q[point.axis] - point.p[point.axis];
+    if (diff < 0) {
+        kdNearest(points, lo, mid, q, k, bound, heap);
+        if (diff * diff <= bound) kdNearest(points, mid + 1, hi, q, k, bound, heap);
+    } else {
+        kdNearest(points, mid + 1, hi, q, k, bound, heap);
+        if (diff * diff <= bound) kdNearest(points, lo, mid, q, k, bound, heap);
+    }
+}
+
+// Up to k stops nearest to at, closest first, optionally only those within
+// radiusKm (negative for no limit).
+vector<uint32_t> nearestStops(const Coordinate& at, size_t k, double radiusKm) {
+    if (!stopSpatial.built) buildStopSpatialIndex();
+    double q[3];
+    unitVector(at, q);
+    // Beyond half the circumference every point is in range
+    double bound = 5; // above the largest squared chord, 4
+    if (radiusKm >= 0 && radiusKm < M_PI * EARTH_RADIUS_KM) {
+        double chord = 2 * sin(radiusKm / EARTH_RADIUS_KM / 2);
+        bound = chord * chord;
+    }
+    vector<pair<double, uint32_t>> heap;
+    heap.reserve(k + 1);
+    kdNearest(stopSpatial.points, 0, stopSpatial.points.size(), q, k, bound, heap);
+    sort_heap(heap.begin(), heap.end());
+    vector<uint32_t> stops;
+    for (const auto& entry : heap) stops.push_back(entry.second);
+    return stops;
+}
+
+string nearestStopsToJSON(const Coordinate& at, size_t k, double radiusKm) {
+    vector<uint32_t> stops = nearestStops(at, k, radiusKm);
+    JsonWriter w;
+    w.raw("{\"stops\":[");
+    for (size_t i = 0; i < stops.size(); i++) {
+        const Coordinate& c = routeGraph.stopCoords[stops[i]];
+        if (i > 0) w.raw(",");
+        w.raw("{\"stop\":").str(sv(routeGraph.stopNames[stops[i]]))
+         .raw(",\"lat\":").num(c.lat, 6)
+         .raw(",\"lng\":").num(c.lng, 6)
+         .raw(",\"distanceKm\":").num(haversineKm(at, c), 3)
+         .raw("}");
+    }
+    w.raw("]}");
+    return move(w.str());
+}
+
+// ========================
+// Seat Management
+// ========================
+
+const int DEFAULT_ROUTE_SEATS = 40;
+const int MAX_ROUTE_SEATS = 10000;
+
+// Gives the route seats 1..totalSeats. Seats it already has are left as
+// they are, so booked and reserved seats keep their holders. Returns how
+// many seats were booked or reserved.
+int initializeSeatsForRoute(int routeID, int totalSeats = DEFAULT_ROUTE_SEATS) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    RouteSeats* entry;
+    {
+        unique_lock<shared_mutex> exclusive(inventoryMutex);
+        ensureRouteSeats(routeID);
+        entry = &routeSeatsEntry(routeID);
+    }
+    RouteSeats& route = *entry;
+    lock_guard<mutex> seatsLock(routeLock(routeID));
+    undoSaveRoute(routeID);
+    int held = 0;
+    for (int i = 0; i < totalSeats; i++) {
+        if (route.exists(i)) {
+            held += route.status(i) != SEAT_AVAILABLE;
+            continue;
+        }
+        route.set(i, SEAT_AVAILABLE, 0, 0);
+        journalSeat(seatRecord(route, i));
+    }
+    commitMutation();
+    return held;
+}
+
+// Creates seats for every route in routes.txt that has none yet, with
+// capacities[routeID] seats or defaultSeats. Routes that already have
+// inventory are left as they are, so calling this again changes nothing.
+// Returns the routes that were initialized.
+vector<int> initializeMissingSeats(const unordered_map<int, int>& capacities, int defaultSeats) {
+    ensureRoutes();
+    vector<int> created;
+    lock_guard<mutex> ledger(ledgerMutex);
+    for (const auto& pair : allStoredRoutes) {
+        int routeID = pair.first;
+        RouteSeats* entry;
+        {
+            unique_lock<shared_mutex> exclusive(inventoryMutex);
+            ensureRouteSeats(routeID);
+            auto it = seatInventory.find(routeID);
+            if (it != seatInventory.end() && it->second.total() > 0) continue;
+            entry = &routeSeatsEntry(routeID);
+        }
+        auto cap = capacities.find(routeID);
+        int totalSeats = cap == capacities.end() ? defaultSeats : cap->second;
+        RouteSeats& route = *entry;
+        lock_guard<mutex> seatsLock(routeLock(routeID));
+        undoSaveRoute(routeID);
+        for (int i = 0; i < totalSeats; i++) {
+            route.set(i, SEAT_AVAILABLE, 0, 0);
+            journalSeat(seatRecord(route, i));
+        }
+        created.push_back(routeID);
+    }
+    commitMutation();
+    return created;
+}
+
+int countAvailableSeats(int routeID) {
+    const RouteSeats* route = findRouteSeats(routeID);
+    return route ? route->available : 0;
+}
+
+int countBookedSeats(int routeID) {
+    const RouteSeats* route = findRouteSeats(routeID);
+    return route ? route->bookedCount : 0;
+}
+
+int countReservedSeats(int routeID) {
+    const RouteSeats* route = findRouteSeats(routeID);
+    return route ? route->reservedCount : 0;
+}
+
+int totalSeatCount() {
+    ensureAllSeats();
+    int count = 0;
+    for (const auto& pair : seatInventory) count += pair.second.total();
+    return count;
+}
+
+vector<string> getSeatsWithStatus(int routeID, SeatStatus status) {
+    vector<string> result;
+    const RouteSeats* route = findRouteSeats(routeID);
+    if (!route) return result;
+    for (int i = 0; i < route->capacity(); i++) {
+        if (route->exists(i) && route->status(i) == status) {
+            result.push_back(makeSeatID(routeID, i));
+        }
+    }
+    return result;
+}
+
+vector<string> getAvailableSeats(int routeID) {
+    return getSeatsWithStatus(routeID, SEAT_AVAILABLE);
+}
+
+vector<string> getBookedSeats(int routeID) {
+    return getSeatsWithStatus(routeID, SEAT_BOOKED);
+}
+
+struct NetworkSeatStats {
+    int routes = 0;
+    long long total = 0;
+    long long available = 0;
+    long long booked = 0;
+    long long reserved = 0;
+};
+
+// Whole-network totals straight from the status bitsets.
+NetworkSeatStats getNetworkSeatStats() {
+    ensureAllSeats();
+    NetworkSeatStats stats;
+    for (const auto& pair : seatInventory) {
+        const RouteSeats& r = pair.second;
+        for (size_t w = 0; w < r.present.size(); w++) {
+            stats.total += __builtin_popcountll(r.present[w]);
+            stats.booked += __builtin_popcountll(r.booked[w]);
+            stats.reserved += __builtin_popcountll(r.reserved[w]);
+        }
+        stats.routes++;
+    }
+    stats.available = stats.total - stats.booked - stats.reserved;
+    return stats;
+}
+
+// ========================
+// Timetable
+// ========================
+// backend/timetable.txt schedules trips over the routes in routes.txt, one
+// leg per line:
+//
+//   tripID|routeID|departure|arrival|days[|seats]
+//   T100|3|08:15|08:32|1111100|52
+//
+// A trip's legs are its lines in file order. days has one 0/1 flag per
+// weekday, Monday first; days and seats (default 40) are read from a trip's
+// first line. Times are HH:MM[:SS] from midnight of the service day and may
+// run past 24:00.
+//
+// Every leg is a connection in one flat array sorted by departure, and
+// queries use the Connection Scan Algorithm: earliest arrival is a single
+// forward scan from the departure time that stops once no later connection
+// can arrive sooner; a profile (every journey not beaten on both departure
+// and arrival within a window) is a single backward scan. Journeys start and
+// end on the query's service day. Changing trips takes TRANSFER_SECONDS.
+const string TIMETABLE_FILE = "backend/timetable.txt";
+const int32_t TRANSFER_SECONDS = 120;
+const int32_t NO_TIME = INT32_MAX;
+const uint32_t NO_CONNECTION = UINT32_MAX;
+
+struct Connection {
+    uint32_t depStop; // routeGraph stops
+    uint32_t arrStop;
+    int32_t dep;      // seconds from midnight of the service day
+    int32_t arr;
+    uint32_t trip;
+    uint32_t days;    // the trip's service days, bit 0 = Monday
+};
+
+struct Trip {
+    Sym tripID;
+    uint32_t days;
+    int seats;
+    uint32_t firstLeg; // legs are tripLegs[firstLeg .. firstLeg + legCount - 1]
+    uint32_t legCount;
+};
+
+// One ride: board a trip at connection board and leave it after alight.
+struct TripLeg {
+    uint32_t board;
+    uint32_t alight;
+};
+
+const uint32_t NO_ENTRY = UINT32_MAX;
+
+struct ProfileEntry {
+    int32_t dep;
+    int32_t arr;    // at the target
+    TripLeg leg;    // the first ride from this stop
+    uint32_t later; // the stop's entry before this one, leaving later
+};
+
+// Per-stop and per-trip arrays of the scans, kept between queries so a
+// query allocates nothing of its own. Between queries every slot holds its
+// empty value; a scan lists the slots it sets and puts them back when done.
+// Queries run one at a time.
+struct ScanScratch {
+    vector<int32_t> ready;                  // stop -> NO_TIME
+    vector<TripLeg> reachedBy;              // stop, read only where ready was set
+    vector<uint32_t> boarded;               // trip -> NO_CONNECTION
+    vector<uint32_t> earliest;              // stop -> NO_ENTRY
+    vector<pair<int32_t, uint32_t>> onTrip; // trip -> {NO_TIME, NO_CONNECTION}
+    vector<ProfileEntry> entries;
+    vector<uint32_t> touchedStops;
+    vector<uint32_t> touchedTrips;
+};
+
+struct Timetable {
+    vector<Connection> connections; // by departure, then arrival
+    vector<int> connectionRoute;    // connection -> routeID
+    vector<Trip> trips;
+    vector<uint32_t> tripLegs;      // each trip's connections in order
+    unordered_map<Sym, uint32_t> tripIndex;
+    uint32_t routesCRC = 0;         // routes.txt the stops were resolved against
+    time_t fileMtime = 0;
+    off_t fileSize = -1;            // -1: no timetable.txt
+    bool loaded = false;
+    mutable ScanScratch scratch;
+};
+
+Timetable timetable;
+
+// "HH:MM" or "HH:MM:SS" -> seconds; hours up to 47 for trips past midnight.
+bool parseClock(string_view text, int32_t& seconds) {
+    int h = 0, m = 0, sec = 0;
+    const char* p = text.data();
+    const char* end = p + text.size();
+    auto r = from_chars(p, end, h);
+    if (r.ec != errc() || r.ptr == end || *r.ptr != ':') return false;
+    r = from_chars(r.ptr + 1, end, m);
+    if (r.ec != errc()) return false;
+    if (r.ptr != end) {
+        if (*r.ptr != ':') return false;
+        r = from_chars(r.ptr + 1, end, sec);
+        if (r.ec != errc() || r.ptr != end) return false;
+    }
+    if (h < 0 || h > 47 || m < 0 || m > 59 || sec < 0 || sec > 59) return false;
+    seconds = h * 3600 + m * 60 + sec;
+    return true;
+}
+
+string formatClock(int32_t seconds) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    return buf;
+}
+
+// "1111100" -> weekday bitmask, bit 0 = Monday.
+bool parseServiceDays(string_view text, uint32_t& days) {
+    if (text.size() != 7) return false;
+    days = 0;
+    for (int i = 0; i < 7; i++) {
+        if (text[i] != '0' && text[i] != '1') return false;
+        if (text[i] == '1') days |= 1u << i;
+    }
+    return true;
+}
+
+// "YYYY-MM-DD" -> yyyymmdd and weekday (0 = Monday).
+bool parseServiceDate(string_view text, int& date, int& weekday) {
+    int y, m, d;
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-') return false;
+    if (from_chars(text.data(), text.data() + 4, y).ec != errc() ||
+        from_chars(text.data() + 5, text.data() + 7, m).ec != errc() ||
+        from_chars(text.data() + 8, text.data() + 10, d).ec != errc()) return false;
+    static const int monthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (y < 1970 || m < 1 || m > 12 || d < 1 || d > monthDays[m - 1]) return false;
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (m == 2 && d == 29 && !leap) return false;
+    // Days since 1970-01-01 (a Thursday), from Howard Hinnant's days_from_civil
+    int yy = y - (m <= 2);
+    int era = yy / 400;
+    int yoe = yy - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = (long)era * 146097 + doe - 719468;
+    weekday = (int)((days + 3) % 7);
+    date = y * 10000 + m * 100 + d;
+    return true;
+}
+
+string formatServiceDate(int date) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02d", date / 10000, date / 100 % 100, date % 100);
+    return buf;
+}
+
+// Today's date and the time of day in local time.
+void localDateTime(string& date, int32_t& seconds) {
+    time_t now = time(0);
+    struct tm local = *localtime(&now);
+    char buf[16];
+    strftime(buf, sizeof(buf), "%Y-%m-%d", &local);
+    date = buf;
+    seconds = local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+}
+
+// Lines naming an unknown route, or with bad times or days, are skipped.
+void loadTimetable() {
+    METRIC_PHASE(PHASE_LOAD_TIMETABLE);
+    struct Leg {
+        uint32_t trip;
+        int routeID;
+        int32_t dep;
+        int32_t arr;
+    };
+    Timetable t;
+    t.loaded = true;
+    t.routesCRC = routesFileCRC;
+    struct stat st;
+    if (stat(TIMETABLE_FILE.c_str(), &st) == 0) {
+        t.fileMtime = st.st_mtime;
+        t.fileSize = st.st_size;
+    }
+    
+    vector<Leg> legs;
+    ifstream file(TIMETABLE_FILE, ios::binary);
+    string line;
+    vector<string_view> parts;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        METRIC_COUNT(COUNT_BYTES_READ, line.size() + 1);
+        if (line.empty() || line[0] == '#') continue;
+        parts.clear();
+        string_view rest(line);
+        for (size_t bar; (bar = rest.find('|')) != string_view::npos; rest.remove_prefix(bar + 1)) {
+            parts.push_back(rest.substr(0, bar));
+        }
+        parts.push_back(rest);
+        if (parts.size() < 5 || parts.size() > 6 || parts[0].empty()) continue;
+        
+        Leg leg;
+        auto r = from_chars(parts[1].data(), parts[1].data() + parts[1].size(), leg.routeID);
+        if (r.ec != errc() || !allStoredRoutes.count(leg.routeID)) continue;
+        if (!parseClock(parts[2], leg.dep) || !parseClock(parts[3], leg.arr) || leg.arr < leg.dep) continue;
+        
+        Sym id = intern(parts[0]);
+        auto found = t.tripIndex.find(id);
+        if (found == t.tripIndex.end()) {
+            uint32_t days;
+            int seats = DEFAULT_ROUTE_SEATS;
+            if (!parseServiceDays(parts[4], days)) continue;
+            if (parts.size() == 6 && !parts[5].empty()) {
+                auto sr = from_chars(parts[5].data(), parts[5].data() + parts[5].size(), seats);
+                if (sr.ec != errc() || seats <= 0 || seats > MAX_ROUTE_SEATS) continue;
+            }
+            found = t.tripIndex.emplace(id, (uint32_t)t.trips.size()).first;
+            t.trips.push_back({id, days, seats, 0, 0});
+        }
+        leg.trip = found->second;
+        legs.push_back(leg);
+    }
+    
+    // Sort the legs by time into the connection array
+    vector<uint32_t> order(legs.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return legs[a].dep < legs[b].dep || (legs[a].dep == legs[b].dep && legs[a].arr < legs[b].arr);
+    });
+    t.connections.resize(legs.size());
+    t.connectionRoute.resize(legs.size());
+    vector<uint32_t> connectionOf(legs.size());
+    for (uint32_t c = 0; c < order.size(); c++) {
+        const Leg& leg = legs[order[c]];
+        const Route& route = allStoredRoutes[leg.routeID];
+        t.connections[c] = {(uint32_t)routeGraph.stopIndex.at(route.fromKey), (uint32_t)routeGraph.stopIndex.at(route.toKey),
+                            leg.dep, leg.arr, leg.trip, t.trips[leg.trip].days};
+        t.connectionRoute[c] = leg.routeID;
+        connectionOf[order[c]] = c;
+    }
+    
+    // Group each trip's connections, keeping file order within the trip
+    for (const Leg& leg : legs) t.trips[leg.trip].legCount++;
+    uint32_t next = 0;
+    for (Trip& trip : t.trips) {
+        trip.firstLeg = next;
+        next += trip.legCount;
+        trip.legCount = 0;
+    }
+    t.tripLegs.resize(legs.size());
+    for (uint32_t i = 0; i < legs.size(); i++) {
+        Trip& trip = t.trips[legs[i].trip];
+        t.tripLegs[trip.firstLeg + trip.legCount++] = connectionOf[i];
+    }
+    timetable = move(t);
+}
+
+// The timetable for the current routes.txt and timetable.txt.
+const Timetable& ensureTimetable() {
+    ensureRoutes();
+    struct stat st;
+    off_t size = stat(TIMETABLE_FILE.c_str(), &st) == 0 ? st.st_size : -1;
+    if (!timetable.loaded || timetable.routesCRC != routesFileCRC || timetable.fileSize != size ||
+        (size >= 0 && timetable.fileMtime != st.st_mtime)) {
+        loadTimetable();
+    }
+    return timetable;
+}
+
+const Trip* findTrip(const Timetable& tt, string_view tripID) {
+    Sym id;
+    if (!symbols.lookup(tripID, id)) return nullptr;
+    auto it = tt.tripIndex.find(id);
+    return it == tt.tripIndex.end() ? nullptr : &tt.trips[it->second];
+}
+
+// First connection departing at or after t.
+uint32_t firstDeparture(const Timetable& tt, int32_t t) {
+    auto it = lower_bound(tt.connections.begin(), tt.connections.end(), t,
+        [](const Connection& c, int32_t time) { return c.dep < time; });
+    return (uint32_t)(it - tt.connections.begin());
+}
+
+// The scratch sized for the current stops and the timetable's trips.
+ScanScratch& scanScratch(const Timetable& tt) {
+    ScanScratch& s = tt.scratch;
+    size_t stops = routeGraph.stopKeys.size();
+    if (s.ready.size() != stops) {
+        s.ready.assign(stops, NO_TIME);
+        s.reachedBy.resize(stops);
+        s.earliest.assign(stops, NO_ENTRY);
+    }
+    if (s.boarded.size() != tt.trips.size()) {
+        s.boarded.assign(tt.trips.size(), NO_CONNECTION);
+        s.onTrip.assign(tt.trips.size(), {NO_TIME, NO_CONNECTION});
+    }
+    return s;
+}
+
+// Earliest arrival at target leaving source at or after t0, on a service day
+// with the given weekday. Fills legs and returns the arrival time, or
+// NO_TIME if target can't be reached that day.
+int32_t earliestArrival(const Timetable& tt, uint32_t source, uint32_t target, int32_t t0, int weekday,
+                        vector<TripLeg>& legs) {
+    legs.clear();
+    const vector<Connection>& cs = tt.connections;
+    uint32_t day = 1u << weekday;
+    ScanScratch& s = scanScratch(tt);
+    // ready: earliest time a trip can be boarded at the stop
+    vector<int32_t>& ready = s.ready;
+    vector<uint32_t>& boarded = s.boarded;
+    vector<TripLeg>& reachedBy = s.reachedBy;
+    ready[source] = t0;
+    s.touchedStops.push_back(source);
+    int32_t best = NO_TIME;
+    for (uint32_t i = firstDeparture(tt, t0); i < cs.size(); i++) {
+        const Connection& c = cs[i];
+        if (c.dep >= best) break;
+        if (!(c.days & day)) continue;
+        uint32_t& board = boarded[c.trip];
+        if (board == NO_CONNECTION) {
+            if (ready[c.depStop] > c.dep) continue;
+            board = i;
+            s.touchedTrips.push_back(c.trip);
+        }
+        if (c.arrStop == target) {
+            if (c.arr < best) {
+                best = c.arr;
+                reachedBy[target] = {board, i};
+            }
+        } else if (c.arr + TRANSFER_SECONDS < ready[c.arrStop]) {
+            if (ready[c.arrStop] == NO_TIME) s.touchedStops.push_back(c.arrStop);
+            ready[c.arrStop] = c.arr + TRANSFER_SECONDS;
+            reachedBy[c.arrStop] = {board, i};
+        }
+    }
+    if (best != NO_TIME) {
+        for (uint32_t stop = target; stop != source; stop = cs[legs.back().board].depStop) {
+            legs.push_back(reachedBy[stop]);
+        }
+        reverse(legs.begin(), legs.end());
+    }
+    for (uint32_t stop : s.touchedStops) ready[stop] = NO_TIME;
+    for (uint32_t trip : s.touchedTrips) boarded[trip] = NO_CONNECTION;
+    s.touchedStops.clear();
+    s.touchedTrips.clear();
+    return best;
+}
+
+struct ProfileJourney {
+    int32_t dep;
+    int32_t arr;
+    vector<TripLeg> legs;
+};
+
+// Profile query: the journeys from source to target leaving in [t0, t1]
+// that no other journey beats by leaving later and arriving sooner, by
+// departure, then the earliest arrival when leaving at t1, which may depart
+// after t1. Nothing arriving after that one can be an answer, which bounds
+// the scan.
+vector<ProfileJourney> profileJourneys(const Timetable& tt, uint32_t source, uint32_t target,
+                                       int32_t t0, int32_t t1, int weekday) {
+    if (source == target) return {};
+    const vector<Connection>& cs = tt.connections;
+    uint32_t day = 1u << weekday;
+    vector<TripLeg> tail;
+    int32_t limit = earliestArrival(tt, source, target, t1, weekday, tail);
+    
+    // Each stop's entries form a list from its earliest departure (added
+    // last) to its latest; arrivals fall along the list too. All lists
+    // share one array.
+    ScanScratch& s = scanScratch(tt);
+    vector<ProfileEntry>& entries = s.entries;
+    vector<uint32_t>& earliest = s.earliest;
+    vector<pair<int32_t, uint32_t>>& onTrip = s.onTrip; // arrival, alight
+    // Best entry at the stop among those leaving at or after t. Lookups come
+    // from connections just before t, so the walk stays short.
+    auto bestFrom = [&](uint32_t stop, int32_t t) -> const ProfileEntry* {
+        uint32_t e = earliest[stop];
+        while (e != NO_ENTRY && entries[e].dep < t) e = entries[e].later;
+        return e == NO_ENTRY ? nullptr : &entries[e];
+    };
+    
+    uint32_t first = firstDeparture(tt, t0);
+    uint32_t last = limit == NO_TIME ? (uint32_t)cs.size() : firstDeparture(tt, limit);
+    for (uint32_t i = last; i-- > first;) {
+        const Connection& c = cs[i];
+        if (!(c.days & day) || c.arr >= limit) continue;
+        int32_t arr = NO_TIME;
+        uint32_t alight = NO_CONNECTION;
+        if (c.arrStop == target) {
+            arr = c.arr;
+            alight = i;
+        } else if (const ProfileEntry* e = bestFrom(c.arrStop, c.arr + TRANSFER_SECONDS)) {
+            arr = e->arr;
+            alight = i;
+        }
+        pair<int32_t, uint32_t>& stay = onTrip[c.trip];
+        if (stay.first <= arr) { // on ties, stay on board
+            arr = stay.first;
+            alight = stay.second;
+        }
+        if (arr == NO_TIME) continue;
+        if (stay.first == NO_TIME) s.touchedTrips.push_back(c.trip);
+        stay = {arr, alight};
+        uint32_t& head = earliest[c.depStop];
+        if (head != NO_ENTRY && entries[head].arr <= arr) continue;
+        if (head != NO_ENTRY && entries[head].dep == c.dep) {
+            entries[head] = {c.dep, arr, {i, alight}, entries[head].later};
+        } else {
+            if (head == NO_ENTRY) s.touchedStops.push_back(c.depStop);
+            entries.push_back({c.dep, arr, {i, alight}, head});
+            head = (uint32_t)entries.size() - 1;
+        }
+    }
+    
+    vector<ProfileJourney> journeys;
+    for (uint32_t e = earliest[source]; e != NO_ENTRY && entries[e].dep <= t1; e = entries[e].later) {
+        const ProfileEntry* option = &entries[e];
+        ProfileJourney j = {option->dep, option->arr, {option->leg}};
+        uint32_t stop = cs[option->leg.alight].arrStop;
+        while (stop != target) {
+            const ProfileEntry* next = bestFrom(stop, cs[j.legs.back().alight].arr + TRANSFER_SECONDS);
+            if (!next) break;
+            j.legs.push_back(next->leg);
+            stop = cs[next->leg.alight].arrStop;
+        }
+        journeys.push_back(move(j));
+    }
+    if (limit != NO_TIME) journeys.push_back({cs[tail[0].board].dep, limit, move(tail)});
+    for (uint32_t stop : s.touchedStops) earliest[stop] = NO_ENTRY;
+    for (uint32_t trip : s.touchedTrips) onTrip[trip] = {NO_TIME, NO_CONNECTION};
+    s.touchedStops.clear();
+    s.touchedTrips.clear();
+    entries.clear();
+    return journeys;
+}
+
+// Trip seats are guarded by ledgerMutex; the caller holds it.
+const TripSeats* findTripSeats(const TripDate& key) {
+    ensureTripSeats();
+    auto it = tripInventory.find(key);
+    return it == tripInventory.end() ? nullptr : &it->second;
+}
+
+int freeTripSeats(const Trip& trip, int date, uint64_t legs) {
+    const TripSeats* seats = findTripSeats({trip.tripID, date});
+    return seats ? seats->countFree(trip.seats, legs) : trip.seats;
+}
+
+// Positions along the trip of its first leg leaving stop `from` and of the
+// first leg after it reaching stop `to`; false if it does not run between them.
+bool tripSegment(const Timetable& tt, const Trip& trip, int from, int to, uint32_t& board, uint32_t& alight) {
+    for (board = 0; board < trip.legCount; board++) {
+        if ((int)tt.connections[tt.tripLegs[trip.firstLeg + board]].depStop != from) continue;
+        for (alight = board; alight < trip.legCount; alight++) {
+            if ((int)tt.connections[tt.tripLegs[trip.firstLeg + alight]].arrStop == to) return true;
+        }
+    }
+    return false;
+}
+
+// Legs of a journey with the seats free on each ridden segment of date.
+void tripLegsJSON(JsonWriter& w, const Timetable& tt, const vector<TripLeg>& legs, int date) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    w.raw("[");
+    for (size_t i = 0; i < legs.size(); i++) {
+        const Connection& board = tt.connections[legs[i].board];
+        const Connection& alight = tt.connections[legs[i].alight];
+        const Trip& trip = tt.trips[board.trip];
+        if (i > 0) w.raw(",");
+        w.raw("{\"tripID\":").str(sv(trip.tripID))
+         .raw(",\"from\":").str(sv(routeGraph.stopNames[board.depStop]))
+         .raw(",\"to\":").str(sv(routeGraph.stopNames[alight.arrStop]))
+         .raw(",\"departure\":").str(formatClock(board.dep))
+         .raw(",\"arrival\":").str(formatClock(alight.arr))
+         .raw(",\"routeIDs\":[");
+        // The trip's legs from boarding to alighting
+        int from = -1, to = -1;
+        for (uint32_t k = 0; k < trip.legCount; k++) {
+            uint32_t c = tt.tripLegs[trip.firstLeg + k];
+            if (c == legs[i].board) from = (int)k;
+            if (from < 0) continue;
+            if ((int)k > from) w.raw(",");
+            w.num((long long)tt.connectionRoute[c]);
+            if (c == legs[i].alight) {
+                to = (int)k + 1;
+                break;
+            }
+        }
+        w.raw("],\"seatsAvailable\":").num((long long)freeTripSeats(trip, date, tripSegmentLegs(from, to)))
+         .raw("}");
+    }
+    w.raw("]");
+}
+
+void journeyFields(JsonWriter& w, const Timetable& tt, int date, int32_t dep, int32_t arr,
+                   const vector<TripLeg>& legs) {
+    w.raw("\"departure\":").str(formatClock(dep))
+     .raw(",\"arrival\":").str(formatClock(arr))
+     .raw(",\"durationMinutes\":").num((long long)(arr - dep) / 60)
+     .raw(",\"transfers\":").num((long long)legs.size() - 1)
+     .raw(",\"legs\":");
+    tripLegsJSON(w, tt, legs, date);
+}
+
+// Seats of a dated trip as free or taken on the given legs. A taken seat
+// names the first booking holding any of them.
+void tripSeatsToJSON(JsonWriter& w, const Trip& trip, int date, uint64_t legs) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    const TripSeats* seats = findTripSeats({trip.tripID, date});
+    // A shrunk capacity still lists the seats booked before
+    int count = max(trip.seats, seats ? (int)seats->occupied.size() : 0);
+    vector<const TripSeatHold*> holder(count, nullptr);
+    if (seats) {
+        for (const TripSeatHold& h : seats->holds) {
+            if ((h.legs & legs) && !holder[h.index]) holder[h.index] = &h;
+        }
+    }
+    int available = seats ? seats->countFree(trip.seats, legs) : trip.seats;
+    string dateText = formatServiceDate(date);
+    w.raw("{\"tripID\":").str(sv(trip.tripID))
+     .raw(",\"date\":").str(dateText)
+     .raw(",\"total\":").num((long long)trip.seats)
+     .raw(",\"available\":").num((long long)available)
+     .raw(",\"booked\":").num((long long)(trip.seats - available))
+     .raw(",\"seats\":[");
+    for (int i = 0; i < count; i++) {
+        const TripSeatHold* h = holder[i];
+        if (i > 0) w.raw(",");
+        w.raw("{\"seatID\":").str(makeTripSeatID(sv(trip.tripID), date, i))
+         .raw(",\"status\":\"").raw(h ? "Booked" : "Available")
+         .raw("\",\"userID\":").str(h ? sv(h->userID) : string_view())
+         .raw(",\"bookingID\":").str(h ? sv(h->bookingID) : string_view())
+         .raw("}");
+    }
+    w.raw("]}");
+}
+
+// ========================
+// User Management
+// ========================
+
+bool createUser(const string& userID, const string& name, const string& email) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    if (findUser(userID)) {
+        return false; // User already exists
+    }
+    Sym id = intern(userID);
+    undoSaveUser(id);
+    User& user = users[id];
+    user = {id, intern(name), email, 0, 0.0};
+    journalUser(user);
+    commitMutation();
+    return true;
+}
+
+bool updateUser(const string& userID, const string& name, const string& email) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    User* user = findUser(userID);
+    if (!user) {
+        return false;
+    }
+    undoSaveUser(user->userID);
+    user->name = intern(name);
+    user->email = email;
+    journalUser(*user);
+    commitMutation();
+    return true;
+}
+
+bool userExists(const string& userID) {
+    return findUser(userID) != nullptr;
+}
+
+// ========================
+// Booking Management
+// ========================
+
+string bookSeats(int routeID, const string& routeInfo, const string& userID, 
+                 const vector<string>& seatIDs, double pricePerSeat) {
+    Sym userSym;
+    Sym routeInfoSym;
+    vector<Sym> seatSyms;
+    RouteSeats* route;
+    int number;
+    Sym bookingSym;
+    {
+        // Lazy snapshot loads intern symbols, so lookups go under the ledger
+        lock_guard<mutex> ledger(ledgerMutex);
+        User* user = findUser(userID);
+        if (!user) {
+            return "ERROR:User does not exist";
+        }
+        userSym = user->userID;
+        routeInfoSym = intern(routeInfo);
+        seatSyms.reserve(seatIDs.size());
+        for (const string& seatID : seatIDs) seatSyms.push_back(intern(seatID));
+        route = findRouteSeats(routeID);
+        number = nextBookingID++;
+        bookingSym = intern(bookingName(number));
+    }
+    auto fail = [&](const string& message) {
+        returnBookingNumber(number);
+        return "ERROR:" + message;
+    };
+    
+    vector<int> claimed;
+    claimed.reserve(seatIDs.size());
+    for (const string& seatID : seatIDs) {
+        int seatRoute, index;
+        if (!parseSeatID(seatID, seatRoute, index)) {
+            return fail("Seat " + seatID + " does not exist");
+        }
+        if (seatRoute != routeID) {
+            return fail("Seat " + seatID + " does not belong to this route");
+        }
+        claimed.push_back(index);
+    }
+    
+    // Check, take and stamp every seat at once, holding only this route's
+    // lock; until the booking is filed below nothing else refers to it
+    if (!claimed.empty()) {
+        lock_guard<mutex> seatsLock(routeLock(routeID));
+        for (size_t i = 0; i < claimed.size(); i++) {
+            int index = claimed[i];
+            if (!route || !route->exists(index)) {
+                return fail("Seat " + seatIDs[i] + " does not exist");
+            }
+            bool repeated = find(claimed.begin(), claimed.begin() + i, index) != claimed.begin() + i;
+            if (repeated || route->status(index) != SEAT_AVAILABLE) {
+                return fail("Seat " + seatIDs[i] + " is not available");
+            }
+        }
+        undoSaveRoute(routeID);
+        for (int index : claimed) route->set(index, SEAT_BOOKED, userSym, bookingSym);
+    }
+    
+    // File the booking
+    lock_guard<mutex> ledger(ledgerMutex);
+    double totalPrice = pricePerSeat * seatIDs.size();
+    Booking booking = {
+        bookingSym,
+        routeID,
+        routeInfoSym,
+        userSym,
+        seatSyms,
+        totalPrice,
+        getCurrentTimestamp(),
+        SYM_ACTIVE
+    };
+    
+    undoSaveBooking(bookingSym);
+    undoSaveUser(userSym);
+    bookings[bookingSym] = booking;
+    reindexBooking(nullptr, booking);
+    for (int index : claimed) journalSeat({routeID, index, SEAT_BOOKED, userSym, bookingSym, 0});
+    
+    // Update user
+    User* user = findUser(userID);
+    user->totalBookings++;
+    user->totalSpent += totalPrice;
+    
+    // Persist changes
+    journalBooking(booking);
+    journalUser(*user);
+    commitMutation();
+    
+    return string(sv(bookingSym));
+}
+
+// Books seats on one dated trip of the timetable, from stop `from` to stop
+// `to` or, when they are empty, the whole trip. The booking is filed under
+// the route of the trip's first leg; its seat IDs name the trip, date and
+// segment.
+string bookTripSeats(const string& tripID, const string& dateText, const string& from, const string& to,
+                     const string& routeInfo, const string& userID, const vector<string>& seatIDs,
+                     double pricePerSeat) {
+    const Timetable& tt = ensureTimetable();
+    const Trip* trip = findTrip(tt, tripID);
+    if (!trip) {
+        return "ERROR:Trip does not exist";
+    }
+    int date, weekday;
+    if (!parseServiceDate(dateText, date, weekday)) {
+        return "ERROR:Invalid date";
+    }
+    if (!(trip->days & (1u << weekday))) {
+        return "ERROR:Trip does not run on " + dateText;
+    }
+    uint32_t boardLeg = 0, alightLeg = trip->legCount - 1;
+    if (!from.empty() || !to.empty()) {
+        int source, target;
+        if (!resolveStops(from, to, source, target) || !tripSegment(tt, *trip, source, target, boardLeg, alightLeg)) {
+            return "ERROR:Trip does not run from " + from + " to " + to;
+        }
+    }
+    // The whole trip keeps its plain seat IDs
+    bool whole = boardLeg == 0 && alightLeg == trip->legCount - 1;
+    uint64_t legs = whole ? WHOLE_TRIP : tripSegmentLegs(boardLeg, alightLeg + 1);
+    
+    lock_guard<mutex> ledger(ledgerMutex);
+    User* user = findUser(userID);
+    if (!user) {
+        return "ERROR:User does not exist";
+    }
+    TripDate key = {trip->tripID, date};
+    const TripSeats* seats = findTripSeats(key);
+    vector<int> claimed;
+    claimed.reserve(seatIDs.size());
+    for (const string& seatID : seatIDs) {
+        string_view seatTrip;
+        int seatDate, index;
+        uint64_t seatLegs;
+        if (!parseTripSeatID(seatID, seatTrip, seatDate, index, seatLegs) || index >= trip->seats ||
+            seatLegs != WHOLE_TRIP) {
+            return "ERROR:Seat " + seatID + " does not exist";
+        }
+        if (seatTrip != tripID || seatDate != date) {
+            return "ERROR:Seat " + seatID + " does not belong to this trip";
+        }
+        bool repeated = find(claimed.begin(), claimed.end(), index) != claimed.end();
+        if (repeated || (seats && !seats->isFree(index, legs))) {
+            return "ERROR:Seat " + seatID + " is not available";
+        }
+        claimed.push_back(index);
+    }
+    
+    uint32_t firstLeg = tt.tripLegs[trip->firstLeg];
+    const Connection& first = tt.connections[tt.tripLegs[trip->firstLeg + boardLeg]];
+    const Connection& last = tt.connections[tt.tripLegs[trip->firstLeg + alightLeg]];
+    string info = routeInfo;
+    if (info.empty()) {
+        info = tripID + " " + dateText + " " + formatClock(first.dep).substr(0, 5) + " " +
+               string(sv(routeGraph.stopNames[first.depStop])) + " → " +
+               string(sv(routeGraph.stopNames[last.arrStop]));
+    }
+    string bookingID = generateBookingID();
+    Sym bookingSym = intern(bookingID);
+    vector<Sym> seatSyms;
+    seatSyms.reserve(seatIDs.size());
+    for (int index : claimed) seatSyms.push_back(intern(makeTripSeatID(tripID, date, index, legs)));
+    double totalPrice = pricePerSeat * seatIDs.size();
+    Booking booking = {
+        bookingSym,
+        tt.connectionRoute[firstLeg],
+        intern(info),
+        user->userID,
+        seatSyms,
+        totalPrice,
+        getCurrentTimestamp(),
+        SYM_ACTIVE
+    };
+    
+    undoSaveBooking(bookingSym);
+    undoSaveUser(user->userID);
+    undoSaveTrip(key);
+    bookings[bookingSym] = booking;
+    reindexBooking(nullptr, booking);
+    for (int index : claimed) {
+        TripSeat seat = {key, {index, legs, user->userID, bookingSym}, false};
+        storeTripSeat(seat);
+        journalTripSeat(seat);
+    }
+    user->totalBookings++;
+    user->totalSpent += totalPrice;
+    
+    journalBooking(booking);
+    journalUser(*user);
+    commitMutation();
+    return bookingID;
+}
+
+bool cancelBooking(const string& bookingID, const string& userID) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    Booking* found = findBooking(bookingID);
+    if (!found) {
+        return false;
+    }
+    
+    Booking& booking = *found;
+    
+    if (sv(booking.userID) != userID) {
+        return false; // User doesn't own this booking
+    }
+    
+    if (booking.status == SYM_CANCELLED) {
+        return false; // Already cancelled
+    }
+    
+    // Free up seats still held by this booking
+    undoSaveBooking(booking.bookingID);
+    for (Sym seatID : booking.seatIDs) {
+        int index, date;
+        string_view tripID;
+        uint64_t legs;
+        if (parseTripSeatID(sv(seatID), tripID, date, index, legs)) {
+            TripDate key = {intern(tripID), date};
+            const TripSeats* seats = findTripSeats(key);
+            if (!seats || !seats->held(index, legs, booking.bookingID)) continue;
+            undoSaveTrip(key);
+            TripSeat freed = {key, {index, legs, booking.userID, booking.bookingID}, true};
+            storeTripSeat(freed);
+            journalTripSeat(freed);
+        } else if (RouteSeats* route = findSeatRoute(sv(seatID), index)) {
+            lock_guard<mutex> seatsLock(routeLock(route->routeID));
+            if (!route->exists(index) || route->bookingIDs[index] != booking.bookingID) continue;
+            undoSaveRoute(route->routeID);
+            route->set(index, SEAT_AVAILABLE, 0, 0);
+            journalSeat(seatRecord(*route, index));
+        }
+    }
+    
+    // Update booking status
+    setBookingStatus(booking, SYM_CANCELLED);
+    journalBooking(booking);
+    
+    // Update user stats
+    User* user = findUser(userID);
+    if (user) {
+        undoSaveUser(user->userID);
+        user->totalSpent -= booking.totalPrice;
+        journalUser(*user);
+    }
+    commitMutation();
+    return true;
+}
+
+// Holds a seat for ttlSeconds. Reserving a seat the user already holds
+// extends the hold. Returns the new deadline, or 0 if the seat can't be held.
+uint32_t reserveSeat(const string& seatID, const string& userID, uint32_t ttlSeconds) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    int index;
+    RouteSeats* route = findSeatRoute(seatID, index);
+    if (!route) {
+        return 0;
+    }
+    
+    uint32_t deadline = holdClock() + ttlSeconds;
+    {
+        lock_guard<mutex> seatsLock(routeLock(route->routeID));
+        if (!route->exists(index)) {
+            return 0;
+        }
+        SeatStatus status = route->status(index);
+        bool renewing = status == SEAT_RESERVED && sv(route->userIDs[index]) == userID;
+        if (status != SEAT_AVAILABLE && !renewing) {
+            return 0;
+        }
+        
+        undoSaveRoute(route->routeID);
+        route->set(index, SEAT_RESERVED, intern(userID), 0, deadline);
+        journalSeat(seatRecord(*route, index));
+        scheduleHold(route->routeID, index, deadline);
+    }
+    commitMutation();
+    return deadline;
+}
+
+bool releaseSeat(const string& seatID, const string& userID) {
+    lock_guard<mutex> ledger(ledgerMutex);
+    int index;
+    RouteSeats* route = findSeatRoute(seatID, index);
+    if (!route) {
+        return false;
+    }
+    
+    {
+        lock_guard<mutex> seatsLock(routeLock(route->routeID));
+        if (!route->exists(index) || sv(route->userIDs[index]) != userID || route->status(index) != SEAT_RESERVED) {
+            return false;
+        }
+        
+        undoSaveRoute(route->routeID);
+        route->set(index, SEAT_AVAILABLE, 0, 0);
+        journalSeat(seatRecord(*route, index));
+    }
+    commitMutation();
+    return true;
+}
+
+// Releases every hold whose deadline has passed and records the releases
+// in the journal. Holds loaded without a deadline get theirs recorded too.
+// Returns the number of holds released.
+int expireHolds() {
+    lock_guard<mutex> ledger(ledgerMutex);
+    vector<HoldTimer> due;
+    vector<pair<int, int>> unstamped;
+    {
+        lock_guard<mutex> lock(holdTimersMutex);
+        holdTimers.advance(holdClock(), [&](const HoldTimer& timer) { due.push_back(timer); });
+        unstamped.swap(unstampedHolds);
+    }
+    if (due.empty() && unstamped.empty()) return 0;
+    
+    int released = 0;
+    for (const HoldTimer& timer : due) {
+        RouteSeats* route = findRouteSeats(timer.routeID);
+        if (!route) continue;
+        lock_guard<mutex> seatsLock(routeLock(route->routeID));
+        // A hold that was released, booked or extended since leaves a stale timer
+        if (!route->exists(timer.index) || route->status(timer.index) != SEAT_RESERVED ||
+            route->holdExpiry(timer.index) != timer.deadline) {
+            continue;
+        }
+        undoSaveRoute(route->routeID);
+        route->set(timer.index, SEAT_AVAILABLE, 0, 0);
+        journalSeat(seatRecord(*route, timer.index));
+        released++;
+    }
+    for (const auto& hold : unstamped) {
+        RouteSeats* route = findRouteSeats(hold.first);
+        if (!route) continue;
+        lock_guard<mutex> seatsLock(routeLock(route->routeID));
+        if (route->exists(hold.second) && route->status(hold.second) == SEAT_RESERVED) {
+            journalSeat(seatRecord(*route, hold.second));
+        }
+    }
+    commitMutation();
+    return released;
+}
+
+// ========================
+// JSON Output Functions
+// ========================
+
+void stringsJSON(JsonWriter& w, const vector<string>& vec) {
+    w.raw("[");
+    for (size_t i = 0; i < vec.size(); i++) {
+        if (i > 0) w.raw(",");
+        w.str(vec[i]);
+    }
+    w.raw("]");
+}
+
+void symsJSON(JsonWriter& w, const vector<Sym>& vec) {
+    w.raw("[");
+    for (size_t i = 0; i < vec.size(); i++) {
+        if (i > 0) w.raw(",");
+        w.str(sv(vec[i]));
+    }
+    w.raw("]");
+}
+
+string vectorToJSON(const vector<string>& vec) {
+    JsonWriter w;
+    stringsJSON(w, vec);
+    return move(w.str());
+}
+
+// One seat object; getAllSeats also names the route.
+void seatJSON(JsonWriter& w, const RouteSeats& route, int i, bool withRouteID) {
+    w.raw("{\"seatID\":\"R").num((long long)route.routeID).raw("S").num((long long)i + 1)
+     .raw("\",\"status\":\"").raw(seatStatusName(route.status(i)))
+     .raw("\",\"userID\":").str(sv(route.userIDs[i]));
+    if (withRouteID) w.raw(",\"routeID\":").num((long long)route.routeID);
+    w.raw(",\"bookingID\":").str(sv(route.bookingIDs[i]));
+    if (uint32_t expiresAt = route.holdExpiry(i)) w.raw(",\"holdExpiresAt\":").num((long long)expiresAt);
+    w.raw("}");
+}
+
+void seatsToJSON(JsonWriter& w, int routeID) {
+    w.raw("[");
+    const RouteSeats* route = findRouteSeats(routeID);
+    bool first = true;
+    for (int i = 0; route && i < route->capacity(); i++) {
+        if (!route->exists(i)) continue;
+        if (!first) w.raw(",");
+        first = false;
+        seatJSON(w, *route, i, false);
+    }
+    w.raw("]");
+}
+
+void userJSON(JsonWriter& w, const User& u) {
+    w.raw("{\"userID\":").str(sv(u.userID))
+     .raw(",\"name\":").str(sv(u.name))
+     .raw(",\"email\":").str(u.email)
+     .raw(",\"totalBookings\":").num((long long)u.totalBookings)
+     .raw(",\"totalSpent\":").num(u.totalSpent, 2)
+     .raw(",\"bookingIDs\":");
+    ensureUserBookings(u.userID);
+    symsJSON(w, indexedBookings(bookingIndex.byUser, u.userID));
+    w.raw("}");
+}
+
+string userToJSON(const string& userID) {
+    const User* found = findUser(userID);
+    if (!found) return "{}";
+    JsonWriter w;
+    userJSON(w, *found);
+    return move(w.str());
+}
+
+void bookingJSON(JsonWriter& w, const Booking& b) {
+    w.raw("{\"bookingID\":").str(sv(b.bookingID))
+     .raw(",\"routeID\":").num((long long)b.routeID)
+     .raw(",\"routeInfo\":").str(sv(b.routeInfo))
+     .raw(",\"userID\":").str(sv(b.userID))
+     .raw(",\"seatIDs\":");
+    symsJSON(w, b.seatIDs);
+    w.raw(",\"totalPrice\":").num(b.totalPrice, 2)
+     .raw(",\"timestamp\":").str(b.timestamp)
+     .raw(",\"status\":").str(sv(b.status))
+     .raw("}");
+}
+
+string bookingToJSON(string_view bookingID) {
+    const Booking* found = findBooking(bookingID);
+    if (!found) return "{}";
+    JsonWriter w;
+    bookingJSON(w, *found);
+    return move(w.str());
+}
+
+void bookingListJSON(JsonWriter& w, const vector<Sym>& bookingIDs) {
+    w.raw("[");
+    for (size_t i = 0; i < bookingIDs.size(); i++) {
+        if (i > 0) w.raw(",");
+        const Booking* booking = findBooking(sv(bookingIDs[i]));
+        if (booking) bookingJSON(w, *booking);
+        else w.raw("{}");
+    }
+    w.raw("]");
+}
+
+void userBookingsToJSON(JsonWriter& w, const string& userID) {
+    const User* user = findUser(userID);
+    if (!user) {
+        w.raw("[]");
+        return;
+    }
+    ensureUserBookings(user->userID);
+    bookingListJSON(w, indexedBookings(bookingIndex.byUser, user->userID));
+}
+
+void routeBookingsToJSON(JsonWriter& w, int routeID) {
+    ensureRouteBookings(routeID);
+    auto it = bookingIndex.byRoute.find(routeID);
+    if (it == bookingIndex.byRoute.end()) w.raw("[]");
+    else bookingListJSON(w, it->second);
+}
+
+// Who is travelling on a route: each active booking with its passenger and
+// seats, plus totals.
+void routeManifestToJSON(JsonWriter& w, int routeID) {
+    ensureRouteBookings(routeID);
+    w.raw("{\"routeID\":").num((long long)routeID).raw(",\"passengers\":[");
+    long long count = 0, seats = 0;
+    auto it = bookingIndex.activeByRoute.find(routeID);
+    if (it != bookingIndex.activeByRoute.end()) {
+        for (Sym bookingID : it->second) {
+            const Booking* booking = findBooking(sv(bookingID));
+            if (!booking) continue;
+            const User* user = findUser(sv(booking->userID));
+            if (count++ > 0) w.raw(",");
+            w.raw("{\"bookingID\":").str(sv(bookingID))
+             .raw(",\"userID\":").str(sv(booking->userID))
+             .raw(",\"name\":").str(user ? sv(user->name) : string_view())
+             .raw(",\"seatIDs\":");
+            symsJSON(w, booking->seatIDs);
+            w.raw("}");
+            seats += booking->seatIDs.size();
+        }
+    }
+    w.raw("],\"bookings\":").num(count).raw(",\"seats\":").num(seats).raw("}");
+}
+
+// "routePath":[...],"totalDistance":..,"totalFare":..,"stops":n for a list
+// of route IDs, shared by findRoute and each findRoutesPareto option.
+void routePathFields(JsonWriter& w, const vector<int>& path) {
+    w.raw("\"routePath\":[");
+    
+    double totalDistance = 0;
+    double totalFare = 0;
+    
+    for (size_t i = 0; i < path.size(); i++) {
+        auto it = allStoredRoutes.find(path[i]);
+        if (it == allStoredRoutes.end()) continue;
+        const Route& route = it->second;
+        if (i > 0) w.raw(",");
+        w.raw("{\"routeID\":").num((long long)route.routeID)
+         .raw(",\"from\":").str(sv(route.from))
+         .raw(",\"to\":").str(sv(route.to))
+         .raw(",\"distance\":").num(route.distance, 2)
+         .raw(",\"ticketPrice\":").num(route.ticketPrice, 2)
+         .raw("}");
+        totalDistance += route.distance;
+        totalFare += route.ticketPrice;
+    }
+    
+    w.raw("],\"totalDistance\":").num(totalDistance, 2)
+     .raw(",\"totalFare\":").num(totalFare, 2)
+     .raw(",\"stops\":").num((long long)path.size());
+}
+
+string networkSeatStatsToJSON() {
+    NetworkSeatStats stats = getNetworkSeatStats();
+    JsonWriter w;
+    w.raw("{\"routes\":").num((long long)stats.routes)
+     .raw(",\"total\":").num(stats.total)
+     .raw(",\"available\":").num(stats.available)
+     .raw(",\"booked\":").num(stats.booked)
+     .raw(",\"reserved\":").num(stats.reserved)
+     .raw("}");
+    return move(w.str());
+}
+
+// Symbol table size and process peak RSS, for sizing large datasets.
+long peakRSSKB() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+string memoryStatsToJSON() {
+    JsonWriter w;
+    w.raw("{\"symbols\":").num((long long)symbols.count())
+     .raw(",\"symbolArenaBytes\":").num((long long)symbols.arena.size())
+     .raw(",\"symbolTableBytes\":").num((long long)symbols.memoryBytes())
+     .raw(",\"users\":").num((long long)users.size())
+     .raw(",\"bookings\":").num((long long)bookings.size())
+     .raw(",\"seatRoutes\":").num((long long)seatInventory.size())
+     .raw(",\"peakRSSKB\":").num((long long)peakRSSKB())
+     .raw("}");
+    return move(w.str());
+}
+
+#ifndef LOGIC_NO_METRICS
+void histogramJSON(JsonWriter& w, const LatencyHistogram& h, bool detailed, double usPerTick) {
+    uint64_t count = h.total.load(memory_order_relaxed);
+    double sumUs = h.sumTicks.load(memory_order_relaxed) * usPerTick;
+    w.raw("{\"count\":").num((long long)count).raw(",\"totalUs\":").num(sumUs, 1);
+    if (detailed && count > 0) {
+        w.raw(",\"meanUs\":").num(sumUs / count, 2)
+         .raw(",\"p50Us\":").num(h.quantile(0.5) * usPerTick, 2)
+         .raw(",\"p90Us\":").num(h.quantile(0.9) * usPerTick, 2)
+         .raw(",\"p99Us\":").num(h.quantile(0.99) * usPerTick, 2)
+         .raw(",\"p999Us\":").num(h.quantile(0.999) * usPerTick, 2);
+    }
+    w.raw(",\"maxUs\":").num(h.maxTicks.load(memory_order_relaxed) * usPerTick, 2).raw("}");
+}
+
+// The members of a metrics object. detailed adds percentiles, for
+// getMetrics; a one-shot process's line only needs counts and totals.
+void metricsFields(JsonWriter& w, bool detailed) {
+    double usPerTick = metrics.nanosPerTick() / 1000.0;
+    w.raw("\"uptimeSeconds\":").num(chrono::duration<double>(chrono::steady_clock::now() - metrics.started).count(), 3).raw(",\"commands\":{");
+    map<string_view, const LatencyHistogram*> sorted;
+    for (const auto& entry : metrics.commands) sorted.emplace(entry.first, entry.second.get());
+    bool first = true;
+    for (const auto& entry : sorted) {
+        if (!first) w.raw(",");
+        first = false;
+        w.str(entry.first).raw(":");
+        histogramJSON(w, *entry.second, detailed, usPerTick);
+    }
+    w.raw("},\"phases\":{");
+    first = true;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (metrics.phases[p].total.load(memory_order_relaxed) == 0) continue;
+        if (!first) w.raw(",");
+        first = false;
+        w.str(PHASE_NAMES[p]).raw(":");
+        histogramJSON(w, metrics.phases[p], detailed, usPerTick);
+    }
+    w.raw("}");
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        w.raw(",").str(COUNTER_NAMES[c]).raw(":").num((long long)metrics.counters[c].load(memory_order_relaxed));
+    }
+    w.raw(",\"peakRSSKB\":").num((long long)peakRSSKB());
+}
+#endif
+
+// Appends this process's metrics to --metrics-file as one JSON line.
+void appendMetricsLine(const char* mode, int status) {
+#ifndef LOGIC_NO_METRICS
+    if (metricsFile.empty()) return;
+    JsonWriter w;
+    w.raw("{\"time\":").str(getCurrentTimestamp());
+#ifndef _WIN32
+    w.raw(",\"pid\":").num((long long)getpid());
+#endif
+    w.raw(",\"mode\":").str(mode)
+     .raw(",\"status\":").num((long long)status).raw(",");
+    metricsFields(w, false);
+    w.raw("}\n");
+    int fd = openForAppend(metricsFile);
+    if (fd < 0) return;
+    writeAll(fd, w.str());
+    closeFile(fd);
+#else
+    (void)mode;
+    (void)status;
+#endif
+}
+
+string seatStatsToJSON(int routeID) {
+    const RouteSeats* route = findRouteSeats(routeID);
+    JsonWriter w;
+    w.raw("{\"routeID\":").num((long long)routeID)
+     .raw(",\"total\":").num((long long)(route ? route->total() : 0))
+     .raw(",\"available\":").num((long long)(route ? route->available : 0))
+     .raw(",\"booked\":").num((long long)(route ? route->bookedCount : 0))
+     .raw(",\"reserved\":").num((long long)(route ? route->reservedCount : 0))
+     .raw("}");
+    return move(w.str());
+}
+
+// ========================
+// JSON Input Parser
+// ========================
+// A request is parsed once, in a single pass, into the members of its
+// top-level object. Values are views into the input; only strings holding
+// escapes are decoded, into a buffer owned by the request. String bodies
+// are scanned 16 bytes at a time for the closing quote or a backslash.
+
+struct Request {
+    struct Member {
+        string_view key;
+        string_view value;       // decoded string, or raw text of anything else
+        bool isString = false;
+        bool isArray = false;
+        uint32_t itemStart = 0;  // array values: elements in items
+        uint32_t itemCount = 0;
+    };
+    vector<Member> members;
+    vector<string_view> items;
+    string decoded; // reserved to the input size up front, so views stay valid
+
+    const Member* find(string_view key) const {
+        for (const Member& m : members) {
+            if (m.key == key) return &m;
+        }
+        return nullptr;
+    }
+
+    // Scalar value as text, "" if absent or null; strings are unescaped.
+    string str(string_view key) const {
+        const Member* m = find(key);
+        if (!m || m->isArray || (!m->isString && m->value == "null")) return string();
+        return string(m->value);
+    }
+
+    vector<string> strings(string_view key) const {
+        vector<string> result;
+        const Member* m = find(key);
+        if (!m) return result;
+        for (uint32_t i = 0; i < m->itemCount; i++) result.emplace_back(items[m->itemStart + i]);
+        return result;
+    }
+};
+
+// First '"' or '\\' in p..end-1, or end.
+const char* scanStringBody(const char* p, const char* end) {
+#ifdef LOGIC_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                  _mm_cmpeq_epi8(chunk, backslash)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\') p++;
+    return p;
+}
+
+// Bit masks of one 64-byte block: bit i describes byte i.
+struct JsonBlockMasks {
+    uint64_t quote, backslash, open, close, comma;
+};
+
+void jsonBlockMasks(const char* p, JsonBlockMasks& m) {
+#ifdef LOGIC_SSE2
+    // '{' and '[' differ only in bit 0x20, as do '}' and ']'
+    const __m128i fold = _mm_set1_epi8(0x20);
+    m = {0, 0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        __m128i folded = _mm_or_si128(chunk, fold);
+        int shift = 16 * i;
+        m.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))) << shift;
+        m.backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))) << shift;
+        m.open |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{'))) << shift;
+        m.close |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))) << shift;
+        m.comma |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(','))) << shift;
+    }
+#else
+    m = {0, 0, 0, 0, 0};
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        switch (p[i]) {
+            case '"': m.quote |= bit; break;
+            case '\\': m.backslash |= bit; break;
+            case '{': case '[': m.open |= bit; break;
+            case '}': case ']': m.close |= bit; break;
+            case ',': m.comma |= bit; break;
+        }
+    }
+#endif
+}
+
+// Bits of characters escaped by a backslash. carry holds whether the
+// first byte of the next block is escaped.
+uint64_t escapedBits(uint64_t backslash, uint64_t& carry) {
+    const uint64_t evenBits = 0x5555555555555555ULL;
+    backslash &= ~carry;
+    uint64_t followsEscape = backslash << 1 | carry;
+    // Runs of backslashes escape the next byte when their length is odd
+    uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+    uint64_t evenRunEnds;
+    carry = __builtin_add_overflow(oddStarts, backslash, &evenRunEnds);
+    return (evenBits ^ (evenRunEnds << 1)) & followsEscape;
+}
+
+// Bit i set when an odd number of bits 0..i are set in x.
+uint64_t prefixXor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Walks JSON text from start (outside any string) 64 bytes at a time and
+// calls visit(position, kind) for every bracket or comma outside strings,
+// with kind '[' for '{' or '[', ']' for '}' or ']', and ','. Stops when
+// visit returns false; returns false if the text ends first.
+template <class Visit>
+bool scanJsonStructure(const char* start, const char* end, Visit visit) {
+    uint64_t escapeCarry = 0, stringCarry = 0;
+    char padded[64];
+    for (const char* block = start; block < end; block += 64) {
+        const char* p = block;
+        if (end - block < 64) {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, end - block);
+            p = padded;
+        }
+        JsonBlockMasks m;
+        jsonBlockMasks(p, m);
+        uint64_t quotes = m.quote;
+        if (m.backslash | escapeCarry) quotes &= ~escapedBits(m.backslash, escapeCarry);
+        uint64_t inString = prefixXor(quotes) ^ stringCarry;
+        stringCarry = (uint64_t)((int64_t)inString >> 63);
+        uint64_t structural = (m.open | m.close | m.comma) & ~inString;
+        while (structural) {
+            int i = __builtin_ctzll(structural);
+            structural &= structural - 1;
+            uint64_t bit = 1ULL << i;
+            char kind = (m.open & bit) ? '[' : (m.close & bit) ? ']' : ',';
+            if (!visit(block + i, kind)) return true;
+        }
+    }
+    return false;
+}
+
+struct JsonCursor {
+    const char* p;
+    const char* end;
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+    bool consume(char c) {
+        skipSpace();
+        if (p == end || *p != c) return false;
+        p++;
+        return true;
+    }
+};
+
+// Parses the string at c.p (which must be at its opening quote). Without
+// escapes out views the input; otherwise it views the decoded copy.
+bool parseJsonString(JsonCursor& c, string& decoded, string_view& out) {
+    const char* start = ++c.p;
+    const char* q = scanStringBody(c.p, c.end);
+    if (q == c.end) return false;
+    if (*q == '"') {
+        out = string_view(start, q - start);
+        c.p = q + 1;
+        return true;
+    }
+    
+    size_t from = decoded.size();
+    decoded.append(start, q - start);
+    while (true) {
+        if (*q == '"') break;
+        // *q is a backslash
+        if (q + 1 >= c.end) return false;
+        char e = q[1];
+        q += 2;
+        switch (e) {
+            case '"': decoded += '"'; break;
+            case '\\': decoded += '\\'; break;
+            case '/': decoded += '/'; break;
+            case 'b': decoded += '\b'; break;
+            case 'f': decoded += '\f'; break;
+            case 'n': decoded += '\n'; break;
+            case 'r': decoded += '\r'; break;
+            case 't': decoded += '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (!parseHex4(q, c.end, cp)) return false;
+                q += 4;
+                // A surrogate pair encodes one code point above U+FFFF
+                uint32_t low;
+                if (cp >= 0xD800 && cp < 0xDC00 && c.end - q >= 6 && q[0] == '\\' && q[1] == 'u' &&
+                    parseHex4(q + 2, c.end, low) && low >= 0xDC00 && low < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    q += 6;
+                }
+                appendUTF8(decoded, cp);
+                break;
+            }
+            default: return false;
+        }
+        const char* next = scanStringBody(q, c.end);
+        if (next == c.end) return false;
+        decoded.append(q, next - q);
+        q = next;
+    }
+    out = string_view(decoded.data() + from, decoded.size() - from);
+    c.p = q + 1;
+    return true;
+}
+
+// Steps over one value of any kind without decoding it.
+bool skipJsonValue(JsonCursor& c) {
+    c.skipSpace();
+    if (c.p == c.end) return false;
+    if (*c.p == '"') {
+        const char* q = c.p + 1;
+        while (true) {
+            q = scanStringBody(q, c.end);
+            if (q == c.end) return false;
+            if (*q == '"') break;
+            q += 2; // escaped character
+            if (q > c.end) return false;
+        }
+        c.p = q + 1;
+        return true;
+    }
+    if (*c.p == '{' || *c.p == '[') {
+        int depth = 0;
+        const char* close = nullptr;
+        scanJsonStructure(c.p, c.end, [&](const char* pos, char kind) {
+            if (kind == '[') depth++;
+            else if (kind == ']' && --depth == 0) close = pos;
+            return close == nullptr;
+        });
+        if (!close) return false;
+        c.p = close + 1;
+        return true;
+    }
+    const char* start = c.p;
+    while (c.p < c.end && !strchr(",}] \t\r\n", *c.p)) c.p++;
+    return c.p > start;
+}
+
+// Parses one value into a view: strings decoded, anything else raw.
+bool parseJsonValue(JsonCursor& c, string& decoded, string_view& out, bool& isString) {
+    c.skipSpace();
+    if (c.p == c.end) return false;
+    isString = *c.p == '"';
+    if (isString) return parseJsonString(c, decoded, out);
+    const char* start = c.p;
+    if (!skipJsonValue(c)) return false;
+    out = string_view(start, c.p - start);
+    return true;
+}
+
+// Parses a JSON object into req; false if input is not one.
+bool parseRequest(string_view input, Request& req) {
+    req.members.clear();
+    req.items.clear();
+    req.decoded.clear();
+    req.decoded.reserve(input.size());
+    JsonCursor c = {input.data(), input.data() + input.size()};
+    if (!c.consume('{')) return false;
+    if (c.consume('}')) return true;
+    do {
+        c.skipSpace();
+        Request::Member m;
+        if (c.p == c.end || *c.p != '"' || !parseJsonString(c, req.decoded, m.key)) return false;
+        if (!c.consume(':')) return false;
+        c.skipSpace();
+        if (c.p != c.end && *c.p == '[') {
+            const char* start = c.p++;
+            m.isArray = true;
+            m.itemStart = (uint32_t)req.items.size();
+            if (!c.consume(']')) {
+                do {
+                    string_view item;
+                    bool isString;
+                    if (!parseJsonValue(c, req.decoded, item, isString)) return false;
+                    req.items.push_back(item);
+                } while (c.consume(','));
+                if (!c.consume(']')) return false;
+            }
+            m.itemCount = (uint32_t)req.items.size() - m.itemStart;
+            m.value = string_view(start, c.p - start);
+        } else if (!parseJsonValue(c, req.decoded, m.value, m.isString)) {
+            return false;
+        }
+        req.members.push_back(m);
+    } while (c.consume(','));
+    return c.consume('}');
+}
+
+// ========================
+// Paged Listings
+// ========================
+// getAllSeats, getAllBookings and getAllUsers walk their tables in key
+// order: route then seat, bookingID, userID. A ListQuery holds the filters
+// and the last key examined, so a listing can be written in one go, cut
+// into pages with an opaque cursor, or produced a few records at a time by
+// the daemons so a large table is never held in memory as one response.
+
+enum ListTable { LIST_SEATS, LIST_BOOKINGS, LIST_USERS };
+
+// Records a socket listing adds per step, and the queued output it stops at
+const size_t LIST_PUMP_ITEMS = 256;
+const size_t LIST_PUMP_BYTES = 1 << 16;
+
+struct ListQuery {
+    ListTable table = LIST_SEATS;
+    int routeID = -1;       // filters, seats and bookings only; -1 or
+    int seatStatus = -1;    // unset match everything
+    bool byStatus = false;
+    Sym bookingStatus = 0;
+    bool byUser = false;
+    Sym userID = 0;
+    size_t limit = 0;       // records per page, 0 for all
+    bool paged = false;     // limit or cursor given: {"items":..,"nextCursor":..}
+    bool stream = false;    // one record per line, then a summary line
+    bool started = false;   // position: the records after this key
+    int afterRoute = 0;
+    int afterSeat = 0;
+    Sym afterKey = 0;
+    string afterText;       // a cursor key that is no symbol, until passed
+    size_t emitted = 0;
+    bool done = false;      // reached the end of the table
+    
+    bool finished() const { return done || (limit > 0 && emitted >= limit); }
+};
+
+const char* listCursorTag(ListTable table) {
+    return table == LIST_SEATS ? "s:" : table == LIST_BOOKINGS ? "b:" : "u:";
+}
+
+// Cursors are the hex of "<table>:<last key>", so they survive any JSON
+// or URL quoting and are rejected by the other listings.
+string encodeListCursor(const ListQuery& q) {
+    string key = listCursorTag(q.table);
+    if (q.table == LIST_SEATS) key += to_string(q.afterRoute) + ":" + to_string(q.afterSeat);
+    else key += q.afterText.empty() ? sv(q.afterKey) : string_view(q.afterText);
+    static const char hex[] = "0123456789abcdef";
+    string cursor;
+    cursor.reserve(key.size() * 2);
+    for (unsigned char c : key) {
+        cursor += hex[c >> 4];
+        cursor += hex[c & 15];
+    }
+    return cursor;
+}
+
+bool decodeListCursor(string_view cursor, ListQuery& q) {
+    if (cursor.size() % 2 != 0) return false;
+    string key;
+    for (size_t i = 0; i < cursor.size(); i += 2) {
+        int digits[2];
+        for (int j = 0; j < 2; j++) {
+            char c = cursor[i + j];
+            digits[j] = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (digits[j] < 0) return false;
+        }
+        key += (char)(digits[0] << 4 | digits[1]);
+    }
+    if (key.compare(0, 2, listCursorTag(q.table)) != 0) return false;
+    
+    if (q.table == LIST_SEATS) {
+        const char* p = key.data() + 2;
+        const char* end = key.data() + key.size();
+        auto route = from_chars(p, end, q.afterRoute);
+        if (route.ec != errc() || route.ptr == end || *route.ptr != ':') return false;
+        auto seat = from_chars(route.ptr + 1, end, q.afterSeat);
+        if (seat.ec != errc() || seat.ptr != end) return false;
+    } else {
+        // Client input: don't grow the symbol table with it
+        string_view after = string_view(key).substr(2);
+        if (!symbols.lookup(after, q.afterKey)) q.afterText = string(after);
+    }
+    q.started = true;
+    return true;
+}
+
+// A routeID from a request: a whole number, present.
+bool parseRouteID(string_view text, int& routeID) {
+    return parseNumber(text, routeID);
+}
+
+bool parseListQuery(const Request& req, ListTable table, ListQuery& q, string& error) {
+    q.table = table;
+    string limitStr = req.str("limit");
+    string cursor = req.str("cursor");
+    q.stream = req.str("stream") == "true";
+    q.paged = !limitStr.empty() || !cursor.empty();
+    if (!limitStr.empty()) {
+        long long limit;
+        if (!parseNumber(limitStr, limit) || limit <= 0) {
+            error = "Invalid limit";
+            return false;
+        }
+        q.limit = (size_t)limit;
+    }
+    if (!cursor.empty() && !decodeListCursor(cursor, q)) {
+        error = "Invalid cursor";
+        return false;
+    }
+    if (table == LIST_USERS) return true;
+    
+    string routeIDStr = req.str("routeID");
+    string status = req.str("status");
+    string userID = req.str("userID");
+    // A negative routeID would read as "no filter"
+    if (!routeIDStr.empty() && (!parseRouteID(routeIDStr, q.routeID) || q.routeID < 0)) {
+        error = "Invalid routeID";
+        return false;
+    }
+    if (!status.empty()) {
+        if (table == LIST_SEATS) {
+            q.seatStatus = parseSeatStatus(status);
+            if (status != seatStatusName((SeatStatus)q.seatStatus)) {
+                error = "Unknown status: " + status;
+                return false;
+            }
+        } else {
+            q.byStatus = true;
+            // A status no booking has matches nothing
+            if (!symbols.lookup(status, q.bookingStatus)) q.done = true;
+        }
+    }
+    if (!userID.empty()) {
+        q.byUser = true;
+        if (!symbols.lookup(userID, q.userID)) q.done = true;
+    }
+    return true;
+}
+
+// Commas between records in an array, a newline after each when streaming.
+void writeListRecordStart(ListQuery& q, JsonWriter& w) {
+    if (!q.stream && q.emitted > 0) w.raw(",");
+}
+
+void writeListRecordEnd(ListQuery& q, JsonWriter& w) {
+    if (q.stream) w.raw("\n");
+    q.emitted++;
+}
+
+// Where a users or bookings listing picks up: after the cursor's key.
+template <class Table>
+typename Table::iterator listResume(Table& table, const ListQuery& q) {
+    if (!q.started) return table.begin();
+    if (!q.afterText.empty()) return table.upper_bound(string_view(q.afterText));
+    return table.upper_bound(q.afterKey);
+}
+
+// Writes up to maxItems more matching records and moves q past them.
+void writeListItems(ListQuery& q, JsonWriter& w, size_t maxItems) {
+    size_t written = 0;
+    auto room = [&]() { return written < maxItems && !q.finished(); };
+    
+    if (q.table == LIST_SEATS) {
+        if (q.routeID >= 0) ensureRouteSeats(q.routeID);
+        else ensureAllSeats();
+        auto it = q.started ? seatInventory.lower_bound(q.afterRoute) : seatInventory.begin();
+        while (it != seatInventory.end() && room()) {
+            if (q.routeID >= 0 && it->first != q.routeID) {
+                it = it->first < q.routeID ? seatInventory.lower_bound(q.routeID) : seatInventory.end();
+                continue;
+            }
+            const RouteSeats& route = it->second;
+            int i = q.started && it->first == q.afterRoute ? q.afterSeat + 1 : 0;
+            for (; i < route.capacity() && room(); i++) {
+                if (!route.exists(i)) continue;
+                if (q.seatStatus >= 0 && route.status(i) != q.seatStatus) continue;
+                if (q.byUser && route.userIDs[i] != q.userID) continue;
+                writeListRecordStart(q, w);
+                seatJSON(w, route, i, true);
+                writeListRecordEnd(q, w);
+                written++;
+            }
+            q.started = true;
+            q.afterRoute = it->first;
+            q.afterSeat = i - 1;
+            if (i < route.capacity()) break;
+            ++it;
+        }
+        if (it == seatInventory.end()) q.done = true;
+    } else if (q.table == LIST_BOOKINGS) {
+        ensureAllBookings();
+        auto it = listResume(bookings, q);
+        for (; it != bookings.end() && room(); ++it) {
+            const Booking& b = it->second;
+            q.started = true;
+            q.afterKey = it->first;
+            q.afterText.clear();
+            if (q.routeID >= 0 && b.routeID != q.routeID) continue;
+            if (q.byStatus && b.status != q.bookingStatus) continue;
+            if (q.byUser && b.userID != q.userID) continue;
+            writeListRecordStart(q, w);
+            bookingJSON(w, b);
+            writeListRecordEnd(q, w);
+            written++;
+        }
+        if (it == bookings.end()) q.done = true;
+    } else {
+        ensureAllUsers();
+        ensureBookingIndex(); // for every user's bookingIDs
+        auto it = listResume(users, q);
+        for (; it != users.end() && room(); ++it) {
+            q.started = true;
+            q.afterKey = it->first;
+            q.afterText.clear();
+            writeListRecordStart(q, w);
+            userJSON(w, it->second);
+            writeListRecordEnd(q, w);
+            written++;
+        }
+        if (it == users.end()) q.done = true;
+    }
+}
+
+void writeListHead(const ListQuery& q, JsonWriter& w) {
+    if (!q.stream) w.raw(q.paged ? "{\"items\":[" : "[");
+}
+
+// Closes the listing; the cursor is null once the table is exhausted.
+void writeListTail(const ListQuery& q, JsonWriter& w) {
+    if (!q.stream && !q.paged) {
+        w.raw("]");
+        return;
+    }
+    w.raw(q.stream ? "{\"done\":true" : "]").raw(",\"count\":").num((long long)q.emitted)
+     .raw(",\"nextCursor\":");
+    if (q.done) w.raw("null");
+    else w.str(encodeListCursor(q));
+    w.raw("}");
+}
+
+void writeList(ListQuery& q, JsonWriter& w) {
+    writeListHead(q, w);
+    writeListItems(q, w, SIZE_MAX);
+    writeListTail(q, w);
+}
+
+// ========================
+// Command Processor
+// ========================
+
+// Returned when a listing was handed back through processCommand's
+// deferred argument instead of being written
+const int COMMAND_DEFERRED = 2;
+
+// getAllSeats/getAllBookings/getAllUsers, written to out or, when the
+// caller can produce it incrementally, left in *deferred.
+int listCommand(const Request& req, ListTable table, ostream& out, ListQuery* deferred) {
+    ListQuery q;
+    string error;
+    if (!parseListQuery(req, table, q, error)) {
+        out << errorJSON(error) << endl;
+        return 1;
+    }
+    if (deferred) {
+        *deferred = q;
+        return COMMAND_DEFERRED;
+    }
+    {
+        JsonWriter w(&out);
+        writeList(q, w);
+    }
+    out << endl;
+    return 0;
+}
+
+// Data a command reads as a whole, loaded before it runs. Anything else is
+// loaded on first access: findUser, findBooking and findRouteSeats read
+// single records through the snapshot or the text index, and listings
+// load what their filters need.
+enum CommandNeeds { NEEDS_ROUTES = 1, NEEDS_USERS = 2, NEEDS_BOOKINGS = 4, NEEDS_SEATS = 8 };
+
+int commandNeeds(string_view cmd) {
+    static const unordered_map<string_view, int> needs = {
+        {"findRoute", NEEDS_ROUTES},
+        {"findRoutesPareto", NEEDS_ROUTES},
+        {"suggestStops", NEEDS_ROUTES},
+        {"getRouteCacheStats", NEEDS_ROUTES},
+        {"nearestStops", NEEDS_ROUTES},
+        {"getAllUsers", NEEDS_USERS},
+        {"getAllBookings", NEEDS_BOOKINGS},
+        {"getNetworkSeatStats", NEEDS_SEATS},
+        {"initAllSeats", NEEDS_ROUTES},
+        {"findTrip", NEEDS_ROUTES},
+        {"findTripProfile", NEEDS_ROUTES},
+        {"getTripSeats", NEEDS_ROUTES},
+        {"bookTripSeats", NEEDS_ROUTES},
+    };
+    auto it = needs.find(cmd);
+    return it == needs.end() ? 0 : it->second;
+}
+
+void loadCommandNeeds(int needs) {
+    if (needs & NEEDS_ROUTES) ensureRoutes();
+    if (needs & NEEDS_USERS) ensureAllUsers();
+    if (needs & NEEDS_BOOKINGS) ensureAllBookings();
+    if (needs & NEEDS_SEATS) ensureAllSeats();
+}
+
+// A seat count from a request: a whole number from 1 to MAX_ROUTE_SEATS.
+bool parseSeatCount(string_view text, int& seats) {
+    return parseNumber(text, seats) && seats > 0 && seats <= MAX_ROUTE_SEATS;
+}
+
+// from, to, date and time of a findTrip or findTripProfile request; date
+// and time default to now. Returns an error message, empty if none.
+struct TripQuery {
+    int source;
+    int target;
+    int date;
+    int weekday;
+    int32_t time;
+};
+
+string parseTripQuery(const Request& req, TripQuery& q) {
+    if (!resolveStops(req.str("from"), req.str("to"), q.source, q.target)) return "Unknown stop";
+    string date = req.str("date"), time = req.str("time");
+    string today;
+    int32_t now;
+    localDateTime(today, now);
+    if (!parseServiceDate(date.empty() ? today : date, q.date, q.weekday)) return "Invalid date";
+    q.time = now;
+    if (!time.empty() && !parseClock(time, q.time)) return "Invalid time";
+    return string();
+}
+
+// Runs a single JSON command against the in-memory state and writes the
+// one-line JSON response to out. Returns the process exit code. Daemons
+// pass deferred to stream listings themselves.
+int processCommand(string_view input, ostream& out, ListQuery* deferred = nullptr) {
+    METRIC_COMMAND_START();
+    METRIC_COUNT(COUNT_BYTES_READ, input.size());
+    Request req;
+    if (!parseRequest(input, req)) {
+        out << "{\"error\":\"Invalid JSON\"}" << endl;
+        return 1;
+    }
+    string cmd = req.str("cmd");
+    
+    if (cmd.empty()) {
+        out << "{\"error\":\"No command specified\"}" << endl;
+        return 1;
+    }
+    METRIC_COMMAND(cmd);
+    loadCommandNeeds(commandNeeds(cmd));
+    
+    // User Management Commands
+    if (cmd == "createUser") {
+        string userID = req.str("userID");
+        string name = req.str("name");
+        string email = req.str("email");
+        
+        if (createUser(userID, name, email)) {
+            out << "{\"success\":true,\"user\":" << userToJSON(userID) << "}" << endl;
+        } else {
+            out << "{\"error\":\"User already exists\"}" << endl;
         }
     }
     else if (cmd == "updateUser") {
-        string userID = extractValue(input, "userID");
-        string name = extractValue(input, "name");
-        string email = extractValue(input, "email");
+        string userID = req.str("userID");
+        string name = req.str("name");
+        string email = req.str("email");
         
         if (updateUser(userID, name, email)) {
-            cout << "{\"success\":true,\"user\":" << userToJSON(userID) << "}" << endl;
+            out << "{\"success\":true,\"user\":" << userToJSON(userID) << "}" << endl;
         } else {
-            cout << "{\"error\":\"User not found\"}" << endl;
+            out << "{\"error\":\"User not found\"}" << endl;
         }
     }
     else if (cmd == "getUser") {
-        string userID = extractValue(input, "userID");
+        string userID = req.str("userID");
         string result = userToJSON(userID);
         if (result == "{}") {
-            cout << "{\"error\":\"User not found\"}" << endl;
+            out << "{\"error\":\"User not found\"}" << endl;
         } else {
-            cout << result << endl;
+            out << result << endl;
         }
     }
     else if (cmd == "getAllUsers") {
-        cout << allUsersToJSON() << endl;
+        return listCommand(req, LIST_USERS, out, deferred);
     }
     
     // Seat Management Commands
     else if (cmd == "initSeats") {
-        string routeIDStr = extractValue(input, "routeID");
+        string routeIDStr = req.str("routeID");
         int routeID = routeIDStr.empty() ? 1 : stoi(routeIDStr);
-        initializeSeatsForRoute(routeID);
-        // Persist seat state after initialization so subsequent calls see it
-        saveSeatState();
-        cout << "{\"success\":true,\"message\":\"Seats initialized for route " << routeID << "\"}" << endl;
+        string seatsStr = req.str("seats");
+        int totalSeats = DEFAULT_ROUTE_SEATS;
+        if (!seatsStr.empty() && !parseSeatCount(seatsStr, totalSeats)) {
+            out << "{\"error\":\"Invalid seat count\"}" << endl;
+        } else {
+            int held = initializeSeatsForRoute(routeID, totalSeats);
+            out << "{\"success\":true,\"message\":\"Seats initialized for route " << routeID
+                << "\",\"held\":" << held << "}" << endl;
+        }
+    }
+    else if (cmd == "initAllSeats") {
+        // {"seats":40,"capacities":{"3":52}}: only routes without seats
+        string seatsStr = req.str("seats");
+        int defaultSeats = DEFAULT_ROUTE_SEATS;
+        unordered_map<int, int> capacities;
+        bool valid = seatsStr.empty() || parseSeatCount(seatsStr, defaultSeats);
+        const Request::Member* caps = req.find("capacities");
+        if (valid && caps && caps->value != "null") {
+            Request perRoute;
+            valid = !caps->isString && !caps->isArray && parseRequest(caps->value, perRoute);
+            for (size_t i = 0; valid && i < perRoute.members.size(); i++) {
+                const Request::Member& m = perRoute.members[i];
+                int routeID, seats;
+                auto r = from_chars(m.key.data(), m.key.data() + m.key.size(), routeID);
+                valid = r.ec == errc() && r.ptr == m.key.data() + m.key.size() && parseSeatCount(m.value, seats);
+                if (valid) capacities[routeID] = seats;
+            }
+        }
+        if (!valid) {
+            out << "{\"error\":\"Invalid seat count\"}" << endl;
+        } else {
+            vector<int> created = initializeMissingSeats(capacities, defaultSeats);
+            {
+                JsonWriter w(&out);
+                w.raw("{\"success\":true,\"initialized\":[");
+                for (size_t i = 0; i < created.size(); i++) {
+                    if (i > 0) w.raw(",");
+                    w.num((long long)created[i]);
+                }
+                w.raw("],\"routes\":").num((long long)allStoredRoutes.size()).raw("}");
+            }
+            out << endl;
+        }
     }
     else if (cmd == "getSeats") {
-        string routeIDStr = extractValue(input, "routeID");
+        string routeIDStr = req.str("routeID");
         int routeID = routeIDStr.empty() ? 1 : stoi(routeIDStr);
-        cout << seatsToJSON(routeID) << endl;
+        { JsonWriter w(&out); seatsToJSON(w, routeID); }
+        out << endl;
     }
     else if (cmd == "getAllSeats") {
-        cout << allSeatsToJSON() << endl;
+        return listCommand(req, LIST_SEATS, out, deferred);
     }
     else if (cmd == "getSeatStats") {
-        string routeIDStr = extractValue(input, "routeID");
+        string routeIDStr = req.str("routeID");
         int routeID = routeIDStr.empty() ? 1 : stoi(routeIDStr);
-        cout << seatStatsToJSON(routeID) << endl;
+        out << seatStatsToJSON(routeID) << endl;
+    }
+    else if (cmd == "getNetworkSeatStats") {
+        out << networkSeatStatsToJSON() << endl;
+    }
+    else if (cmd == "getRouteCacheStats") {
+        out << routeCacheStatsToJSON() << endl;
+    }
+    else if (cmd == "getMemoryStats") {
+        out << memoryStatsToJSON() << endl;
+    }
+    else if (cmd == "getMetrics") {
+#ifndef LOGIC_NO_METRICS
+        {
+            JsonWriter w(&out);
+            w.raw("{");
+            metricsFields(w, true);
+            w.raw("}");
+        }
+        out << endl;
+        if (req.str("reset") == "true") metrics.reset();
+#else
+        out << "{\"error\":\"Metrics are not built in\"}" << endl;
+#endif
     }
     else if (cmd == "getAvailableSeats") {
-        string routeIDStr = extractValue(input, "routeID");
+        string routeIDStr = req.str("routeID");
         int routeID = routeIDStr.empty() ? 1 : stoi(routeIDStr);
         vector<string> available = getAvailableSeats(routeID);
-        cout << vectorToJSON(available) << endl;
+        out << vectorToJSON(available) << endl;
     }
     else if (cmd == "getBookedSeats") {
-        string routeIDStr = extractValue(input, "routeID");
+        string routeIDStr = req.str("routeID");
         int routeID = routeIDStr.empty() ? 1 : stoi(routeIDStr);
         vector<string> booked = getBookedSeats(routeID);
-        cout << vectorToJSON(booked) << endl;
+        out << vectorToJSON(booked) << endl;
     }
     
     // Booking Commands
     else if (cmd == "bookSeats") {
-        string routeIDStr = extractValue(input, "routeID");
-        string routeInfo = extractValue(input, "routeInfo");
-        string userID = extractValue(input, "userID");
-        string priceStr = extractValue(input, "pricePerSeat");
-        vector<string> seatIDs = extractArray(input, "seatIDs");
+        string routeIDStr = req.str("routeID");
+        string routeInfo = req.str("routeInfo");
+        string userID = req.str("userID");
+        string priceStr = req.str("pricePerSeat");
+        vector<string> seatIDs = req.strings("seatIDs");
         
         int routeID = stoi(routeIDStr);
         double pricePerSeat = stod(priceStr);
@@ -861,105 +6347,1079 @@ int main(int argc, char* argv[]) {
         string result = bookSeats(routeID, routeInfo, userID, seatIDs, pricePerSeat);
         
         if (result.substr(0, 6) == "ERROR:") {
-            cout << "{\"error\":\"" << result.substr(6) << "\"}" << endl;
+            out << errorJSON(string_view(result).substr(6)) << endl;
+        } else {
+            out << "{\"success\":true,\"bookingID\":\"" << result << "\","
+                 << "\"booking\":" << bookingToJSON(result) << "}" << endl;
+        }
+    }
+    else if (cmd == "bookTripSeats") {
+        string tripID = req.str("tripID");
+        string date = req.str("date");
+        string routeInfo = req.str("routeInfo");
+        string userID = req.str("userID");
+        string priceStr = req.str("pricePerSeat");
+        vector<string> seatIDs = req.strings("seatIDs");
+        
+        double pricePerSeat = stod(priceStr);
+        string result = bookTripSeats(tripID, date, req.str("from"), req.str("to"), routeInfo, userID, seatIDs,
+                                      pricePerSeat);
+        
+        if (result.substr(0, 6) == "ERROR:") {
+            out << errorJSON(string_view(result).substr(6)) << endl;
         } else {
-            cout << "{\"success\":true,\"bookingID\":\"" << result << "\","
+            out << "{\"success\":true,\"bookingID\":\"" << result << "\","
                  << "\"booking\":" << bookingToJSON(result) << "}" << endl;
         }
     }
     else if (cmd == "cancelBooking") {
-        string bookingID = extractValue(input, "bookingID");
-        string userID = extractValue(input, "userID");
+        string bookingID = req.str("bookingID");
+        string userID = req.str("userID");
         
         if (cancelBooking(bookingID, userID)) {
-            cout << "{\"success\":true,\"message\":\"Booking cancelled successfully\"}" << endl;
+            out << "{\"success\":true,\"message\":\"Booking cancelled successfully\"}" << endl;
         } else {
-            cout << "{\"error\":\"Cannot cancel booking\"}" << endl;
+            out << "{\"error\":\"Cannot cancel booking\"}" << endl;
         }
     }
     else if (cmd == "getBooking") {
-        string bookingID = extractValue(input, "bookingID");
+        string bookingID = req.str("bookingID");
         string result = bookingToJSON(bookingID);
         if (result == "{}") {
-            cout << "{\"error\":\"Booking not found\"}" << endl;
+            out << "{\"error\":\"Booking not found\"}" << endl;
         } else {
-            cout << result << endl;
+            out << result << endl;
         }
     }
     else if (cmd == "getAllBookings") {
-        cout << allBookingsToJSON() << endl;
+        return listCommand(req, LIST_BOOKINGS, out, deferred);
     }
     else if (cmd == "getUserBookings") {
-        string userID = extractValue(input, "userID");
-        cout << userBookingsToJSON(userID) << endl;
+        string userID = req.str("userID");
+        { JsonWriter w(&out); userBookingsToJSON(w, userID); }
+        out << endl;
+    }
+    else if (cmd == "getRouteBookings") {
+        int routeID;
+        if (!parseRouteID(req.str("routeID"), routeID)) {
+            out << "{\"error\":\"Invalid routeID\"}" << endl;
+            return 1;
+        }
+        { JsonWriter w(&out); routeBookingsToJSON(w, routeID); }
+        out << endl;
+    }
+    else if (cmd == "getRouteManifest") {
+        int routeID;
+        if (!parseRouteID(req.str("routeID"), routeID)) {
+            out << "{\"error\":\"Invalid routeID\"}" << endl;
+            return 1;
+        }
+        { JsonWriter w(&out); routeManifestToJSON(w, routeID); }
+        out << endl;
     }
     
     // Seat Reservation Commands
     else if (cmd == "reserveSeat") {
-        string seatID = extractValue(input, "seatID");
-        string userID = extractValue(input, "userID");
+        string seatID = req.str("seatID");
+        string userID = req.str("userID");
+        string ttlStr = req.str("ttlSeconds");
+        long long ttl = ttlStr.empty() ? RESERVATION_DEFAULT_TTL : stoll(ttlStr);
+        ttl = min<long long>(max<long long>(ttl, 1), RESERVATION_MAX_TTL);
         
-        if (reserveSeat(seatID, userID)) {
-            cout << "{\"success\":true,\"message\":\"Seat reserved\"}" << endl;
+        if (uint32_t expiresAt = reserveSeat(seatID, userID, (uint32_t)ttl)) {
+            out << "{\"success\":true,\"message\":\"Seat reserved\",\"expiresAt\":" << expiresAt << "}" << endl;
         } else {
-            cout << "{\"error\":\"Cannot reserve seat\"}" << endl;
+            out << "{\"error\":\"Cannot reserve seat\"}" << endl;
         }
     }
     else if (cmd == "releaseSeat") {
-        string seatID = extractValue(input, "seatID");
-        string userID = extractValue(input, "userID");
+        string seatID = req.str("seatID");
+        string userID = req.str("userID");
         
         if (releaseSeat(seatID, userID)) {
-            cout << "{\"success\":true,\"message\":\"Seat released\"}" << endl;
+            out << "{\"success\":true,\"message\":\"Seat released\"}" << endl;
         } else {
-            cout << "{\"error\":\"Cannot release seat\"}" << endl;
+            out << "{\"error\":\"Cannot release seat\"}" << endl;
+        }
+    }
+    
+    else if (cmd == "suggestStops") {
+        string query = req.str("query");
+        string limitStr = req.str("limit");
+        int limit = limitStr.empty() ? SUGGEST_DEFAULT_LIMIT : stoi(limitStr);
+        limit = max(1, min(limit, SUGGEST_MAX_LIMIT));
+        out << suggestStopsToJSON(query, limit) << endl;
+    }
+    
+    else if (cmd == "nearestStops") {
+        string latStr = req.str("lat");
+        string lngStr = req.str("lng");
+        string kStr = req.str("k");
+        string radiusStr = req.str("radiusKm");
+        if (latStr.empty() || lngStr.empty()) {
+            out << "{\"error\":\"Missing lat or lng\"}" << endl;
+            return 1;
         }
+        Coordinate at = {stod(latStr), stod(lngStr)};
+        if (!(at.lat >= -90 && at.lat <= 90 && at.lng >= -180 && at.lng <= 180)) {
+            out << "{\"error\":\"Invalid coordinates\"}" << endl;
+            return 1;
+        }
+        double radiusKm = radiusStr.empty() ? -1 : stod(radiusStr);
+        // A radius search returns everything in range unless k is given
+        int k = !kStr.empty() ? stoi(kStr) : radiusStr.empty() ? NEAREST_DEFAULT_K : NEAREST_MAX_K;
+        k = max(1, min(k, NEAREST_MAX_K));
+        out << nearestStopsToJSON(at, (size_t)k, radiusKm) << endl;
     }
     
     else if (cmd == "findRoute") {
-        string from = extractValue(input, "from");
-        string to = extractValue(input, "to");
+        string from = req.str("from");
+        string to = req.str("to");
+        string criteriaStr = req.str("criteria");
+        
+        RouteCriteria criteria = BY_DISTANCE;
+        if (criteriaStr == "ticketPrice") criteria = BY_PRICE;
+        else if (!criteriaStr.empty() && criteriaStr != "distance") {
+            out << errorJSON("Unknown criteria: " + criteriaStr) << endl;
+            return 1;
+        }
         
-        vector<int> path = findRoutePath(from, to);
+        string key = routeCacheKey(from, to, criteria);
+        if (const string* cached = routeCacheGet(key)) {
+            out << *cached << endl;
+            return 0;
+        }
         
+        vector<int> path = findRoutePath(from, to, criteria);
+        string response;
         if (path.empty()) {
-            cout << "{\"error\":\"No route found\"}" << endl;
+            response = "{\"error\":\"No route found\"}";
         } else {
-            ostringstream oss;
-            oss << "{\"success\":true,\"routePath\":[";
-            
-            double totalDistance = 0;
-            double totalFare = 0;
-            
-            for (size_t i = 0; i < path.size(); i++) {
-                int routeID = path[i];
-                if (allStoredRoutes.find(routeID) != allStoredRoutes.end()) {
-                    Route& route = allStoredRoutes[routeID];
-                    if (i > 0) oss << ",";
-                    oss << "{\"routeID\":" << routeID 
-                        << ",\"from\":\"" << route.from << "\""
-                        << ",\"to\":\"" << route.to << "\""
-                        << ",\"distance\":" << fixed << setprecision(2) << route.distance
-                        << ",\"ticketPrice\":" << fixed << setprecision(2) << route.ticketPrice
-                        << "}";
-                    totalDistance += route.distance;
-                    totalFare += route.ticketPrice;
+            JsonWriter w;
+            w.raw("{\"success\":true,");
+            routePathFields(w, path);
+            w.raw("}");
+            response = move(w.str());
+        }
+        routeCachePut(key, response);
+        out << response << endl;
+    }
+    
+    else if (cmd == "findTrip") {
+        TripQuery q;
+        string error = parseTripQuery(req, q);
+        const Timetable& tt = ensureTimetable();
+        vector<TripLeg> legs;
+        int32_t arrival = NO_TIME;
+        if (error.empty()) arrival = earliestArrival(tt, q.source, q.target, q.time, q.weekday, legs);
+        if (!error.empty()) {
+            out << errorJSON(error) << endl;
+        } else if (arrival == NO_TIME) {
+            out << "{\"error\":\"No trip found\"}" << endl;
+        } else {
+            {
+                JsonWriter w(&out);
+                w.raw("{\"success\":true,\"date\":").str(formatServiceDate(q.date)).raw(",");
+                journeyFields(w, tt, q.date, tt.connections[legs[0].board].dep, arrival, legs);
+                w.raw("}");
+            }
+            out << endl;
+        }
+    }
+    else if (cmd == "findTripProfile") {
+        TripQuery q;
+        string error = parseTripQuery(req, q);
+        string until = req.str("until");
+        int32_t end = q.time + 3600; // an hour's departures unless told otherwise
+        if (error.empty() && !until.empty() && (!parseClock(until, end) || end < q.time)) error = "Invalid until";
+        const Timetable& tt = ensureTimetable();
+        vector<ProfileJourney> options;
+        if (error.empty()) options = profileJourneys(tt, q.source, q.target, q.time, end, q.weekday);
+        if (!error.empty()) {
+            out << errorJSON(error) << endl;
+        } else if (options.empty()) {
+            out << "{\"error\":\"No trip found\"}" << endl;
+        } else {
+            {
+                JsonWriter w(&out);
+                w.raw("{\"success\":true,\"date\":").str(formatServiceDate(q.date)).raw(",\"options\":[");
+                for (size_t i = 0; i < options.size(); i++) {
+                    if (i > 0) w.raw(",");
+                    w.raw("{");
+                    journeyFields(w, tt, q.date, options[i].dep, options[i].arr, options[i].legs);
+                    w.raw("}");
                 }
+                w.raw("]}");
             }
-            
-            oss << "],\"totalDistance\":" << fixed << setprecision(2) << totalDistance
-                << ",\"totalFare\":" << fixed << setprecision(2) << totalFare
-                << ",\"stops\":" << (int)path.size()
-                << "}";
-            
-            cout << oss.str() << endl;
+            out << endl;
+        }
+    }
+    else if (cmd == "getTripSeats") {
+        const Timetable& tt = ensureTimetable();
+        const Trip* trip = findTrip(tt, req.str("tripID"));
+        string from = req.str("from"), to = req.str("to");
+        int date, weekday, source, target;
+        uint32_t board = 0, alight = 0;
+        if (!trip) {
+            out << "{\"error\":\"Trip does not exist\"}" << endl;
+        } else if (!parseServiceDate(req.str("date"), date, weekday)) {
+            out << "{\"error\":\"Invalid date\"}" << endl;
+        } else if ((!from.empty() || !to.empty()) &&
+                   (!resolveStops(from, to, source, target) || !tripSegment(tt, *trip, source, target, board, alight))) {
+            out << errorJSON("Trip does not run from " + from + " to " + to) << endl;
+        } else {
+            uint64_t legs = from.empty() && to.empty() ? WHOLE_TRIP : tripSegmentLegs(board, alight + 1);
+            { JsonWriter w(&out); tripSeatsToJSON(w, *trip, date, legs); }
+            out << endl;
+        }
+    }
+    
+    else if (cmd == "findRoutesPareto") {
+        string from = req.str("from");
+        string to = req.str("to");
+        string maxLegsStr = req.str("maxLegs");
+        int maxLegs = PARETO_DEFAULT_LEGS;
+        if (!maxLegsStr.empty() && (!parseNumber(maxLegsStr, maxLegs) || maxLegs < 1 || maxLegs > PARETO_MAX_LEGS)) {
+            out << "{\"error\":\"Invalid maxLegs\"}" << endl;
+            return 1;
+        }
+        
+        bool truncated;
+        vector<vector<int>> paths = findRoutesPareto(from, to, maxLegs, &truncated);
+        
+        if (paths.empty()) {
+            out << (truncated ? "{\"error\":\"No route found before the search limit\"}"
+                              : "{\"error\":\"No route found\"}") << endl;
+        } else {
+            {
+                JsonWriter w(&out);
+                // truncated: the search limit cut the search short, so
+                // the options may be incomplete
+                w.raw("{\"success\":true,\"truncated\":").raw(truncated ? "true" : "false")
+                 .raw(",\"options\":[");
+                for (size_t i = 0; i < paths.size(); i++) {
+                    if (i > 0) w.raw(",");
+                    w.raw("{");
+                    routePathFields(w, paths[i]);
+                    w.raw("}");
+                }
+                w.raw("]}");
+            }
+            out << endl;
         }
     }
     
     else {
-        cout << "{\"error\":\"Unknown command: " << cmd << "\"}" << endl;
+        out << errorJSON("Unknown command: " + cmd) << endl;
+        return 1;
+    }
+    
+    return 0;
+}
+
+void loadTextData() {
+    loadUsers();
+    loadBookings();
+    loadSeatState();
+}
+
+// Text files whose index is current stay on disk and are read as commands
+// need them. The others are loaded now, which also rebuilds their index.
+void openTextData() {
+    if (openTextIndex(usersText)) usersLoaded = false;
+    else loadUsers();
+    if (openTextIndex(bookingsText)) {
+        bookingsLoaded = bookingIndexComplete = false;
+        raiseNextBookingID(bookingsText.header->nextBookingID);
+    } else {
+        loadBookings();
+    }
+    if (openTextIndex(seatsText)) seatsLoaded = false;
+    else loadSeatState();
+}
+
+void loadAllData() {
+    // Nothing is parsed up front if it does not have to be. Records are
+    // faulted in from the mapped binary snapshot, or read through the text
+    // files' indexes, as commands touch them; routes.txt is read by the
+    // first command that needs routes.
+    if (!openSnapshot()) {
+        openTextData();
+    }
+    replayJournal();
+}
+
+// ========================
+// Daemon Mode (--serve)
+// ========================
+// Loads state once and answers newline-delimited JSON commands, one
+// response line per command, until EOF or SIGINT/SIGTERM.
+
+volatile sig_atomic_t stopRequested = 0;
+
+void handleStopSignal(int) {
+    stopRequested = 1;
+}
+
+// Returns "" when a listing was left in *deferred for the caller to write.
+string runCommandLine(string_view line, ListQuery* deferred = nullptr) {
+    refreshRoutesIfChanged();
+    expireHolds();
+    ostringstream out;
+    try {
+        if (processCommand(line, out, deferred) == COMMAND_DEFERRED) return string();
+    } catch (const exception& e) {
+        // A malformed request (e.g. stoi on a missing field) must not take
+        // the whole daemon down with it
+        out.str("");
+        out << "{\"error\":\"Invalid request\"}" << endl;
+    }
+    string response = out.str();
+    if (response.empty() || response.back() != '\n') response += '\n';
+    return response;
+}
+
+// Makes pending mutations durable before their responses are released.
+void commitJournal() {
+    flushJournal();
+    maybeCompactJournal(true);
+}
+
+int serveStdio() {
+    ios::sync_with_stdio(false);
+    string line, held;
+    while (!stopRequested && getline(cin, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == string::npos) continue;
+        ListQuery listing;
+        string response = runCommandLine(line, &listing);
+        if (response.empty()) {
+            // Written straight to stdout, after every earlier response
+            commitJournal();
+            cout << held;
+            held.clear();
+            {
+                JsonWriter w(&cout);
+                writeList(listing, w);
+                w.raw("\n");
+            }
+            cout << flush;
+            continue;
+        }
+        held += response;
+        // Keep batching while more commands are already buffered and the
+        // group commit window is still open
+        if (journalWithinWindow() && cin.rdbuf()->in_avail() > 0) continue;
+        commitJournal();
+        cout << held << flush;
+        held.clear();
+    }
+    commitJournal();
+    cout << held << flush;
+    return 0;
+}
+
+#ifndef _WIN32
+struct ClientConn {
+    int fd;
+    string in;
+    string out;
+    string held; // responses waiting for the next journal flush
+    bool closing;
+    unique_ptr<ListQuery> listing; // being written; later lines wait in `in`
+};
+
+// Runs the complete lines buffered for c. A listing stops the loop: its
+// records are produced by pumpListing as c's output drains.
+void runClientLines(ClientConn& c) {
+    size_t start = 0, nl;
+    while (!c.listing && (nl = c.in.find('\n', start)) != string::npos) {
+        string line = c.in.substr(start, nl - start);
+        start = nl + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == string::npos) continue;
+        ListQuery listing;
+        string response = runCommandLine(line, &listing);
+        if (response.empty()) {
+            // The listing follows every earlier response to this client
+            if (journalHasPending()) commitJournal();
+            c.out += c.held;
+            c.held.clear();
+            c.listing.reset(new ListQuery(listing));
+            JsonWriter w;
+            writeListHead(*c.listing, w);
+            c.out += w.str();
+        } else if (journalHasPending() || !c.held.empty()) {
+            c.held += response;
+        } else {
+            c.out += response;
+        }
+    }
+    c.in.erase(0, start);
+}
+
+// Tops c's output up with the next records of its listing, keeping at
+// most about LIST_PUMP_BYTES queued however large the table is.
+void pumpListing(ClientConn& c) {
+    while (c.listing && c.out.size() < LIST_PUMP_BYTES) {
+        JsonWriter w;
+        writeListItems(*c.listing, w, LIST_PUMP_ITEMS);
+        if (c.listing->finished()) {
+            writeListTail(*c.listing, w);
+            w.raw("\n");
+            c.listing.reset();
+        }
+        c.out += w.str();
+        if (!c.listing) runClientLines(c);
+    }
+}
+
+void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Single-threaded poll() loop: commands from all connections run one at a
+// time on this thread, so the route and ledger locks are never contended.
+int serveSocket(const string& path) {
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        cerr << "socket: " << strerror(errno) << endl;
+        return 1;
+    }
+    
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Socket path too long: " << path << endl;
+        return 1;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 64) < 0) {
+        cerr << "bind/listen " << path << ": " << strerror(errno) << endl;
+        close(listenFd);
         return 1;
     }
+    setNonBlocking(listenFd);
+    
+    vector<ClientConn> clients;
+    vector<pollfd> fds;
+    char buf[65536];
+    
+    while (!stopRequested) {
+        fds.clear();
+        fds.push_back({listenFd, POLLIN, 0});
+        for (const ClientConn& c : clients) {
+            short events = POLLIN;
+            if (!c.out.empty() || c.listing) events |= POLLOUT;
+            fds.push_back({c.fd, events, 0});
+        }
+        
+        int timeoutMs = journalHasPending() ? journalWindowRemainingMs() : 1000;
+        if (poll(fds.data(), fds.size(), timeoutMs) < 0) {
+            if (errno == EINTR) continue;
+            cerr << "poll: " << strerror(errno) << endl;
+            break;
+        }
+        
+        for (size_t i = 1; i < fds.size(); i++) {
+            ClientConn& c = clients[i - 1];
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = read(c.fd, buf, sizeof(buf));
+                if (n > 0) {
+                    c.in.append(buf, n);
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    c.closing = true;
+                }
+                runClientLines(c);
+            }
+        }
+        
+        // Holds lapse on the clock, not only when a command arrives
+        expireHolds();
+        
+        // One sync covers every mutation collected in this window
+        if (journalHasPending() && !journalWithinWindow()) {
+            commitJournal();
+        }
+        
+        for (size_t i = 1; i < fds.size(); i++) {
+            ClientConn& c = clients[i - 1];
+            if (!journalHasPending() && !c.held.empty()) {
+                c.out += c.held;
+                c.held.clear();
+            }
+            pumpListing(c);
+            if (!c.out.empty()) {
+                ssize_t n = write(c.fd, c.out.data(), c.out.size());
+                if (n > 0) {
+                    c.out.erase(0, n);
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    c.out.clear();
+                    c.listing.reset();
+                    c.closing = true;
+                }
+            }
+        }
+        
+        for (size_t i = clients.size(); i-- > 0;) {
+            if (clients[i].closing && clients[i].out.empty() && clients[i].held.empty() &&
+                !clients[i].listing) {
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+                setNonBlocking(fd);
+                clients.push_back({fd, "", "", "", false, nullptr});
+            }
+        }
+    }
+    
+    commitJournal();
+    for (const ClientConn& c : clients) close(c.fd);
+    close(listenFd);
+    unlink(path.c_str());
+    return 0;
+}
+#endif
+
+// ========================
+// Batch Mode (--batch)
+// ========================
+// Runs a whole job in one process: a JSON array of commands or NDJSON on
+// stdin, executed in order against one loaded state, answered with one
+// JSON array of responses in the same order. Mutations are journaled as
+// usual but synced once at the end, or every checkpointEvery commands.
+// An atomic batch stops at the first error and rolls every earlier
+// command back, so it either applies completely or not at all.
+
+// Splits a top-level JSON array into its elements, or NDJSON into lines;
+// the commands are views into input.
+vector<string_view> splitBatchCommands(const string& input) {
+    vector<string_view> commands;
+    size_t start = input.find_first_not_of(" \t\r\n");
+    if (start == string::npos) return commands;
+    
+    if (input[start] != '[') {
+        while (start < input.size()) {
+            size_t nl = input.find('\n', start);
+            if (nl == string::npos) nl = input.size();
+            string_view line(input.data() + start, nl - start);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.find_first_not_of(" \t") != string_view::npos) commands.push_back(line);
+            start = nl + 1;
+        }
+        return commands;
+    }
+    
+    // One pass over the whole array: elements end at commas one level in
+    const char* element = input.data() + start + 1;
+    int depth = 0;
+    auto add = [&](const char* stop) {
+        string_view text(element, stop - element);
+        size_t first = text.find_first_not_of(" \t\r\n");
+        if (first == string_view::npos) return;
+        size_t last = text.find_last_not_of(" \t\r\n");
+        commands.push_back(text.substr(first, last - first + 1));
+    };
+    scanJsonStructure(input.data() + start, input.data() + input.size(), [&](const char* pos, char kind) {
+        if (kind == '[') {
+            depth++;
+        } else if (kind == ']') {
+            if (--depth == 0) {
+                add(pos);
+                return false;
+            }
+        } else if (depth == 1) {
+            add(pos);
+            element = pos + 1;
+        }
+        return true;
+    });
+    return commands;
+}
+
+bool isErrorResponse(const string& response) {
+    return response.compare(0, 9, "{\"error\":") == 0;
+}
+
+int runBatch(const string& input, size_t checkpointEvery, bool atomic, ostream& out) {
+    vector<string_view> commands = splitBatchCommands(input);
+    vector<string> responses;
+    responses.reserve(commands.size());
+    int status = 0;
+    
+    if (atomic) beginUndo();
+    for (size_t i = 0; i < commands.size(); i++) {
+        ListQuery listing;
+        string response = runCommandLine(commands[i], &listing);
+        if (response.empty()) {
+            // Every response is one element of the result array
+            listing.stream = false;
+            JsonWriter w;
+            writeList(listing, w);
+            response = move(w.str());
+        } else {
+            response.pop_back(); // newline
+        }
+        bool failed = isErrorResponse(response);
+        responses.push_back(response);
+        if (failed) status = 1;
+        if (failed && atomic) {
+            rollbackUndo();
+            for (size_t j = 0; j < i; j++) responses[j] = "{\"error\":\"Rolled back\"}";
+            responses.resize(commands.size(), "{\"error\":\"Not run\"}");
+            break;
+        }
+        if (!atomic && checkpointEvery > 0 && (i + 1) % checkpointEvery == 0) flushJournal();
+    }
+    if (atomic) endUndo();
     
+    string result = "[";
+    for (size_t i = 0; i < responses.size(); i++) {
+        if (i > 0) result += ",";
+        result += responses[i];
+    }
+    result += "]";
+    out << result << endl;
+    return status;
+}
+
+// ========================
+// Snapshot Maintenance
+// ========================
+
+// Folds data_*.txt and the journal into a fresh binary snapshot.
+int convertToBinarySnapshot() {
+    if (!lockDataFiles()) {
+        cerr << DAEMON_RUNNING_ERROR << endl;
+        return 1;
+    }
+    loadTextData();
+    replayJournal();
+    openJournal();
+    if (!rotateJournal()) {
+        cerr << "Could not rotate " << JOURNAL_FILE << endl;
+        return 1;
+    }
+    useBinarySnapshot = true;
+    ensureTripSeats();
+    writeSnapshot(users, bookings, seatInventory, tripInventory);
+    cout << "{\"success\":true,\"users\":" << users.size()
+         << ",\"bookings\":" << bookings.size()
+         << ",\"seats\":" << totalSeatCount() << "}" << endl;
+    return 0;
+}
+
+// Writes the current state (snapshot + journal) back out as data_*.txt.
+int exportTextFiles() {
+    if (!lockDataFiles()) {
+        cerr << DAEMON_RUNNING_ERROR << endl;
+        return 1;
+    }
+    loadAllData();
+    ensureAllData();
+    saveUsers(users);
+    saveBookings(bookings);
+    saveSeatState(seatInventory);
+    saveTripSeats(tripInventory);
+    cout << "{\"success\":true,\"users\":" << users.size()
+         << ",\"bookings\":" << bookings.size()
+         << ",\"seats\":" << totalSeatCount() << "}" << endl;
+    return 0;
+}
+
+// Builds the route index for the current routes.txt.
+int buildRouteIndexFile() {
+    loadRoutesFromFile();
+    auto started = chrono::steady_clock::now();
+    ChIndex byCriteria[2] = {
+        buildContractionHierarchy(routeGraph, routeGraph.edgeDistance),
+        buildContractionHierarchy(routeGraph, routeGraph.edgePrice)
+    };
+    long long buildMs = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - started).count();
+    if (!saveRouteIndex(byCriteria)) {
+        cout << "{\"error\":\"Could not write " << ROUTE_INDEX_FILE << "\"}" << endl;
+        return 1;
+    }
+    struct stat st;
+    long long bytes = (stat(ROUTE_INDEX_FILE.c_str(), &st) == 0) ? st.st_size : 0;
+    size_t original = 0, shortcuts = 0;
+    for (const ChArc& a : byCriteria[BY_DISTANCE].arcs) (a.edge >= 0 ? original : shortcuts)++;
+    cout << "{\"success\":true,\"stops\":" << routeGraph.stopCount()
+         << ",\"routes\":" << routeGraph.edgeTo.size()
+         << ",\"arcs\":" << original
+         << ",\"distanceShortcuts\":" << shortcuts
+         << ",\"priceShortcuts\":" << byCriteria[BY_PRICE].arcs.size() - original
+         << ",\"buildMs\":" << buildMs
+         << ",\"bytes\":" << bytes << "}" << endl;
+    return 0;
+}
+
+int verifySnapshotFile() {
+    if (!openSnapshot()) {
+        cout << "{\"error\":\"No valid snapshot at " << SNAPSHOT_FILE << "\"}" << endl;
+        return 1;
+    }
+    if (!verifySnapshotData(snapshot)) {
+        cout << "{\"error\":\"Snapshot data checksum mismatch\"}" << endl;
+        return 1;
+    }
+    const SnapHeader* h = snapshot.header;
+    cout << "{\"success\":true,\"version\":" << h->version
+         << ",\"users\":" << h->userCount
+         << ",\"bookings\":" << h->bookingCount
+         << ",\"seats\":" << h->seatCount
+         << ",\"bytes\":" << snapshot.size << "}" << endl;
     return 0;
-}
\ No newline at end of file
+}
+
+// ========================
+// Booking Stress Test (--stress-booking)
+// ========================
+// Runs bookSeats and cancelBooking from many threads against a synthetic
+// in-memory inventory; nothing under backend/ is read or written. After
+// each run it checks that no seat is held by two active bookings, that
+// every active booking still holds all of its seats, and that each route's
+// counters match its bitsets. Prints one JSON line per run: every thread
+// on a few hot routes, then each thread on a route of its own, for 1, 2,
+// 4, ... threads.
+
+struct StressRun {
+    int threads;
+    bool hot;
+    int hotRoutes;
+    int seatsPerRoute;
+    int opsPerThread;
+};
+
+struct StressCounts {
+    long long attempts = 0;
+    long long booked = 0;
+    long long conflicts = 0;
+    long long cancelled = 0;
+};
+
+void resetStressState() {
+    users.clear();
+    bookings.clear();
+    bookingIndex = BookingIndex();
+    seatInventory.clear();
+    journal.txn.clear();
+    journal.pending.clear();
+    nextBookingID = 1;
+}
+
+void stressWorker(const StressRun& run, int t, StressCounts& counts) {
+    mt19937 rng(12345 + t);
+    string userID = "stress" + to_string(t);
+    deque<string> held;
+    vector<string> seatIDs;
+    for (int op = 0; op < run.opsPerThread; op++) {
+        if (!held.empty() && (held.size() > 8 || rng() % 3 == 0)) {
+            if (cancelBooking(held.front(), userID)) counts.cancelled++;
+            held.pop_front();
+            continue;
+        }
+        int routeID = run.hot ? 1 + (int)(rng() % run.hotRoutes) : 1000 + t;
+        seatIDs.clear();
+        int seats = 1 + (int)(rng() % 4);
+        for (int i = 0; i < seats; i++) {
+            seatIDs.push_back(makeSeatID(routeID, (int)(rng() % run.seatsPerRoute)));
+        }
+        counts.attempts++;
+        string result = bookSeats(routeID, "stress", userID, seatIDs, 1.0);
+        if (result.compare(0, 6, "ERROR:") == 0) {
+            counts.conflicts++;
+        } else {
+            counts.booked++;
+            held.push_back(result);
+        }
+        // Nothing flushes the journal here; keep it from growing
+        if (op % 1024 == 0) {
+            lock_guard<mutex> ledger(ledgerMutex);
+            journal.pending.clear();
+        }
+    }
+}
+
+// Number of problems found in the final state; details go to stderr.
+long long checkStressState() {
+    long long problems = 0;
+    map<pair<int, int>, Sym> holder; // seat -> active booking holding it
+    for (const auto& pair : bookings) {
+        const Booking& b = pair.second;
+        if (b.status != SYM_ACTIVE) continue;
+        for (Sym seatID : b.seatIDs) {
+            int routeID, index;
+            parseSeatID(sv(seatID), routeID, index);
+            auto inserted = holder.emplace(make_pair(routeID, index), b.bookingID);
+            if (!inserted.second) {
+                cerr << "double booking: " << sv(seatID) << " in " << sv(inserted.first->second)
+                     << " and " << sv(b.bookingID) << endl;
+                problems++;
+            }
+            const RouteSeats& route = seatInventory[routeID];
+            if (route.status(index) != SEAT_BOOKED || route.bookingIDs[index] != b.bookingID) {
+                cerr << "lost seat: " << sv(seatID) << " of " << sv(b.bookingID) << endl;
+                problems++;
+            }
+        }
+    }
+    for (const auto& pair : seatInventory) {
+        const RouteSeats& route = pair.second;
+        int present = 0, booked = 0;
+        for (size_t w = 0; w < route.present.size(); w++) {
+            present += __builtin_popcountll(route.present[w]);
+            booked += __builtin_popcountll(route.booked[w]);
+        }
+        if (route.total() != present || route.bookedCount != booked) {
+            cerr << "route " << route.routeID << ": counters do not match its seats" << endl;
+            problems++;
+        }
+        if (booked != (int)count_if(holder.begin(), holder.end(),
+                [&](const auto& h) { return h.first.first == route.routeID; })) {
+            cerr << "route " << route.routeID << ": booked seats without an active booking" << endl;
+            problems++;
+        }
+    }
+    return problems;
+}
+
+long long runStress(const StressRun& run) {
+    resetStressState();
+    int routeCount = run.hot ? run.hotRoutes : run.threads;
+    for (int r = 0; r < routeCount; r++) {
+        initializeSeatsForRoute(run.hot ? 1 + r : 1000 + r, run.seatsPerRoute);
+    }
+    for (int t = 0; t < run.threads; t++) {
+        string userID = "stress" + to_string(t);
+        createUser(userID, userID, userID + "@example.com");
+    }
+    journal.pending.clear();
+    
+    vector<StressCounts> counts(run.threads);
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < run.threads; t++) {
+        workers.emplace_back(stressWorker, cref(run), t, ref(counts[t]));
+    }
+    for (thread& worker : workers) worker.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    StressCounts total;
+    for (const StressCounts& c : counts) {
+        total.attempts += c.attempts;
+        total.booked += c.booked;
+        total.conflicts += c.conflicts;
+        total.cancelled += c.cancelled;
+    }
+    long long problems = checkStressState();
+    long long ops = total.attempts + total.cancelled;
+    
+    JsonWriter w;
+    w.raw("{\"mode\":").str(run.hot ? "hot" : "disjoint")
+     .raw(",\"threads\":").num((long long)run.threads)
+     .raw(",\"routes\":").num((long long)routeCount)
+     .raw(",\"attempts\":").num(total.attempts)
+     .raw(",\"booked\":").num(total.booked)
+     .raw(",\"conflicts\":").num(total.conflicts)
+     .raw(",\"cancelled\":").num(total.cancelled)
+     .raw(",\"seconds\":").num(seconds, 3)
+     .raw(",\"opsPerSec\":").num((long long)(ops / seconds))
+     .raw(",\"problems\":").num(problems)
+     .raw("}");
+    cout << w.str() << endl;
+    return problems;
+}
+
+int runStressTests(int maxThreads, int opsPerThread) {
+    long long problems = 0;
+    for (bool hot : {true, false}) {
+        for (int threads = 1;; threads = min(threads * 2, maxThreads)) {
+            problems += runStress({threads, hot, 4, 40, opsPerThread});
+            if (threads == maxThreads) break;
+        }
+    }
+    resetStressState();
+    return problems == 0 ? 0 : 1;
+}
+
+// ========================
+// Entry Point
+// ========================
+// backend/bench.cpp includes this file with LOGIC_NO_MAIN defined, to time
+// the functions above without a main of its own.
+#ifndef LOGIC_NO_MAIN
+
+// Usage:
+//   logic                          one JSON command on stdin (spawn per call)
+//   logic --serve                  NDJSON commands on stdin, responses on stdout;
+//                                  one-shot and batch runs fail while it runs
+//   logic --serve --socket <path>  NDJSON commands over a Unix domain socket
+//   logic --batch                  JSON array or NDJSON of commands on stdin,
+//                                  one JSON array of responses on stdout
+// Options:
+//   --group-commit-ms <n>   wait up to n ms to batch journal syncs (default 0)
+//   --compact-bytes <n>     compact the journal once it reaches n bytes
+//   --route-cache <n>       findRoute responses kept in the LRU cache (default 1024, 0 = off)
+//   --checkpoint <n>        --batch: sync the journal every n commands (default: at the end)
+//   --atomic                --batch: stop at the first error and roll the whole batch back
+//   --metrics-file <path>   append a JSON line of metrics when the process exits
+//                           (default $LOGIC_METRICS_FILE)
+// Maintenance:
+//   logic --convert-snapshot       data_*.txt + journal -> data_snapshot.bin
+//   logic --export-text            current state -> data_*.txt
+//   logic --verify-snapshot        check data_snapshot.bin checksums
+//   logic --build-route-index      routes.txt -> routes.ch (findRoute index)
+//   logic --stress-booking [--threads <n>] [--stress-ops <n>]
+//                                  concurrent booking check and throughput
+
+int main(int argc, char* argv[]) {
+    bool serve = false;
+    bool batch = false;
+    bool atomic = false;
+    size_t checkpointEvery = 0;
+    string socketPath;
+    bool stressBooking = false;
+    int stressThreads = max(1, (int)thread::hardware_concurrency());
+    int stressOps = 20000;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--atomic") {
+            atomic = true;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointEvery = stoull(argv[++i]);
+        } else if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--group-commit-ms" && i + 1 < argc) {
+            groupCommitMs = stoi(argv[++i]);
+        } else if (arg == "--compact-bytes" && i + 1 < argc) {
+            compactThresholdBytes = stoull(argv[++i]);
+        } else if (arg == "--route-cache" && i + 1 < argc) {
+            routeCache.capacity = stoull(argv[++i]);
+        } else if (arg == "--metrics-file" && i + 1 < argc) {
+            metricsFile = argv[++i];
+        } else if (arg == "--convert-snapshot") {
+            return convertToBinarySnapshot();
+        } else if (arg == "--export-text") {
+            return exportTextFiles();
+        } else if (arg == "--verify-snapshot") {
+            return verifySnapshotFile();
+        } else if (arg == "--build-route-index") {
+            return buildRouteIndexFile();
+        } else if (arg == "--stress-booking") {
+            stressBooking = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            stressThreads = max(1, stoi(argv[++i]));
+        } else if (arg == "--stress-ops" && i + 1 < argc) {
+            stressOps = max(1, stoi(argv[++i]));
+        } else {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+    
+    if (stressBooking) {
+        return runStressTests(stressThreads, stressOps);
+    }
+    if (metricsFile.empty() && getenv("LOGIC_METRICS_FILE")) {
+        metricsFile = getenv("LOGIC_METRICS_FILE");
+    }
+    
+    if (batch) {
+        ostringstream input;
+        {
+            METRIC_PHASE(PHASE_READ_INPUT);
+            input << cin.rdbuf();
+        }
+        if (!lockDataFiles()) {
+            cout << errorJSON(DAEMON_RUNNING_ERROR) << endl;
+            return 1;
+        }
+        loadAllData();
+        int status = runBatch(input.str(), checkpointEvery, atomic, cout);
+        {
+            METRIC_PHASE(PHASE_WRITE_OUTPUT);
+            cout.flush();
+        }
+        flushJournal();
+        saveRouteCache();
+        maybeCompactJournal(false);
+        appendMetricsLine("batch", status);
+        return status;
+    }
+    
+    if (!serve) {
+        ostringstream input;
+        {
+            METRIC_PHASE(PHASE_READ_INPUT);
+            input << cin.rdbuf();
+        }
+        if (!lockDataFiles()) {
+            cout << errorJSON(DAEMON_RUNNING_ERROR) << endl;
+            return 1;
+        }
+        loadAllData();
+        expireHolds();
+        int status;
+        try {
+            status = processCommand(input.str(), cout);
+        } catch (const exception& e) {
+            // Same answer runCommandLine gives, instead of an abort
+            cout << "{\"error\":\"Invalid request\"}" << endl;
+            status = 1;
+        }
+        {
+            METRIC_PHASE(PHASE_WRITE_OUTPUT);
+            cout.flush();
+        }
+        flushJournal();
+        saveRouteCache();
+        maybeCompactJournal(false);
+        appendMetricsLine("oneshot", status);
+        return status;
+    }
+    
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    
+    if (!lockDataFiles(true)) {
+        cerr << "Another logic --serve is using the data files" << endl;
+        return 1;
+    }
+    loadAllData();
+    int status;
+    if (socketPath.empty()) {
+        status = serveStdio();
+    } else {
+#ifndef _WIN32
+        status = serveSocket(socketPath);
+#else
+        cerr << "--socket is not supported on Windows; use --serve over stdin/stdout" << endl;
+        status = 1;
+#endif
+    }
+    waitForCompaction();
+    saveRouteCache();
+    unmarkDataFiles();
+    appendMetricsLine("serve", status);
+    return status;
+}
+
+#endif // LOGIC_NO_MAIN
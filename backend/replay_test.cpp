@@ -0,0 +1,94 @@
+// Journal replay checks for logic.cpp.
+//
+// Writes a data_journal.txt in a scratch directory, loads it the way
+// every run does (loadAllData), and checks what survived: committed
+// groups apply, records with damaged fields are skipped without stopping
+// the replay, and an uncommitted or torn tail is ignored and cut off.
+// Prints one line per check and exits 1 if any failed.
+//
+// Usage: make test
+
+#define LOGIC_NO_MAIN
+#include "logic.cpp"
+
+#include <filesystem>
+
+int failures = 0;
+
+void check(bool ok, const string& what) {
+    cout << (ok ? "ok   " : "FAIL ") << what << endl;
+    if (!ok) failures++;
+}
+
+bool hasUser(string_view userID) {
+    Sym id;
+    return symbols.lookup(userID, id) && users.count(id);
+}
+
+bool hasBooking(string_view bookingID) {
+    Sym id;
+    return symbols.lookup(bookingID, id) && bookings.count(id);
+}
+
+SeatStatus seatStatus(int routeID, int index) {
+    auto it = seatInventory.find(routeID);
+    if (it == seatInventory.end() || !it->second.exists(index)) return SEAT_AVAILABLE;
+    return it->second.status(index);
+}
+
+int main() {
+    error_code ec;
+    filesystem::path home = filesystem::current_path(ec);
+    filesystem::path dir;
+    if (!ec) dir = filesystem::temp_directory_path(ec) / ("logic-replay-" + to_string(random_device{}()));
+    if (!ec && filesystem::create_directories(dir / "backend", ec)) filesystem::current_path(dir, ec);
+    else if (!ec) ec = make_error_code(errc::file_exists);
+    if (ec) {
+        cerr << "Cannot create a scratch directory: " << ec.message() << endl;
+        return 1;
+    }
+
+    const string committed =
+        "U|1|Asha|a@x|1|19.00\n"
+        "S|R1S1|Booked|1|1|BK1\n"
+        "B|BK1|1|A → B|1|R1S1|19.00|2026-10-17 09:00:00|Active\n"
+        "C|\n"
+        // Damaged numbers: each record is dropped, its neighbours are not
+        "U|2|Ravi|r@x|x|0.00\n"
+        "U|3|Mira|m@x|0|1.5abc\n"
+        "B|BK9|x|A → B|1|R1S2|19.00|2026-10-17 09:00:00|Active\n"
+        "B|BK8|1|A → B|1|R1S2|abc|2026-10-17 09:00:00|Active\n"
+        "S|R1S3|Reserved|1|1||zz\n"
+        "U|4|Lena|l@x|0|0.00\n"
+        "S|R1S4|Reserved|4|1||1999999999\n"
+        "C|\n";
+    const string tail =
+        "U|5|Tail|t@x|0|0.00\n"   // never committed
+        "B|BK2|1|A → B|1|R1S5|19.00|2026-10-17 09:00:00|Active\n"
+        "C|";                     // torn: no newline
+    {
+        ofstream journalFile(JOURNAL_FILE, ios::binary);
+        journalFile << committed << tail;
+    }
+
+    loadAllData();
+
+    check(hasUser("1") && hasBooking("BK1"), "committed records apply");
+    check(seatStatus(1, 0) == SEAT_BOOKED, "committed seat is booked");
+    check(!hasUser("2") && !hasUser("3"), "user records with bad numbers are skipped");
+    check(!hasBooking("BK9") && !hasBooking("BK8"), "booking records with bad numbers are skipped");
+    check(seatStatus(1, 2) == SEAT_AVAILABLE, "seat record with a bad deadline is skipped");
+    check(hasUser("4") && seatStatus(1, 3) == SEAT_RESERVED, "records after a bad one still apply");
+    check(nextBookingID.load() == 2, "skipped bookings leave the booking counter alone");
+    check(!hasUser("5") && !hasBooking("BK2"), "uncommitted tail is not applied");
+    check(journalValidBytes == (long long)committed.size(), "replay stops at the last commit marker");
+
+    openJournal();
+    closeFile(journal.fd);
+    journal.fd = -1;
+    check(filesystem::file_size(JOURNAL_FILE, ec) == committed.size(), "torn tail is cut off the journal");
+
+    filesystem::current_path(home, ec);
+    filesystem::remove_all(dir, ec);
+    return failures ? 1 : 0;
+}
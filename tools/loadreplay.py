@@ -0,0 +1,450 @@
+"""Replay a trace of JSON commands against backend/logic and report latency.
+
+The trace is NDJSON, one command per line, either read with --trace or
+generated from a mix profile (default 80% findRoute, 15% getSeats, 5%
+bookSeats). Each mode replays it against a fresh scratch copy of the data
+files, so the repository's own data is never touched:
+  * spawn   - one `backend/logic` process per command (like call_cpp_logic_once)
+  * pipe    - one `backend/logic --serve` process over stdin/stdout
+  * socket  - one `backend/logic --serve --socket` process, one connection per worker
+With --connect PATH the trace goes to an already running socket daemon
+instead, and its data is used as is.
+
+Load is closed-loop (--concurrency workers, each sending its next command
+when the last one is answered) or open-loop at --rate commands/s. In
+open-loop mode latency counts from the time a command was due, so queueing
+behind a slow backend shows up in the percentiles.
+
+Afterwards the final seat state is read back and checked against the
+bookings the trace made. Every seat of a successful booking must still be
+Booked by it, no seat may be in two of them, and each route's booked count
+must have grown by exactly the seats booked.
+
+Prints one JSON report per mode. Run from the repo root after `make`:
+
+    python tools/loadreplay.py --requests 2000 --mode spawn,pipe,socket
+    python tools/loadreplay.py --generate-only --requests 10000 > trace.ndjson
+    python tools/loadreplay.py --trace trace.ndjson --mode socket --concurrency 8
+    python tools/loadreplay.py --trace trace.ndjson --mode pipe --rate 500
+"""
+import argparse
+import json
+import math
+import os
+import random
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from collections import Counter, defaultdict
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BINARY = os.path.join(REPO, 'backend', 'logic.exe' if os.name == 'nt' else 'logic')
+DATA_FILES = ['routes.txt', 'data_users.txt', 'data_bookings.txt', 'data_seats.txt']
+REPLAY_USER = 'loadreplay'
+
+DEFAULT_MIX = 'findRoute=80,getSeats=15,bookSeats=5'
+
+
+# =======================
+# Trace generation
+# =======================
+def read_network(backend_dir):
+    """stop -> stops it has a route to"""
+    network = defaultdict(set)
+    with open(os.path.join(backend_dir, 'routes.txt'), encoding='utf-8') as f:
+        for line in f:
+            parts = line.rstrip('\n').split('|')
+            if len(parts) >= 3 and not line.startswith('#'):
+                network[parts[0]].add(parts[1])
+                network[parts[1]]
+    return network
+
+
+def reachable(network, start):
+    seen = {start}
+    queue = [start]
+    while queue:
+        stop = queue.pop()
+        for nxt in network[stop]:
+            if nxt not in seen:
+                seen.add(nxt)
+                queue.append(nxt)
+    seen.discard(start)
+    return sorted(seen)
+
+
+def read_seat_routes(backend_dir):
+    """routeID -> seat count, from the seat snapshot"""
+    routes = Counter()
+    path = os.path.join(backend_dir, 'data_seats.txt')
+    if os.path.exists(path):
+        with open(path, encoding='utf-8') as f:
+            for line in f:
+                parts = line.rstrip('\n').split('|')
+                if len(parts) >= 4 and parts[3].isdigit():
+                    routes[int(parts[3])] += 1
+    return routes
+
+
+def parse_mix(text):
+    mix = []
+    for item in text.split(','):
+        name, _, weight = item.partition('=')
+        mix.append((name.strip(), float(weight or 1)))
+    return mix
+
+
+def generate_trace(n, mix, seed, backend_dir):
+    rng = random.Random(seed)
+    network = read_network(backend_dir)
+    stops = sorted(network)
+    destinations = {}
+    seat_routes = read_seat_routes(backend_dir)
+    route_ids = sorted(seat_routes) or [1]
+    names = [name for name, _ in mix]
+    weights = [weight for _, weight in mix]
+    trace = []
+    for _ in range(n):
+        name = rng.choices(names, weights)[0]
+        route = rng.choice(route_ids)
+        if name == 'findRoute':
+            # Trips that have a route, as real searches mostly do
+            start = rng.choice(stops)
+            if start not in destinations:
+                destinations[start] = reachable(network, start)
+            if not destinations[start]:
+                start = max(stops, key=lambda s: len(network[s]))
+                destinations.setdefault(start, reachable(network, start))
+            end = rng.choice(destinations[start] or stops)
+            trace.append({'cmd': 'findRoute', 'from': start, 'to': end,
+                          'criteria': rng.choice(['distance', 'ticketPrice'])})
+        elif name in ('getSeats', 'getSeatStats'):
+            trace.append({'cmd': name, 'routeID': str(route)})
+        elif name == 'bookSeats':
+            count = rng.randint(1, 2)
+            seats = rng.sample(range(1, max(2, seat_routes[route]) + 1), count)
+            trace.append({'cmd': 'bookSeats', 'routeID': str(route), 'routeInfo': 'Load replay',
+                          'userID': REPLAY_USER, 'pricePerSeat': '20',
+                          'seatIDs': ['R%dS%d' % (route, s) for s in seats]})
+        else:
+            raise SystemExit('No generator for command %r in the mix' % name)
+    return trace
+
+
+def read_trace(path):
+    with open(path, encoding='utf-8') as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+# =======================
+# Backends
+# =======================
+class SpawnBackend:
+    """One process per command, in the scratch directory"""
+
+    def __init__(self, workdir):
+        self.workdir = workdir
+
+    def connect(self):
+        return self
+
+    def call(self, command):
+        proc = subprocess.run([BINARY], input=json.dumps(command), capture_output=True,
+                              text=True, cwd=self.workdir, timeout=60)
+        return proc.stdout
+
+    def close(self):
+        pass
+
+
+class PipeBackend:
+    """One --serve process; calls from all workers take turns on its pipe"""
+
+    def __init__(self, workdir):
+        self.proc = subprocess.Popen([BINARY, '--serve'], cwd=workdir, stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE, text=True, bufsize=1)
+        self.lock = threading.Lock()
+
+    def connect(self):
+        return self
+
+    def call(self, command):
+        with self.lock:
+            self.proc.stdin.write(json.dumps(command) + '\n')
+            self.proc.stdin.flush()
+            line = self.proc.stdout.readline()
+        if not line:
+            raise RuntimeError('daemon closed the pipe')
+        return line
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait()
+
+
+class SocketConnection:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.reader = self.sock.makefile('r', encoding='utf-8')
+
+    def call(self, command):
+        self.sock.sendall((json.dumps(command) + '\n').encode('utf-8'))
+        line = self.reader.readline()
+        if not line:
+            raise RuntimeError('daemon closed the connection')
+        return line
+
+    def close(self):
+        self.sock.close()
+
+
+class SocketBackend:
+    """A --serve --socket daemon (started here, or already running)"""
+
+    def __init__(self, workdir=None, path=None):
+        self.proc = None
+        self.path = path
+        if path is None:
+            self.path = os.path.join(workdir, 'logic.sock')
+            self.proc = subprocess.Popen([BINARY, '--serve', '--socket', self.path], cwd=workdir)
+            for _ in range(250):
+                if os.path.exists(self.path):
+                    break
+                time.sleep(0.02)
+            else:
+                raise RuntimeError('socket daemon did not start')
+
+    def connect(self):
+        return SocketConnection(self.path)
+
+    def close(self):
+        if self.proc:
+            self.proc.terminate()
+            self.proc.wait()
+
+
+def prepare_workdir():
+    workdir = tempfile.mkdtemp(prefix='loadreplay-')
+    os.mkdir(os.path.join(workdir, 'backend'))
+    for name in DATA_FILES:
+        source = os.path.join(REPO, 'backend', name)
+        if os.path.exists(source):
+            shutil.copy(source, os.path.join(workdir, 'backend', name))
+    return workdir
+
+
+def open_backend(mode, workdir, connect_path):
+    if connect_path:
+        return SocketBackend(path=connect_path)
+    if mode == 'spawn':
+        return SpawnBackend(workdir)
+    if mode == 'pipe':
+        return PipeBackend(workdir)
+    if mode == 'socket':
+        return SocketBackend(workdir=workdir)
+    raise SystemExit('Unknown mode %r' % mode)
+
+
+# =======================
+# Replay
+# =======================
+def replay(backend, trace, concurrency, rate):
+    """Returns per-command (cmd, latency seconds, response text) and wall time"""
+    results = [None] * len(trace)
+    next_index = [0]
+    index_lock = threading.Lock()
+    failures = []
+    start = time.perf_counter()
+
+    def worker():
+        try:
+            conn = backend.connect()
+        except Exception as e:
+            failures.append(str(e))
+            return
+        try:
+            while True:
+                with index_lock:
+                    i = next_index[0]
+                    next_index[0] += 1
+                if i >= len(trace):
+                    return
+                due = start + i / rate if rate else None
+                if due is not None:
+                    delay = due - time.perf_counter()
+                    if delay > 0:
+                        time.sleep(delay)
+                sent = time.perf_counter()
+                response = conn.call(trace[i])
+                done = time.perf_counter()
+                results[i] = (trace[i].get('cmd', ''), done - (due if due is not None else sent), response)
+        except Exception as e:
+            failures.append(str(e))
+        finally:
+            if conn is not backend:
+                conn.close()
+
+    threads = [threading.Thread(target=worker) for _ in range(concurrency)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    if failures:
+        raise RuntimeError('replay failed: ' + failures[0])
+    return results, time.perf_counter() - start
+
+
+# =======================
+# Reporting
+# =======================
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    rank = max(0, math.ceil(p / 100.0 * len(sorted_values)) - 1)
+    return sorted_values[rank]
+
+
+def latency_summary(latencies):
+    ordered = sorted(latencies)
+    ms = lambda s: round(s * 1000, 3)
+    return {
+        'count': len(ordered),
+        'p50_ms': ms(percentile(ordered, 50)),
+        'p90_ms': ms(percentile(ordered, 90)),
+        'p99_ms': ms(percentile(ordered, 99)),
+        'p999_ms': ms(percentile(ordered, 99.9)),
+        'max_ms': ms(ordered[-1]) if ordered else 0.0,
+    }
+
+
+def histogram(latencies):
+    """Counts per power-of-two bucket in microseconds: {"<=64us": n, ...}"""
+    buckets = Counter()
+    for s in latencies:
+        us = max(1, int(s * 1e6))
+        buckets[1 << (us - 1).bit_length()] += 1
+    return {'<=%dus' % bound: buckets[bound] for bound in sorted(buckets)}
+
+
+def is_error(response):
+    return response.lstrip().startswith('{"error"')
+
+
+# =======================
+# Verification
+# =======================
+def booked_seats(seats):
+    """seatID -> (userID, bookingID) for the booked seats in a getAllSeats listing"""
+    return {s['seatID']: (s.get('userID', ''), s.get('bookingID', ''))
+            for s in seats if s.get('status') == 'Booked'}
+
+
+def verify(before, after, results):
+    """Checks the final seats against the bookings the replay made"""
+    problems = []
+    owner = {}
+    added = Counter()
+    for cmd, _, response in results:
+        if cmd != 'bookSeats' or is_error(response):
+            continue
+        booking = json.loads(response).get('booking', {})
+        for seat in booking.get('seatIDs', []):
+            if seat in owner:
+                problems.append('%s booked by both %s and %s' % (seat, owner[seat], booking['bookingID']))
+            owner[seat] = booking['bookingID']
+            added[booking.get('routeID')] += 1
+    for seat, booking_id in owner.items():
+        state = after.get(seat)
+        if state is None:
+            problems.append('%s of %s is not booked' % (seat, booking_id))
+        elif state[1] != booking_id:
+            problems.append('%s belongs to %s, expected %s' % (seat, state[1], booking_id))
+        if seat in before:
+            problems.append('%s was already booked before the replay' % seat)
+    count_before = Counter(int(seat[1:seat.index('S')]) for seat in before)
+    count_after = Counter(int(seat[1:seat.index('S')]) for seat in after)
+    for route in set(count_before) | set(count_after) | set(added):
+        if count_after[route] != count_before[route] + added[route]:
+            problems.append('route %s: %d booked seats, expected %d' %
+                            (route, count_after[route], count_before[route] + added[route]))
+    return {'bookedSeats': len(owner), 'consistent': not problems, 'problems': problems[:20]}
+
+
+def run_mode(mode, trace, args):
+    workdir = None if args.connect else prepare_workdir()
+    backend = open_backend(mode, workdir, args.connect)
+    try:
+        control = backend.connect()
+        control.call({'cmd': 'createUser', 'userID': REPLAY_USER, 'name': 'Load Replay',
+                      'email': 'loadreplay@example.com'})
+        before = booked_seats(json.loads(control.call({'cmd': 'getAllSeats'})))
+        results, wall = replay(backend, trace, args.concurrency, args.rate)
+        after = booked_seats(json.loads(control.call({'cmd': 'getAllSeats'})))
+        if control is not backend:
+            control.close()
+    finally:
+        backend.close()
+        if workdir:
+            shutil.rmtree(workdir, ignore_errors=True)
+
+    by_cmd = defaultdict(list)
+    errors = Counter()
+    for cmd, latency, response in results:
+        by_cmd[cmd].append(latency)
+        if is_error(response):
+            errors[cmd] += 1
+    latencies = [latency for _, latency, _ in results]
+    return {
+        'mode': 'connect' if args.connect else mode,
+        'requests': len(results),
+        'concurrency': args.concurrency,
+        'rate': args.rate,
+        'seconds': round(wall, 3),
+        'throughput_rps': round(len(results) / wall, 1) if wall else 0.0,
+        'latency': latency_summary(latencies),
+        'histogram': histogram(latencies),
+        'commands': {cmd: dict(latency_summary(values), errors=errors[cmd])
+                     for cmd, values in sorted(by_cmd.items())},
+        'verification': verify(before, after, results),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--trace', help='NDJSON trace to replay (default: generate one)')
+    parser.add_argument('--requests', type=int, default=1000, help='length of a generated trace')
+    parser.add_argument('--mix', default=DEFAULT_MIX, help='generated command mix, e.g. ' + DEFAULT_MIX)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--generate-only', action='store_true', help='print the generated trace and exit')
+    parser.add_argument('--mode', default='socket' if hasattr(socket, 'AF_UNIX') else 'pipe',
+                        help='comma-separated: spawn, pipe, socket')
+    parser.add_argument('--connect', help='socket of a running `logic --serve --socket` daemon')
+    parser.add_argument('--concurrency', type=int, default=1, help='closed-loop workers')
+    parser.add_argument('--rate', type=float, default=0, help='open-loop commands per second')
+    args = parser.parse_args()
+    args.concurrency = max(1, args.concurrency)
+
+    if args.trace:
+        trace = read_trace(args.trace)
+    else:
+        trace = generate_trace(args.requests, parse_mix(args.mix), args.seed, os.path.join(REPO, 'backend'))
+    if args.generate_only:
+        for command in trace:
+            print(json.dumps(command))
+        return 0
+
+    consistent = True
+    for mode in args.mode.split(','):
+        report = run_mode(mode.strip(), trace, args)
+        consistent = consistent and report['verification']['consistent']
+        print(json.dumps(report))
+    return 0 if consistent else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())